@@ -0,0 +1,258 @@
+/*
+ * bench_codec.c
+ *
+ *  Benchmark and fuzzer for the incremental frame parser (ws_codec.c).
+ *
+ *  bench: a stream of masked frames is parsed (and unmasked) in segments of
+ *         -g bytes, frames/s and MB/s are reported,
+ *  fuzz:  random frame streams are cut at random points and parsed, every
+ *         payload must match the original; random garbage must not crash
+ *         the parser.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ws_codec.h"
+
+typedef struct{
+	uint8_t *buf;
+	size_t len;
+	size_t cap;
+} stream_t;
+
+typedef struct{
+	uint8_t opcode;
+	uint8_t fin;
+	size_t len;
+	size_t pos;			//payload position in the plain stream
+} frame_info_t;
+
+// ****************************************************************************
+static uint64_t now_ns(void){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// ****************************************************************************
+static void put(stream_t *s, const uint8_t *p, size_t len){
+	if (s -> len + len > s -> cap){
+		s -> cap = (s -> len + len) * 2;
+		s -> buf = realloc(s -> buf, s -> cap);
+	}
+	memcpy(s -> buf + s -> len, p, len);
+	s -> len += len;
+}
+
+// ****************************************************************************
+//append masked frame, the plain payload is appended to "plain"
+static void add_frame(stream_t *s, stream_t *plain, uint8_t opcode,
+		uint8_t fin, size_t len, int force_64){
+	uint8_t hdr[14], mask[4], *p;
+	size_t hlen = 2, start;
+
+	hdr[0] = (fin << 7) | opcode;
+	if ((len <= 125) && !force_64){
+		hdr[1] = 0x80 | len;
+	}
+	else if ((len <= 0xFFFF) && !force_64){
+		hdr[1] = 0x80 | 126;
+		hdr[2] = len >> 8;
+		hdr[3] = len;
+		hlen = 4;
+	}
+	else{
+		hdr[1] = 0x80 | 127;
+		for (int i = 0; i < 8; i++){
+			hdr[2 + i] = (uint64_t)len >> (56 - 8 * i);
+		}
+		hlen = 10;
+	}
+	for (int i = 0; i < 4; i++){
+		mask[i] = rand();
+		hdr[hlen++] = mask[i];
+	}
+	put(s, hdr, hlen);
+	start = plain -> len;
+	for (size_t i = 0; i < len; i++){
+		uint8_t b = rand();
+		put(plain, &b, 1);
+	}
+	p = plain -> buf + start;
+	start = s -> len;
+	put(s, p, len);
+	for (size_t i = 0; i < len; i++){
+		s -> buf[start + i] ^= mask[i & 3];
+	}
+}
+
+// ****************************************************************************
+//parse stream cut in segments, returns number of frames or -1 on mismatch
+static long parse_stream(const stream_t *s, const stream_t *plain,
+		const frame_info_t *fi, size_t frames, size_t seg_min, size_t seg_max,
+		uint8_t *out, size_t out_len){
+	ws_parser_t p;
+	ws_chunk_t chunk;
+	const uint8_t *data;
+	size_t pos = 0, len, seg, nr = 0;
+	WS_PARSE_EVENT ev;
+
+	ws_parser_init(&p);
+	while (pos < s -> len){
+		seg = seg_min;
+		if (seg_max > seg_min){
+			seg += rand() % (seg_max - seg_min + 1);
+		}
+		if (seg > s -> len - pos){
+			seg = s -> len - pos;
+		}
+		data = s -> buf + pos;
+		len = seg;
+		pos += seg;
+		while ((ev = ws_parser_run(&p, &data, &len, &chunk)) != WS_PARSE_NEED_MORE){
+			switch (ev){
+			case WS_PARSE_HEADER:
+				if ((fi != NULL) && ((nr >= frames) || (p.opcode != fi[nr].opcode)
+						|| (p.fin != fi[nr].fin) || (p.len != fi[nr].len))){
+					return -1;
+				}
+				if (p.len > out_len){
+					return nr;
+				}
+				break;
+			case WS_PARSE_PAYLOAD:
+				ws_unmask(out + chunk.offset, chunk.data, chunk.len, p.mask,
+						chunk.offset);
+				break;
+			case WS_PARSE_FRAME_END:
+				if ((fi != NULL) &&
+						(memcmp(out, plain -> buf + fi[nr].pos, fi[nr].len) != 0)){
+					return -1;
+				}
+				nr++;
+				break;
+			case WS_PARSE_ERROR:
+				return (fi != NULL) ? -1 : (long)nr;
+			default:
+				break;
+			}
+		}
+	}
+	return nr;
+}
+
+// ****************************************************************************
+static int fuzz(int iterations){
+	static const uint8_t ops[] = {0x0, 0x1, 0x2, 0x8, 0x9, 0xA};
+	stream_t s = {0}, plain = {0};
+	frame_info_t fi[64];
+	uint8_t *out = malloc(70000);
+	size_t frames;
+	long r;
+
+	for (int it = 0; it < iterations; it++){
+		s.len = plain.len = 0;
+		frames = 1 + rand() % 64;
+		for (size_t i = 0; i < frames; i++){
+			uint8_t op = ops[rand() % sizeof(ops)];
+			size_t len;
+
+			if (op & 0x08){
+				len = rand() % 126;
+				fi[i].fin = 1;
+			}
+			else{
+				switch (rand() % 4){
+				case 0: len = rand() % 126; break;
+				case 1: len = 126 + rand() % 200; break;
+				case 2: len = rand() % 70000; break;
+				default: len = 0; break;
+				}
+				fi[i].fin = rand() & 1;
+			}
+			fi[i].opcode = op;
+			fi[i].len = len;
+			fi[i].pos = plain.len;
+			//control frames always use the 7 bit length
+			add_frame(&s, &plain, op, fi[i].fin, len,
+					((op & 0x08) == 0) && ((rand() % 8) == 0));
+		}
+		r = parse_stream(&s, &plain, fi, frames, 1, 1 + rand() % 3000, out, 70000);
+		if (r != (long)frames){
+			printf("fuzz: mismatch in iteration %i (%li of %zu frames)\n",
+					it, r, frames);
+			return -1;
+		}
+
+		//random garbage, only must not crash or run out of the buffer
+		for (size_t i = 0; i < s.len; i++){
+			if ((rand() % 64) == 0){
+				s.buf[i] = rand();
+			}
+		}
+		parse_stream(&s, &plain, NULL, 0, 1, 1 + rand() % 3000, out, 70000);
+	}
+	printf("fuzz: %i iterations ok\n", iterations);
+	free(out);
+	free(s.buf);
+	free(plain.buf);
+	return 0;
+}
+
+// ****************************************************************************
+static void bench(size_t msg_size, size_t seg, size_t total){
+	stream_t s = {0}, plain = {0};
+	uint8_t *out = malloc(msg_size + 1);
+	size_t frames = total / (msg_size + 6) + 1;
+	uint64_t t0, t1;
+	long r;
+	double sec;
+
+	for (size_t i = 0; i < frames; i++){
+		add_frame(&s, &plain, 0x2, 1, msg_size, 0);
+	}
+	t0 = now_ns();
+	r = parse_stream(&s, &plain, NULL, 0, seg, seg, out, msg_size);
+	t1 = now_ns();
+	sec = (t1 - t0) / 1e9;
+	printf("%8zu %8zu %10li %12.0f %10.1f\n", msg_size, seg, r, r / sec,
+			s.len / sec / 1e6);
+	free(out);
+	free(s.buf);
+	free(plain.buf);
+}
+
+// ****************************************************************************
+int main(int argc, char **argv){
+	static const size_t sizes[] = {8, 64, 512, 1024, 16384};
+	int opt, iterations = 0;
+	size_t seg = 1460, total = 64 * 1024 * 1024;
+
+	while ((opt = getopt(argc, argv, "f:g:t:")) != -1){
+		switch (opt){
+		case 'f': iterations = atoi(optarg); break;
+		case 'g': seg = atoi(optarg); break;
+		case 't': total = (size_t)atoi(optarg) * 1024 * 1024; break;
+		default:
+			fprintf(stderr, "usage: %s [-f fuzz_iterations] [-g segment] "\
+					"[-t total_MB]\n", argv[0]);
+			return 1;
+		}
+	}
+	srand(time(NULL));
+	if (iterations > 0){
+		return fuzz(iterations) == 0 ? 0 : 1;
+	}
+	printf("%8s %8s %10s %12s %10s\n", "msg_len", "segment", "frames",
+			"frames/s", "MB/s");
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++){
+		bench(sizes[i], seg, total);
+	}
+	return 0;
+}
@@ -0,0 +1,294 @@
+/*
+ * bench_deflate.c
+ *
+ *  Benchmark and fuzzer for the permessage-deflate codec (ws_deflate.c),
+ *  zlib is the reference.
+ *
+ *  bench: messages of several kinds (JSON sensor readings, text, random
+ *         bytes) are compressed and decompressed one by one, compression
+ *         ratio and MB/s are compared with zlib (level 1 and 6, raw
+ *         deflate, sync flush, no context takeover),
+ *  fuzz:  ws_deflate output must be decompressed by zlib, zlib output (all
+ *         levels, with and without context takeover) must be decompressed
+ *         by ws_inflate, damaged data must not crash ws_inflate.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "ws_deflate.h"
+
+#define MAX_MSG		70000
+#define OUT_LEN		(MAX_MSG * 2 + 64)
+
+enum {KIND_JSON = 0, KIND_TEXT, KIND_RANDOM, KIND_NR};
+static const char *kind_name[KIND_NR] = {"json", "text", "random"};
+
+static ws_deflate_t deflater;
+static ws_inflate_t inflater;
+
+// ****************************************************************************
+static uint64_t now_ns(void){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// ****************************************************************************
+//message of the given kind, len bytes
+static size_t make_msg(uint8_t *buf, size_t len, int kind){
+	static const char *words[] = {"the", "sensor", "value", "of", "temperature",
+			"is", "read", "every", "second", "and", "sent", "to", "clients"};
+	char part[96];
+	size_t n = 0, k;
+
+	while (n < len){
+		switch (kind){
+		case KIND_JSON:
+			k = sprintf(part, "{\"type\":\"message\",\"data\":"\
+					"{\"sensor\":%i,\"value\":%i.%02i}}", rand() % 16,
+					rand() % 100, rand() % 100);
+			break;
+		case KIND_TEXT:
+			k = sprintf(part, "%s ",
+					words[rand() % (sizeof(words) / sizeof(words[0]))]);
+			break;
+		default:
+			part[0] = rand();
+			k = 1;
+			break;
+		}
+		if (k > len - n){
+			k = len - n;
+		}
+		memcpy(buf + n, part, k);
+		n += k;
+	}
+	return n;
+}
+
+// ****************************************************************************
+//zlib raw deflate with sync flush, tail removed, returns length
+static size_t z_compress(z_stream *z, const uint8_t *in, size_t len,
+		uint8_t *out, size_t cap){
+	z -> next_in = (uint8_t *)in;
+	z -> avail_in = len;
+	z -> next_out = out;
+	z -> avail_out = cap;
+	//nothing is written if there is no new input
+	deflate(z, Z_SYNC_FLUSH);
+	return (cap - z -> avail_out >= 4) ? cap - z -> avail_out - 4 : 0;
+}
+
+// ****************************************************************************
+//zlib raw inflate of a message without tail, returns length or -1
+static long z_decompress(z_stream *z, const uint8_t *in, size_t len,
+		uint8_t *out, size_t cap){
+	static const uint8_t tail[4] = {0x00, 0x00, 0xFF, 0xFF};
+	int r;
+
+	z -> next_out = out;
+	z -> avail_out = cap;
+	z -> next_in = (uint8_t *)in;
+	z -> avail_in = len;
+	r = inflate(z, Z_SYNC_FLUSH);
+	if ((r != Z_OK) && (r != Z_BUF_ERROR)){
+		return -1;
+	}
+	z -> next_in = (uint8_t *)tail;
+	z -> avail_in = 4;
+	r = inflate(z, Z_SYNC_FLUSH);
+	if ((r != Z_OK) && (r != Z_BUF_ERROR)){
+		return -1;
+	}
+	return cap - z -> avail_out;
+}
+
+// ****************************************************************************
+//keep the last "window" bytes of all messages in dict
+static void dict_add(uint8_t *dict, size_t *dict_len, size_t window,
+		const uint8_t *data, size_t len){
+	if (len >= window){
+		memcpy(dict, data + len - window, window);
+		*dict_len = window;
+		return;
+	}
+	if (*dict_len + len > window){
+		memmove(dict, dict + *dict_len + len - window, window - len);
+		*dict_len = window - len;
+	}
+	memcpy(dict + *dict_len, data, len);
+	*dict_len += len;
+}
+
+// ****************************************************************************
+static int fuzz(int iterations){
+	uint8_t *msg = malloc(MAX_MSG), *comp = malloc(OUT_LEN);
+	uint8_t *out = malloc(MAX_MSG), *dict = malloc(1 << 15);
+	z_stream zd, zi;
+	size_t len, clen, olen, dict_len;
+	long zlen;
+	int bits, level, takeover;
+
+	for (int it = 0; it < iterations; it++){
+		bits = 8 + rand() % 8;
+		level = rand() % 10;
+		takeover = rand() & 1;
+		memset(&zd, 0, sizeof(zd));
+		memset(&zi, 0, sizeof(zi));
+		//zlib does not support 8 bit windows for raw deflate
+		deflateInit2(&zd, level, Z_DEFLATED, -((bits < 9) ? 9 : bits), 8,
+				(rand() % 4 == 0) ? Z_HUFFMAN_ONLY : Z_DEFAULT_STRATEGY);
+		inflateInit2(&zi, -15);
+		dict_len = 0;
+
+		for (int m = 0; m < 8; m++){
+			len = rand() % 3 == 0 ? rand() % 64 : rand() % MAX_MSG;
+			len = make_msg(msg, len, rand() % KIND_NR);
+
+			//ws_deflate -> zlib and ws_inflate
+			clen = ws_deflate(&deflater, msg, len, comp, OUT_LEN, bits);
+			zlen = z_decompress(&zi, comp, clen, out, MAX_MSG);
+			if ((clen == 0) || (zlen != (long)len) || (memcmp(out, msg, len) != 0)){
+				printf("fuzz: zlib can not decompress ws_deflate output, "\
+						"iteration %i\n", it);
+				return -1;
+			}
+			if ((ws_inflate(&inflater, comp, clen, out, MAX_MSG, &olen, NULL, 0)
+					!= WS_INFLATE_OK) || (olen != len) || (memcmp(out, msg, len) != 0)){
+				printf("fuzz: ws_inflate failed on ws_deflate output, "\
+						"iteration %i\n", it);
+				return -1;
+			}
+
+			//zlib -> ws_inflate, with dictionary if the context is kept
+			if (takeover == 0){
+				deflateReset(&zd);
+				dict_len = 0;
+			}
+			clen = z_compress(&zd, msg, len, comp, OUT_LEN);
+			if ((ws_inflate(&inflater, comp, clen, out, MAX_MSG, &olen, dict,
+					dict_len) != WS_INFLATE_OK) || (olen != len) ||
+					(memcmp(out, msg, len) != 0)){
+				printf("fuzz: ws_inflate failed on zlib output, iteration %i "\
+						"(level %i, bits %i, takeover %i)\n", it, level, bits, takeover);
+				return -1;
+			}
+			dict_add(dict, &dict_len, 1 << 15, msg, len);
+
+			//output limit
+			if ((len > 1) && (ws_inflate(&inflater, comp, clen, out, len - 1,
+					&olen, dict, dict_len) != WS_INFLATE_FULL)){
+				printf("fuzz: output limit not detected, iteration %i\n", it);
+				return -1;
+			}
+
+			//damaged data must only fail
+			for (size_t i = 0; i < clen; i++){
+				if ((rand() % 32) == 0){
+					comp[i] = rand();
+				}
+			}
+			ws_inflate(&inflater, comp, rand() % (clen + 1), out, MAX_MSG, &olen,
+					dict, dict_len);
+		}
+		deflateEnd(&zd);
+		inflateEnd(&zi);
+	}
+	printf("fuzz: %i iterations ok\n", iterations);
+	free(msg);
+	free(comp);
+	free(out);
+	free(dict);
+	return 0;
+}
+
+// ****************************************************************************
+static void bench(int kind, size_t msg_len, size_t total){
+	uint8_t *msg = malloc(msg_len), *comp = malloc(msg_len * 2 + 64);
+	uint8_t *out = malloc(msg_len);
+	size_t len, clen = 0, olen, in_bytes = 0, ws_bytes = 0, z_bytes[2] = {0, 0};
+	double ws_c = 0, ws_d = 0, z_c[2] = {0, 0}, z_d = 0;
+	static const int levels[2] = {1, 6};
+	z_stream zd[2], zi;
+	uint64_t t0;
+
+	memset(zd, 0, sizeof(zd));
+	memset(&zi, 0, sizeof(zi));
+	for (int l = 0; l < 2; l++){
+		deflateInit2(&zd[l], levels[l], Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+	}
+	inflateInit2(&zi, -15);
+	while (in_bytes < total){
+		len = make_msg(msg, msg_len, kind);
+		in_bytes += len;
+
+		t0 = now_ns();
+		clen = ws_deflate(&deflater, msg, len, comp, msg_len * 2 + 64, 15);
+		ws_c += now_ns() - t0;
+		ws_bytes += clen;
+		t0 = now_ns();
+		ws_inflate(&inflater, comp, clen, out, msg_len, &olen, NULL, 0);
+		ws_d += now_ns() - t0;
+
+		for (int l = 0; l < 2; l++){
+			t0 = now_ns();
+			deflateReset(&zd[l]);
+			clen = z_compress(&zd[l], msg, len, comp, msg_len * 2 + 64);
+			z_c[l] += now_ns() - t0;
+			z_bytes[l] += clen;
+		}
+		t0 = now_ns();
+		z_decompress(&zi, comp, clen, out, msg_len);
+		z_d += now_ns() - t0;
+	}
+	printf("%-7s %7zu %8.2f %8.2f %8.2f %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+			kind_name[kind], msg_len, (double)ws_bytes / in_bytes,
+			(double)z_bytes[0] / in_bytes, (double)z_bytes[1] / in_bytes,
+			in_bytes / ws_c * 1e3, in_bytes / z_c[0] * 1e3, in_bytes / z_c[1] * 1e3,
+			in_bytes / ws_d * 1e3, in_bytes / z_d * 1e3);
+	for (int l = 0; l < 2; l++){
+		deflateEnd(&zd[l]);
+	}
+	inflateEnd(&zi);
+	free(msg);
+	free(comp);
+	free(out);
+}
+
+// ****************************************************************************
+int main(int argc, char **argv){
+	static const size_t sizes[] = {64, 256, 1024, 16384};
+	int opt, iterations = 0;
+	size_t total = 16 * 1024 * 1024;
+
+	while ((opt = getopt(argc, argv, "f:t:")) != -1){
+		switch (opt){
+		case 'f': iterations = atoi(optarg); break;
+		case 't': total = (size_t)atoi(optarg) * 1024 * 1024; break;
+		default:
+			fprintf(stderr, "usage: %s [-f fuzz_iterations] [-t total_MB]\n",
+					argv[0]);
+			return 1;
+		}
+	}
+	srand(time(NULL));
+	if (iterations > 0){
+		return fuzz(iterations) == 0 ? 0 : 1;
+	}
+	printf("%-7s %7s %8s %8s %8s %9s %9s %9s %9s %9s\n", "kind", "msg_len",
+			"ratio", "z1_ratio", "z6_ratio", "def_MB/s", "z1_MB/s", "z6_MB/s",
+			"inf_MB/s", "zinf_MB/s");
+	for (int k = 0; k < KIND_NR; k++){
+		for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++){
+			bench(k, sizes[i], total);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,168 @@
+/*
+ * bench_handshake.c
+ *
+ *  Benchmark of the upgrade request parser (ws_handshake.c) against the
+ *  previous handshake code (strstr over the whole request, three heap
+ *  allocations, base64_encode). A browser request is parsed whole and in
+ *  segments of -g bytes, the accept key is compared with the reference.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hwcrypto/sha.h"
+#include "wpa2/utils/base64.h"
+
+#include "ws_handshake.h"
+
+static const char request[] =
+		"GET /chat HTTP/1.1\r\n"
+		"Host: 192.168.1.10:8080\r\n"
+		"Connection: Upgrade\r\n"
+		"Pragma: no-cache\r\n"
+		"Cache-Control: no-cache\r\n"
+		"User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 "\
+		"(KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36\r\n"
+		"Upgrade: websocket\r\n"
+		"Origin: http://192.168.1.10\r\n"
+		"Sec-WebSocket-Version: 13\r\n"
+		"Accept-Encoding: gzip, deflate\r\n"
+		"Accept-Language: en-US,en;q=0.9\r\n"
+		"Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+		"Sec-WebSocket-Extensions: permessage-deflate; client_max_window_bits\r\n"
+		"\r\n";
+static const char expected[] = "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=";
+
+// ****************************************************************************
+static uint64_t now_ns(void){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// ****************************************************************************
+//previous code: header strings searched in the whole request, accept key
+//built in heap buffers, returns answer (heap) or NULL
+static char *old_handshake(const char *rq){
+	static const char hs[] = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: "\
+			"websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n";
+	char *buff_1, *buff_2, *buff_3, *ans, *res1, *res2;
+	size_t out_len;
+
+	if ((strstr(rq, "Upgrade: websocket") == NULL) ||
+			((strstr(rq, "Connection: Upgrade") == NULL) &&
+			(strstr(rq, "Connection: keep-alive, Upgrade") == NULL)) ||
+			(strstr(rq, "Sec-WebSocket-Version: 13") == NULL)){
+		return NULL;
+	}
+	res1 = strstr(rq, "Sec-WebSocket-Key");
+	if (res1 == NULL){
+		return NULL;
+	}
+	res2 = strstr(res1, ": ");
+	res1 = strstr(res2, "\r\n");
+	buff_1 = malloc(80);
+	memset(buff_1, 0, 80);
+	memcpy(buff_1, res2 + 2, res1 - res2 - 2);
+	strcpy(&buff_1[res1 - res2 - 2], "258EAFA5-E914-47DA-95CA-C5AB0DC85B11");
+	buff_2 = malloc(20);
+	esp_sha(SHA1, (unsigned char *)buff_1, strlen(buff_1), (unsigned char *)buff_2);
+	free(buff_1);
+	buff_3 = (char *)base64_encode((unsigned char *)buff_2, 20, &out_len);
+	free(buff_2);
+	ans = malloc(out_len + strlen(hs) + 10);
+	sprintf(ans, hs, buff_3);
+	free(buff_3);
+	return ans;
+}
+
+// ****************************************************************************
+//new code: request parsed in segments of seg bytes, answer in a stack buffer
+static int new_handshake(const char *rq, size_t len, size_t seg, char *ans,
+		size_t ans_len){
+	static const char hs[] = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: "\
+			"websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n\r\n";
+	char accept[WS_HS_ACCEPT_LEN + 1];
+	ws_hs_t h;
+	size_t pos = 0, n, used;
+	int8_t res = WS_HS_MORE;
+
+	ws_hs_init(&h);
+	while ((pos < len) && (res == WS_HS_MORE)){
+		n = (len - pos < seg) ? len - pos : seg;
+		res = ws_hs_parse(&h, (const uint8_t *)rq + pos, n, &used);
+		pos += n;
+	}
+	if (res != WS_HS_DONE){
+		return -1;
+	}
+	ws_hs_accept(h.key, accept);
+	snprintf(ans, ans_len, hs, accept);
+	return 0;
+}
+
+// ****************************************************************************
+int main(int argc, char **argv){
+	char ans[256], *old;
+	size_t len = strlen(request), seg = 16;
+	long rounds = 200000;
+	uint64_t t0;
+	double t_old, t_new, t_seg;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "g:r:")) != -1){
+		switch (opt){
+		case 'g': seg = atoi(optarg); break;
+		case 'r': rounds = atol(optarg); break;
+		default:
+			fprintf(stderr, "usage: %s [-g segment] [-r rounds]\n", argv[0]);
+			return 1;
+		}
+	}
+	if ((seg < 1) || (rounds < 1)){
+		return 1;
+	}
+
+	//every segment size must give the same answer
+	for (size_t s = 1; s <= len; s++){
+		if ((new_handshake(request, len, s, ans, sizeof(ans)) != 0) ||
+				(strstr(ans, expected) == NULL)){
+			printf("wrong answer, segment %zu\n", s);
+			return 1;
+		}
+	}
+	old = old_handshake(request);
+	if ((old == NULL) || (strstr(old, expected) == NULL)){
+		printf("wrong answer of the previous code\n");
+		return 1;
+	}
+	free(old);
+
+	t0 = now_ns();
+	for (long r = 0; r < rounds; r++){
+		free(old_handshake(request));
+	}
+	t_old = (double)(now_ns() - t0) / rounds;
+	t0 = now_ns();
+	for (long r = 0; r < rounds; r++){
+		new_handshake(request, len, len, ans, sizeof(ans));
+	}
+	t_new = (double)(now_ns() - t0) / rounds;
+	t0 = now_ns();
+	for (long r = 0; r < rounds; r++){
+		new_handshake(request, len, seg, ans, sizeof(ans));
+	}
+	t_seg = (double)(now_ns() - t0) / rounds;
+
+	printf("request %zu bytes, ns per handshake (parse, accept key, answer)\n",
+			len);
+	printf("%-28s %9.0f  (4 heap allocations)\n", "previous (strstr, malloc)", t_old);
+	printf("%-28s %9.0f  (no allocation)\n", "ws_hs_parse, one segment", t_new);
+	printf("ws_hs_parse, %3zu B segments %9.0f\n", seg, t_seg);
+	return 0;
+}
@@ -0,0 +1,166 @@
+/*
+ * bench_pool.c
+ *
+ *  Benchmark of the block pools (ws_pool.c) against malloc/free.
+ *
+ *  fixed: every thread takes -b blocks of one size and releases them in
+ *         the same order (like items going through a queue), repeated,
+ *  mixed: the same with random payload sizes up to 1 kB, pool buffers come
+ *         from size classes (ws_buf_alloc), larger ones from the heap.
+ *
+ *  Threads share the pools, as receive tasks and the send task do. Time is
+ *  given per allocation and release pair.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "ws_pool.h"
+
+#define MAX_THREADS		16
+#define MAX_BATCH		256
+#define MIXED_MAX		1024
+
+typedef struct{
+	int mode;				//0 - malloc, 1 - pool
+	int mixed;
+	int batch;
+	long rounds;
+	ws_pool_t *pool;
+	uint32_t size;
+} job_t;
+
+static const ws_pool_cfg_t classes[WS_POOL_CLASSES] = {
+	{64, 1024}, {256, 1024}, {MIXED_MAX, 1024}
+};
+
+// ****************************************************************************
+static uint64_t now_ns(void){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// ****************************************************************************
+static void *worker(void *arg){
+	job_t *j = arg;
+	void *blk[MAX_BATCH];
+	uint32_t sizes[MAX_BATCH], seed = (uintptr_t)&blk;
+
+	for (int i = 0; i < j -> batch; i++){
+		seed = seed * 1103515245 + 12345;
+		sizes[i] = j -> mixed ? 1 + (seed >> 8) % MIXED_MAX : j -> size;
+	}
+	for (long r = 0; r < j -> rounds; r++){
+		for (int i = 0; i < j -> batch; i++){
+			if (j -> mode == 0){
+				blk[i] = malloc(sizes[i]);
+			}
+			else if (j -> mixed){
+				blk[i] = ws_buf_alloc(sizes[i]);
+			}
+			else{
+				blk[i] = ws_pool_alloc(j -> pool);
+				if (blk[i] == NULL){
+					blk[i] = malloc(sizes[i]);
+				}
+			}
+			//touch the block like a writer of the payload would
+			*(volatile uint8_t *)blk[i] = i;
+		}
+		for (int i = 0; i < j -> batch; i++){
+			if (j -> mode == 0){
+				free(blk[i]);
+			}
+			else if (j -> mixed){
+				ws_buf_free(blk[i]);
+			}
+			else if (ws_pool_owns(j -> pool, blk[i])){
+				ws_pool_free(j -> pool, blk[i]);
+			}
+			else{
+				free(blk[i]);
+			}
+		}
+	}
+	return NULL;
+}
+
+// ****************************************************************************
+//returns ns per allocation and release
+static double run(int mode, int mixed, int threads, int batch, long rounds,
+		ws_pool_t *pool, uint32_t size){
+	pthread_t th[MAX_THREADS];
+	job_t job = {mode, mixed, batch, rounds, pool, size};
+	uint64_t t0, t1;
+
+	t0 = now_ns();
+	for (int i = 0; i < threads; i++){
+		pthread_create(&th[i], NULL, worker, &job);
+	}
+	for (int i = 0; i < threads; i++){
+		pthread_join(th[i], NULL);
+	}
+	t1 = now_ns();
+	return (double)(t1 - t0) / ((double)rounds * batch * threads);
+}
+
+// ****************************************************************************
+int main(int argc, char **argv){
+	static const int thread_nr[] = {1, 4};
+	static const uint32_t fixed_sizes[] = {40, 1025};
+	ws_pool_t pool;
+	ws_pool_stats_t st[2 + WS_POOL_CLASSES];
+	int opt, batch = 16;
+	long rounds = 200000;
+	uint8_t n;
+
+	while ((opt = getopt(argc, argv, "b:r:")) != -1){
+		switch (opt){
+		case 'b': batch = atoi(optarg); break;
+		case 'r': rounds = atol(optarg); break;
+		default:
+			fprintf(stderr, "usage: %s [-b batch] [-r rounds]\n", argv[0]);
+			return 1;
+		}
+	}
+	if ((batch < 1) || (batch > MAX_BATCH) || (rounds < 1)){
+		return 1;
+	}
+	ws_pools_init(0, classes);
+
+	printf("%-12s %7s %10s %10s\n", "test", "threads", "malloc_ns", "pool_ns");
+	for (size_t s = 0; s < sizeof(fixed_sizes) / sizeof(fixed_sizes[0]); s++){
+		//enough blocks for all threads, misses would measure malloc
+		ws_pool_create(&pool, fixed_sizes[s], MAX_BATCH * 4);
+		for (size_t t = 0; t < sizeof(thread_nr) / sizeof(thread_nr[0]); t++){
+			char name[16];
+
+			snprintf(name, sizeof(name), "fixed %u", fixed_sizes[s]);
+			printf("%-12s %7i %10.1f %10.1f\n", name, thread_nr[t],
+					run(0, 0, thread_nr[t], batch, rounds, NULL, fixed_sizes[s]),
+					run(1, 0, thread_nr[t], batch, rounds, &pool, fixed_sizes[s]));
+		}
+		free(pool.mem);
+	}
+	for (size_t t = 0; t < sizeof(thread_nr) / sizeof(thread_nr[0]); t++){
+		printf("%-12s %7i %10.1f %10.1f\n", "mixed", thread_nr[t],
+				run(0, 1, thread_nr[t], batch, rounds, NULL, 0),
+				run(1, 1, thread_nr[t], batch, rounds, NULL, 0));
+	}
+
+	printf("\n%-7s %7s %10s %10s %10s\n", "class", "blocks", "high_water",
+			"allocs", "misses");
+	n = ws_get_pool_stats(st, 2 + WS_POOL_CLASSES);
+	for (int i = 2; i < n; i++){
+		printf("%-7u %7u %10u %10u %10u\n", st[i].size, st[i].nr,
+				st[i].high_water, st[i].allocs, st[i].misses);
+	}
+	return 0;
+}
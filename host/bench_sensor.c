@@ -0,0 +1,150 @@
+/*
+ * bench_sensor.c
+ *
+ *  Sensor updates as the demo application sent them (malloc() and
+ *  sprintf() of one JSON text per reading) against binary records of
+ *  ws_sensor.c, one per frame and in batches of 8 and 32. Reported are
+ *  encode time and bytes on the wire per reading, the WebSocket frame
+ *  header included. Batches are decoded back with ws_sensor_read() first.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "ws_sensor.h"
+
+#define JSON_LEN		64
+
+// ****************************************************************************
+static uint64_t now_ns(void){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// ****************************************************************************
+//server to client frame header (not masked)
+static size_t frame_head(size_t len){
+	return (len < 126) ? 2 : (len <= 0xFFFF) ? 4 : 10;
+}
+
+// ****************************************************************************
+static int check(void){
+	uint8_t buf[WS_SENSOR_LEN(32)];
+	ws_sensor_batch_t b;
+	ws_sensor_rec_t r;
+
+	ws_sensor_init(&b, buf, 32);
+	for (int i = 0; i < 32; i++){
+		if (ws_sensor_add(&b, i, -1000000 * i + 7, -(i & 3), 4000000000U +
+				i * 2000) != 1){
+			printf("add failed at %i\n", i);
+			return -1;
+		}
+	}
+	if ((ws_sensor_add(&b, 0, 0, 0, 4000000000U) != 0) ||
+			(ws_sensor_len(&b) != WS_SENSOR_LEN(32))){
+		printf("full batch accepted a record\n");
+		return -1;
+	}
+	for (int i = 0; i < 32; i++){
+		if ((ws_sensor_read(buf, sizeof(buf), i, &r) != 1) || (r.id != i) ||
+				(r.value != -1000000 * i + 7) || (r.exp != -(i & 3)) ||
+				(r.t_ms != 4000000000U + i * 2000)){
+			printf("record %i decoded wrong\n", i);
+			return -1;
+		}
+	}
+	if ((ws_sensor_read(buf, sizeof(buf) - 1, 0, &r) != -1) ||
+			(ws_sensor_read(buf, sizeof(buf), 32, &r) != -1)){
+		printf("damaged batch accepted\n");
+		return -1;
+	}
+	ws_sensor_reset(&b);
+	ws_sensor_add(&b, 1, 1, 0, 100);
+	if (ws_sensor_add(&b, 1, 1, 0, 100 + 0x10000) != 0){
+		printf("time out of range accepted\n");
+		return -1;
+	}
+	return 0;
+}
+
+// ****************************************************************************
+//one JSON text per reading, as the counter was sent before the prepared frame
+__attribute__((noinline))
+static size_t json_reading(uint32_t value){
+	char *msg = malloc(JSON_LEN);
+	size_t len;
+
+	len = sprintf(msg, "{\"type\":\"message\",\"data\":{\"sensor\":\"counter\","\
+			"\"value\":%u}}", (unsigned)value);
+	__asm__ volatile("" : : "r"(msg) : "memory");
+	free(msg);
+	return len + frame_head(len);
+}
+
+// ****************************************************************************
+//batch of nr readings, sent when full
+__attribute__((noinline))
+static size_t bin_readings(ws_sensor_batch_t *b, uint32_t first, uint32_t nr){
+	size_t wire = 0, len;
+
+	for (uint32_t i = 0; i < nr; i++){
+		ws_sensor_add(b, 0, first + i, 0, (first + i) * 1000);
+		if (b -> nr == b -> cap){
+			len = ws_sensor_len(b);
+			__asm__ volatile("" : : "r"(b -> buf) : "memory");
+			wire += len + frame_head(len);
+			ws_sensor_reset(b);
+		}
+	}
+	return wire;
+}
+
+// ****************************************************************************
+int main(int argc, char **argv){
+	static const uint8_t batches[] = {1, 8, 32};
+	uint8_t buf[WS_SENSOR_LEN(32)];
+	ws_sensor_batch_t b;
+	uint32_t n = 4000000;
+	uint64_t t0, t;
+	size_t wire = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:")) != -1){
+		switch (opt){
+		case 'n': n = atoi(optarg); break;
+		default:
+			printf("usage: %s [-n readings]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (check() != 0){
+		return 1;
+	}
+	n -= n % 32;
+	printf("%-12s %12s %12s\n", "encoding", "ns/reading", "B/reading");
+	t0 = now_ns();
+	for (uint32_t i = 0; i < n; i++){
+		wire += json_reading(1000000 + i);
+	}
+	t = now_ns() - t0;
+	printf("%-12s %12.1f %12.1f\n", "json", (double)t / n, (double)wire / n);
+	for (size_t k = 0; k < sizeof(batches); k++){
+		ws_sensor_init(&b, buf, batches[k]);
+		wire = 0;
+		t0 = now_ns();
+		for (uint32_t i = 0; i < n; i += 32){
+			wire += bin_readings(&b, 1000000 + i, 32);
+		}
+		t = now_ns() - t0;
+		printf("binary x%-4u %12.1f %12.1f\n", batches[k], (double)t / n,
+				(double)wire / n);
+	}
+	return 0;
+}
@@ -0,0 +1,113 @@
+/*
+ * bench_unmask.c
+ *
+ *  Compares ws_unmask() (fused copy + unmask, word/vector wide) with the
+ *  loop ws_receive_task used before: memcpy() of the payload followed by
+ *  a byte wise XOR with masking_key[i%4].
+ *  Results are checked against a reference for all alignments first.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "ws_codec.h"
+
+// ****************************************************************************
+static uint64_t now_ns(void){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// ****************************************************************************
+//previous receive path: copy, then unmask in place byte by byte
+__attribute__((noinline))
+static void unmask_legacy(uint8_t *msg, const uint8_t *src, size_t len,
+		const uint8_t *masking_key){
+	memcpy(msg, src, len);
+	for (size_t i = 0; i < len; i++){
+		msg[i] = msg[i] ^ masking_key[i%4];
+	}
+}
+
+// ****************************************************************************
+static int check(void){
+	uint8_t src[300], dst[300], ref[300], mask[4] = {0x12, 0x34, 0x56, 0x78};
+
+	for (size_t i = 0; i < sizeof(src); i++){
+		src[i] = rand();
+	}
+	for (size_t sa = 0; sa < 8; sa++){
+		for (size_t da = 0; da < 8; da++){
+			for (size_t len = 0; len < 260; len++){
+				for (uint64_t off = 0; off < 4; off++){
+					for (size_t i = 0; i < len; i++){
+						ref[i] = src[sa + i] ^ mask[(off + i) & 3];
+					}
+					ws_unmask(dst + da, src + sa, len, mask, off);
+					if (memcmp(dst + da, ref, len) != 0){
+						printf("mismatch: src+%zu dst+%zu len %zu offset %u\n",
+								sa, da, len, (unsigned)off);
+						return -1;
+					}
+				}
+			}
+		}
+	}
+	//in place
+	memcpy(dst, src, sizeof(src));
+	ws_unmask(dst + 1, dst + 1, 200, mask, 3);
+	for (size_t i = 0; i < 200; i++){
+		if (dst[1 + i] != (src[1 + i] ^ mask[(3 + i) & 3])){
+			printf("in place mismatch\n");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// ****************************************************************************
+int main(void){
+	static const size_t sizes[] = {8, 32, 125, 512, 1024, 4096, 65536};
+	uint8_t mask[4] = {0xA1, 0xB2, 0xC3, 0xD4};
+	uint8_t *src, *dst;
+	uint64_t t0, t_legacy, t_new, total = 256ULL * 1024 * 1024;
+
+	if (check() != 0){
+		return 1;
+	}
+	src = malloc(65536 + 16);
+	dst = malloc(65536 + 16);
+	for (size_t i = 0; i < 65536 + 16; i++){
+		src[i] = rand();
+	}
+	printf("%8s %14s %14s %8s\n", "len", "legacy MB/s", "ws_unmask MB/s", "speedup");
+	for (size_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++){
+		size_t len = sizes[k], rounds = total / len;
+
+		//src + 6: payload after a short masked header, as in a pbuf
+		t0 = now_ns();
+		for (size_t r = 0; r < rounds; r++){
+			unmask_legacy(dst, src + 6, len, mask);
+			__asm__ volatile("" : : "r"(dst) : "memory");
+		}
+		t_legacy = now_ns() - t0;
+		t0 = now_ns();
+		for (size_t r = 0; r < rounds; r++){
+			ws_unmask(dst, src + 6, len, mask, 0);
+			__asm__ volatile("" : : "r"(dst) : "memory");
+		}
+		t_new = now_ns() - t0;
+		printf("%8zu %14.0f %14.0f %7.1fx\n", len,
+				rounds * len / (t_legacy / 1e9) / 1e6,
+				rounds * len / (t_new / 1e9) / 1e6,
+				(double)t_legacy / t_new);
+	}
+	free(src);
+	free(dst);
+	return 0;
+}
@@ -0,0 +1,218 @@
+/*
+ * bench_utf8.c
+ *
+ *  UTF-8 check of received text: ws_unmask_utf8() (unmask and check in one
+ *  pass) against ws_unmask() followed by ws_utf8_check() and by a simple
+ *  branching decoder, for ASCII, mixed and multibyte text. ws_unmask()
+ *  alone is the baseline.
+ *  The DFA is checked against a reference decoder first, for all sequences
+ *  up to 3 bytes and random longer ones.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "ws_codec.h"
+
+// ****************************************************************************
+static uint64_t now_ns(void){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// ****************************************************************************
+//RFC 3629 decoder, 1 if s is complete valid UTF-8
+static int utf8_ref(const uint8_t *s, size_t len){
+	size_t i = 0, n;
+	uint32_t cp, min;
+
+	while (i < len){
+		if (s[i] < 0x80){
+			i++;
+			continue;
+		}
+		if ((s[i] & 0xE0) == 0xC0){
+			n = 1, cp = s[i] & 0x1F, min = 0x80;
+		}
+		else if ((s[i] & 0xF0) == 0xE0){
+			n = 2, cp = s[i] & 0x0F, min = 0x800;
+		}
+		else if ((s[i] & 0xF8) == 0xF0){
+			n = 3, cp = s[i] & 0x07, min = 0x10000;
+		}
+		else{
+			return 0;
+		}
+		if (i + n >= len){
+			return 0;
+		}
+		for (size_t k = 1; k <= n; k++){
+			if ((s[i + k] & 0xC0) != 0x80){
+				return 0;
+			}
+			cp = (cp << 6) | (s[i + k] & 0x3F);
+		}
+		if ((cp < min) || (cp > 0x10FFFF) || ((cp >= 0xD800) && (cp <= 0xDFFF))){
+			return 0;
+		}
+		i += n + 1;
+	}
+	return 1;
+}
+
+// ****************************************************************************
+static int valid(uint8_t state){
+	return state == WS_UTF8_ACCEPT;
+}
+
+// ****************************************************************************
+static int check(void){
+	static const uint8_t mask[4] = {0x12, 0x34, 0x56, 0x78};
+	uint8_t s[300], m[300], dst[300], st;
+	size_t len;
+
+	//all sequences of 1..3 bytes
+	for (uint32_t v = 0; v < (1 << 24); v++){
+		s[0] = v >> 16, s[1] = v >> 8, s[2] = v;
+		for (len = 1; len <= 3; len++){
+			if ((len < 3) && ((v & 0xFF) != 0)){
+				continue;
+			}
+			if (valid(ws_utf8_check(WS_UTF8_ACCEPT, s, len)) != utf8_ref(s, len)){
+				printf("DFA mismatch: %06X len %zu\n", v, len);
+				return -1;
+			}
+		}
+	}
+	//random text of valid and invalid code points, checked whole, split
+	//in two chunks and fused with unmasking at all alignments
+	for (int r = 0; r < 200000; r++){
+		len = rand() % 64;
+		for (size_t i = 0; i < len; i++){
+			s[i] = (rand() & 3) ? rand() % 0x80 : 0x80 + rand() % 0x80;
+		}
+		if (rand() & 1){
+			//mostly valid: lead bytes followed by continuations
+			for (size_t i = 0; i < len; i++){
+				if ((s[i] >= 0xC0) && (i + 1 < len)){
+					s[i + 1] = 0x80 | (s[i + 1] & 0x3F);
+				}
+			}
+		}
+		int ref = utf8_ref(s, len);
+		size_t cut = (len > 0) ? rand() % len : 0;
+
+		st = ws_utf8_check(WS_UTF8_ACCEPT, s, cut);
+		st = ws_utf8_check(st, s + cut, len - cut);
+		if ((valid(ws_utf8_check(WS_UTF8_ACCEPT, s, len)) != ref) ||
+				(valid(st) != ref)){
+			printf("check mismatch at round %i\n", r);
+			return -1;
+		}
+		for (size_t i = 0; i < len; i++){
+			m[1 + i] = s[i] ^ mask[i & 3];
+		}
+		for (size_t da = 0; da < 4; da++){
+			st = ws_unmask_utf8(dst + da, m + 1, cut, mask, 0, WS_UTF8_ACCEPT);
+			st = ws_unmask_utf8(dst + da + cut, m + 1 + cut, len - cut, mask, cut,
+					st);
+			if ((valid(st) != ref) || (ref && (memcmp(dst + da, s, len) != 0))){
+				printf("fused mismatch at round %i, dst+%zu\n", r, da);
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+// ****************************************************************************
+//fill buf with len bytes of complete code points from words
+static void fill(uint8_t *buf, size_t len, const char *const *words){
+	size_t pos = 0, n, k = 0;
+
+	while (1){
+		n = strlen(words[k]);
+		if (pos + n > len){
+			break;
+		}
+		memcpy(buf + pos, words[k], n);
+		pos += n;
+		k = (words[k + 1] != NULL) ? k + 1 : 0;
+	}
+	memset(buf + pos, ' ', len - pos);
+}
+
+// ****************************************************************************
+int main(void){
+	static const char *const ascii[] = {"{\"type\":\"counter\",", "\"value\":",
+			"12345,", "\"ts\":1700000000}", " ", NULL};
+	static const char *const mixed[] = {"Zażółć ", "gęślą ", "jaźń, ",
+			"temperatura ", "21,5 °C ", NULL};
+	static const char *const multi[] = {"Привет ", "мир ", "こんにちは", "世界",
+			"😀🚀 ", NULL};
+	static const struct {const char *name; const char *const *words;} kinds[] = {
+			{"ascii", ascii}, {"mixed", mixed}, {"multibyte", multi}};
+	static const size_t sizes[] = {125, 1024, 16384};
+	uint8_t mask[4] = {0xA1, 0xB2, 0xC3, 0xD4};
+	uint8_t *text, *src, *dst, st = 0;
+	uint64_t t0, t[4], total = 128ULL * 1024 * 1024;
+
+	if (check() != 0){
+		return 1;
+	}
+	text = malloc(16384);
+	src = malloc(16384 + 16);
+	dst = malloc(16384 + 16);
+	printf("%-10s %6s %12s %12s %12s %12s   MB/s\n", "text", "len", "unmask",
+			"+decoder", "+check", "fused");
+	for (size_t j = 0; j < sizeof(kinds) / sizeof(kinds[0]); j++){
+		for (size_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++){
+			size_t len = sizes[k], rounds = total / len;
+
+			fill(text, len, kinds[j].words);
+			if (!valid(ws_utf8_check(WS_UTF8_ACCEPT, text, len))){
+				printf("test text is not valid\n");
+				return 1;
+			}
+			//src + 6: payload after a short masked header, as in a pbuf
+			for (size_t i = 0; i < len; i++){
+				src[6 + i] = text[i] ^ mask[i & 3];
+			}
+			for (int v = 0; v < 4; v++){
+				t0 = now_ns();
+				for (size_t r = 0; r < rounds; r++){
+					if (v == 3){
+						st |= ws_unmask_utf8(dst, src + 6, len, mask, 0,
+								WS_UTF8_ACCEPT);
+					}
+					else{
+						ws_unmask(dst, src + 6, len, mask, 0);
+					}
+					if (v == 1){
+						st |= (utf8_ref(dst, len) == 1) ? WS_UTF8_ACCEPT :
+								WS_UTF8_REJECT;
+					}
+					else if (v == 2){
+						st |= ws_utf8_check(WS_UTF8_ACCEPT, dst, len);
+					}
+					__asm__ volatile("" : : "r"(dst) : "memory");
+				}
+				t[v] = now_ns() - t0;
+			}
+			printf("%-10s %6zu %12.0f %12.0f %12.0f %12.0f\n", kinds[j].name, len,
+					rounds * len / (t[0] / 1e9) / 1e6,
+					rounds * len / (t[1] / 1e9) / 1e6,
+					rounds * len / (t[2] / 1e9) / 1e6,
+					rounds * len / (t[3] / 1e9) / 1e6);
+		}
+	}
+	free(text);
+	free(src);
+	free(dst);
+	return (st == WS_UTF8_ACCEPT) ? 0 : 1;
+}
@@ -0,0 +1,15 @@
+/*
+ * esp_system.h
+ *
+ *  Host stand-in for the ESP-IDF heap information functions.
+ */
+
+#ifndef HOST_ESP_SYSTEM_H_
+#define HOST_ESP_SYSTEM_H_
+
+#include <stdint.h>
+
+uint32_t esp_get_free_heap_size(void);
+uint32_t esp_get_minimum_free_heap_size(void);
+
+#endif /* HOST_ESP_SYSTEM_H_ */
@@ -0,0 +1,14 @@
+/*
+ * esp_timer.h
+ *
+ *  Host stand-in for the ESP-IDF high resolution time.
+ */
+
+#ifndef HOST_ESP_TIMER_H_
+#define HOST_ESP_TIMER_H_
+
+#include <stdint.h>
+
+int64_t esp_timer_get_time(void);
+
+#endif /* HOST_ESP_TIMER_H_ */
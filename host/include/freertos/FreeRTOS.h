@@ -0,0 +1,44 @@
+/*
+ * FreeRTOS.h
+ *
+ *  Host (Linux) stand-in for the FreeRTOS kernel used by websocket_server.c.
+ *  Tasks are pthreads, queues/semaphores are mutex + condition variable
+ *  ring buffers and software timers are served by one timer thread.
+ *  One tick is one millisecond.
+ */
+
+#ifndef HOST_FREERTOS_H_
+#define HOST_FREERTOS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#define configTICK_RATE_HZ		1000
+#define portTICK_PERIOD_MS		(1000 / configTICK_RATE_HZ)
+#define portTICK_RATE_MS		portTICK_PERIOD_MS
+#define portMAX_DELAY			0xFFFFFFFFUL
+#define portNUM_PROCESSORS		2		//as ESP32, pinned tasks share the host CPUs
+#define pdMS_TO_TICKS(ms)		((TickType_t)(((TickType_t)(ms) * configTICK_RATE_HZ) / 1000))
+
+#define pdFALSE			0
+#define pdTRUE			1
+#define pdFAIL			0
+#define pdPASS			1
+#define errQUEUE_EMPTY	0
+#define errQUEUE_FULL	0
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+//critical sections (spinlocks on ESP32) are mutexes, a spinning thread
+//would wait for a preempted owner on the host
+typedef pthread_mutex_t portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED	PTHREAD_MUTEX_INITIALIZER
+#define vPortCPUInitializeMutex(mux)	pthread_mutex_init((mux), NULL)
+#define portENTER_CRITICAL(mux)			pthread_mutex_lock(mux)
+#define portEXIT_CRITICAL(mux)			pthread_mutex_unlock(mux)
+
+#endif /* HOST_FREERTOS_H_ */
@@ -0,0 +1,36 @@
+/*
+ * queue.h
+ *
+ *  Host stand-in for FreeRTOS queues. Semaphores are queues with
+ *  zero-sized items, as in FreeRTOS itself.
+ */
+
+#ifndef HOST_FREERTOS_QUEUE_H_
+#define HOST_FREERTOS_QUEUE_H_
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct host_queue *QueueHandle_t;
+typedef QueueHandle_t xQueueHandle;
+
+#define queueSEND_TO_BACK	0
+#define queueSEND_TO_FRONT	1
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+QueueHandle_t host_queue_create(UBaseType_t length, UBaseType_t item_size,
+		UBaseType_t initial_count);
+void vQueueDelete(QueueHandle_t q);
+BaseType_t xQueueGenericSend(QueueHandle_t q, const void *item,
+		TickType_t ticks, BaseType_t position);
+BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t ticks);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q);
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t q);
+
+#define xQueueSend(q, item, ticks) \
+	xQueueGenericSend((q), (item), (ticks), queueSEND_TO_BACK)
+#define xQueueSendToBack(q, item, ticks) \
+	xQueueGenericSend((q), (item), (ticks), queueSEND_TO_BACK)
+#define xQueueSendToFront(q, item, ticks) \
+	xQueueGenericSend((q), (item), (ticks), queueSEND_TO_FRONT)
+
+#endif /* HOST_FREERTOS_QUEUE_H_ */
@@ -0,0 +1,23 @@
+/*
+ * semphr.h
+ *
+ *  Host stand-in for FreeRTOS semaphores and mutexes.
+ */
+
+#ifndef HOST_FREERTOS_SEMPHR_H_
+#define HOST_FREERTOS_SEMPHR_H_
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+typedef QueueHandle_t SemaphoreHandle_t;
+typedef SemaphoreHandle_t xSemaphoreHandle;
+
+#define xSemaphoreCreateMutex()				host_queue_create(1, 0, 1)
+#define xSemaphoreCreateBinary()			host_queue_create(1, 0, 0)
+#define xSemaphoreCreateCounting(max, init)	host_queue_create((max), 0, (init))
+#define xSemaphoreTake(s, ticks)			xQueueReceive((s), NULL, (ticks))
+#define xSemaphoreGive(s)					xQueueGenericSend((s), NULL, 0, queueSEND_TO_BACK)
+#define vSemaphoreDelete(s)					vQueueDelete(s)
+
+#endif /* HOST_FREERTOS_SEMPHR_H_ */
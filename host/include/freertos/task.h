@@ -0,0 +1,27 @@
+/*
+ * task.h
+ *
+ *  Host stand-in for FreeRTOS tasks (one pthread per task).
+ */
+
+#ifndef HOST_FREERTOS_TASK_H_
+#define HOST_FREERTOS_TASK_H_
+
+#include "freertos/FreeRTOS.h"
+
+#define tskNO_AFFINITY		0x7FFFFFFF
+
+typedef struct host_task *TaskHandle_t;
+typedef TaskHandle_t xTaskHandle;
+typedef void (*TaskFunction_t)(void *);
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack,
+		void *param, UBaseType_t prio, TaskHandle_t *handle);
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name,
+		uint32_t stack, void *param, UBaseType_t prio, TaskHandle_t *handle,
+		BaseType_t core_id);
+void vTaskDelete(TaskHandle_t handle);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount(void);
+
+#endif /* HOST_FREERTOS_TASK_H_ */
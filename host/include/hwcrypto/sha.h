@@ -0,0 +1,19 @@
+/*
+ * sha.h
+ *
+ *  Host stand-in for the ESP32 hardware SHA driver (software SHA-1).
+ */
+
+#ifndef HOST_HWCRYPTO_SHA_H_
+#define HOST_HWCRYPTO_SHA_H_
+
+#include <stddef.h>
+
+typedef enum {
+	SHA1 = 0
+} esp_sha_type;
+
+void esp_sha(esp_sha_type type, const unsigned char *input, size_t ilen,
+		unsigned char *output);
+
+#endif /* HOST_HWCRYPTO_SHA_H_ */
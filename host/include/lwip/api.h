@@ -0,0 +1,99 @@
+/*
+ * api.h
+ *
+ *  Host stand-in for the lwIP netconn API on top of POSIX TCP sockets.
+ *  Received data is handed out as a netbuf chain of segments no longer
+ *  than HOST_LWIP_SEGMENT bytes (environment variable, default HOST_TCP_MSS)
+ *  so chain walking code is exercised like on the target.
+ */
+
+#ifndef HOST_LWIP_API_H_
+#define HOST_LWIP_API_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint8_t u8_t;
+typedef int8_t s8_t;
+typedef uint16_t u16_t;
+typedef int16_t s16_t;
+typedef uint32_t u32_t;
+typedef int32_t s32_t;
+typedef s8_t err_t;
+
+#define HOST_TCP_MSS	1460
+
+//error codes, values as in lwIP 2.x
+#define ERR_OK			0
+#define ERR_MEM			-1
+#define ERR_BUF			-2
+#define ERR_TIMEOUT		-3
+#define ERR_RTE			-4
+#define ERR_INPROGRESS	-5
+#define ERR_VAL			-6
+#define ERR_WOULDBLOCK	-7
+#define ERR_USE			-8
+#define ERR_ALREADY		-9
+#define ERR_ISCONN		-10
+#define ERR_CONN		-11
+#define ERR_IF			-12
+#define ERR_ABRT		-13
+#define ERR_RST			-14
+#define ERR_CLSD		-15
+#define ERR_ARG			-16
+
+//netconn_write flags
+#define NETCONN_NOCOPY		0x00
+#define NETCONN_COPY		0x01
+#define NETCONN_MORE		0x02
+#define NETCONN_DONTBLOCK	0x04
+
+enum netconn_type {
+	NETCONN_TCP = 0x10
+};
+
+typedef struct {
+	u32_t addr;
+} ip_addr_t;
+
+struct tcp_pcb;
+struct netbuf;
+
+//pcb.tcp is the netconn itself, for the raw API calls of lwip/tcp.h
+struct netconn{
+	int fd;
+	int closed;
+	union {
+		struct tcp_pcb *tcp;
+	} pcb;
+};
+
+struct netvector {
+	const void *ptr;
+	size_t len;
+};
+
+struct netconn *netconn_new(enum netconn_type type);
+err_t netconn_bind(struct netconn *conn, const ip_addr_t *addr, u16_t port);
+err_t netconn_listen(struct netconn *conn);
+err_t netconn_accept(struct netconn *conn, struct netconn **new_conn);
+err_t netconn_recv(struct netconn *conn, struct netbuf **new_buf);
+err_t netconn_write_partly(struct netconn *conn, const void *dataptr,
+		size_t size, u8_t apiflags, size_t *bytes_written);
+err_t netconn_write_vectors_partly(struct netconn *conn,
+		struct netvector *vectors, u16_t vectorcnt, u8_t apiflags,
+		size_t *bytes_written);
+err_t netconn_close(struct netconn *conn);
+err_t netconn_delete(struct netconn *conn);
+void netconn_set_recvtimeout(struct netconn *conn, int timeout_ms);
+
+#define netconn_write(conn, dataptr, size, apiflags) \
+	netconn_write_partly(conn, dataptr, size, apiflags, NULL)
+
+err_t netbuf_data(struct netbuf *buf, void **dataptr, u16_t *len);
+s8_t netbuf_next(struct netbuf *buf);
+void netbuf_first(struct netbuf *buf);
+u16_t netbuf_len(struct netbuf *buf);
+void netbuf_delete(struct netbuf *buf);
+
+#endif /* HOST_LWIP_API_H_ */
@@ -0,0 +1,43 @@
+/*
+ * sockets.h
+ *
+ *  Host stand-in for the lwIP socket API, lwip_* functions are the POSIX
+ *  socket calls.
+ */
+
+#ifndef HOST_LWIP_SOCKETS_H_
+#define HOST_LWIP_SOCKETS_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define lwip_socket		socket
+#define lwip_bind		bind
+#define lwip_listen		listen
+#define lwip_accept		accept
+#define lwip_setsockopt	setsockopt
+#define lwip_recv		recv
+#define lwip_send(s, data, size, flags)	send(s, data, size, (flags) | MSG_NOSIGNAL)
+#define lwip_writev		host_lwip_writev
+#define lwip_select		select
+#define lwip_fcntl		fcntl
+#define lwip_shutdown	shutdown
+#define lwip_close		close
+
+//writev without SIGPIPE
+static inline ssize_t host_lwip_writev(int s, const struct iovec *iov, int cnt){
+	struct msghdr msg = {0};
+
+	msg.msg_iov = (struct iovec *)iov;
+	msg.msg_iovlen = cnt;
+	return sendmsg(s, &msg, MSG_NOSIGNAL);
+}
+
+#endif /* HOST_LWIP_SOCKETS_H_ */
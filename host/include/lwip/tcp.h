@@ -0,0 +1,16 @@
+/*
+ * tcp.h
+ *
+ *  Host stand-in for the part of the lwIP raw TCP API used on netconns,
+ *  pcb of a host netconn is the netconn itself.
+ */
+
+#ifndef HOST_LWIP_TCP_H_
+#define HOST_LWIP_TCP_H_
+
+#include "lwip/api.h"
+
+//segments are sent without waiting for the ACK of the previous ones
+void tcp_nagle_disable(struct tcp_pcb *pcb);
+
+#endif /* HOST_LWIP_TCP_H_ */
@@ -0,0 +1,15 @@
+/*
+ * base64.h
+ *
+ *  Host stand-in for the wpa_supplicant Base64 helpers shipped in ESP-IDF.
+ */
+
+#ifndef HOST_WPA2_BASE64_H_
+#define HOST_WPA2_BASE64_H_
+
+#include <stddef.h>
+
+unsigned char *base64_encode(const unsigned char *src, size_t len,
+		size_t *out_len);
+
+#endif /* HOST_WPA2_BASE64_H_ */
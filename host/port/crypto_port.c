@@ -0,0 +1,142 @@
+/*
+ * crypto_port.c
+ *
+ *  Host (Linux) implementation of esp_sha() (SHA-1 only) and of the
+ *  wpa_supplicant base64_encode() shipped with ESP-IDF.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hwcrypto/sha.h"
+#include "wpa2/utils/base64.h"
+
+#define ROL32(x, n)		(((x) << (n)) | ((x) >> (32 - (n))))
+
+static const char base64_table[] =
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// ****************************************************************************
+static void sha1_block(uint32_t h[5], const uint8_t *p){
+	uint32_t w[80], a, b, c, d, e, f, k, t;
+	int i;
+
+	for (i = 0; i < 16; i++){
+		w[i] = ((uint32_t)p[4*i] << 24) | ((uint32_t)p[4*i + 1] << 16) |
+				((uint32_t)p[4*i + 2] << 8) | p[4*i + 3];
+	}
+	for (i = 16; i < 80; i++){
+		w[i] = ROL32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+	}
+	a = h[0]; b = h[1]; c = h[2]; d = h[3]; e = h[4];
+	for (i = 0; i < 80; i++){
+		if (i < 20){
+			f = (b & c) | (~b & d);
+			k = 0x5A827999;
+		}
+		else if (i < 40){
+			f = b ^ c ^ d;
+			k = 0x6ED9EBA1;
+		}
+		else if (i < 60){
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8F1BBCDC;
+		}
+		else{
+			f = b ^ c ^ d;
+			k = 0xCA62C1D6;
+		}
+		t = ROL32(a, 5) + f + e + k + w[i];
+		e = d; d = c; c = ROL32(b, 30); b = a; a = t;
+	}
+	h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+}
+
+// ****************************************************************************
+void esp_sha(esp_sha_type type, const unsigned char *input, size_t ilen,
+		unsigned char *output){
+	uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+	uint8_t block[64];
+	uint64_t bits = (uint64_t)ilen * 8;
+	size_t left = ilen;
+
+	(void)type;
+	while (left >= 64){
+		sha1_block(h, input);
+		input += 64;
+		left -= 64;
+	}
+	memset(block, 0, sizeof(block));
+	memcpy(block, input, left);
+	block[left] = 0x80;
+	if (left >= 56){
+		sha1_block(h, block);
+		memset(block, 0, sizeof(block));
+	}
+	for (int i = 0; i < 8; i++){
+		block[63 - i] = bits >> (8 * i);
+	}
+	sha1_block(h, block);
+	for (int i = 0; i < 5; i++){
+		output[4*i] = h[i] >> 24;
+		output[4*i + 1] = h[i] >> 16;
+		output[4*i + 2] = h[i] >> 8;
+		output[4*i + 3] = h[i];
+	}
+}
+
+// ****************************************************************************
+//same output format as wpa_supplicant: '\n' every 72 chars and at the end
+unsigned char *base64_encode(const unsigned char *src, size_t len,
+		size_t *out_len){
+	unsigned char *out, *pos;
+	const unsigned char *end, *in;
+	size_t olen;
+	int line_len;
+
+	olen = len * 4 / 3 + 4;
+	olen += olen / 72;
+	olen++;
+	out = malloc(olen);
+	if (out == NULL){
+		return NULL;
+	}
+	end = src + len;
+	in = src;
+	pos = out;
+	line_len = 0;
+	while (end - in >= 3){
+		*pos++ = base64_table[in[0] >> 2];
+		*pos++ = base64_table[((in[0] & 0x03) << 4) | (in[1] >> 4)];
+		*pos++ = base64_table[((in[1] & 0x0f) << 2) | (in[2] >> 6)];
+		*pos++ = base64_table[in[2] & 0x3f];
+		in += 3;
+		line_len += 4;
+		if (line_len >= 72){
+			*pos++ = '\n';
+			line_len = 0;
+		}
+	}
+	if (end - in){
+		*pos++ = base64_table[in[0] >> 2];
+		if (end - in == 1){
+			*pos++ = base64_table[(in[0] & 0x03) << 4];
+			*pos++ = '=';
+		}
+		else{
+			*pos++ = base64_table[((in[0] & 0x03) << 4) | (in[1] >> 4)];
+			*pos++ = base64_table[(in[1] & 0x0f) << 2];
+		}
+		*pos++ = '=';
+		line_len += 4;
+	}
+	if (line_len){
+		*pos++ = '\n';
+	}
+	*pos = '\0';
+	if (out_len != NULL){
+		*out_len = pos - out;
+	}
+	return out;
+}
@@ -0,0 +1,462 @@
+/*
+ * freertos_port.c
+ *
+ *  Host (Linux) implementation of the FreeRTOS subset used by the
+ *  WebSocket server: tasks, queues, semaphores and software timers.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/timers.h"
+
+struct host_task{
+	pthread_t thread;
+	TaskFunction_t fn;
+	void *param;
+	char name[16];
+};
+
+struct host_queue{
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+	UBaseType_t length;
+	UBaseType_t item_size;
+	UBaseType_t count;
+	UBaseType_t head;
+	uint8_t *storage;
+};
+
+struct host_timer{
+	struct host_timer *next;
+	TimerCallbackFunction_t cb;
+	void *id;
+	TickType_t period;
+	uint64_t expiry_ms;
+	uint8_t auto_reload;
+	uint8_t active;
+	uint8_t deleted;
+	uint8_t running;
+};
+
+static __thread struct host_task *current_task;
+
+static pthread_once_t timer_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t timer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t timer_cond;
+static struct host_timer *timer_list;
+
+// ****************************************************************************
+static uint64_t now_ms(void){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// ****************************************************************************
+//absolute CLOCK_MONOTONIC deadline for a wait of "ticks"
+static void deadline(struct timespec *ts, TickType_t ticks){
+	uint64_t ms = (uint64_t)ticks * portTICK_PERIOD_MS;
+
+	clock_gettime(CLOCK_MONOTONIC, ts);
+	ts -> tv_sec += ms / 1000;
+	ts -> tv_nsec += (ms % 1000) * 1000000;
+	if (ts -> tv_nsec >= 1000000000){
+		ts -> tv_sec++;
+		ts -> tv_nsec -= 1000000000;
+	}
+}
+
+// ****************************************************************************
+static void cond_init(pthread_cond_t *c){
+	pthread_condattr_t attr;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(c, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+// ****************************************************************************
+//wait on condition, returns 0 on timeout
+static int cond_wait(pthread_cond_t *c, pthread_mutex_t *m, TickType_t ticks,
+		struct timespec *ts){
+	if (ticks == portMAX_DELAY){
+		pthread_cond_wait(c, m);
+		return 1;
+	}
+	return pthread_cond_timedwait(c, m, ts) != ETIMEDOUT;
+}
+
+// ****************************************************************************
+// TASKS
+// ****************************************************************************
+static void *task_trampoline(void *arg){
+	struct host_task *t = arg;
+
+	current_task = t;
+	t -> fn(t -> param);
+	//task function returned without vTaskDelete, FreeRTOS would abort
+	fprintf(stderr, "task %s returned\n", t -> name);
+	abort();
+	return NULL;
+}
+
+// ****************************************************************************
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name,
+		uint32_t stack, void *param, UBaseType_t prio, TaskHandle_t *handle,
+		BaseType_t core_id){
+	struct host_task *t;
+	pthread_attr_t attr;
+
+	(void)stack;
+	(void)prio;
+	t = calloc(1, sizeof(struct host_task));
+	if (t == NULL){
+		return pdFAIL;
+	}
+	t -> fn = fn;
+	t -> param = param;
+	strncpy(t -> name, name, sizeof(t -> name) - 1);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (core_id != tskNO_AFFINITY){
+		cpu_set_t set;
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+		CPU_ZERO(&set);
+		CPU_SET(core_id % (cpus > 0 ? cpus : 1), &set);
+		pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+	}
+	if (handle != NULL){
+		*handle = t;
+	}
+	if (pthread_create(&t -> thread, &attr, task_trampoline, t) != 0){
+		pthread_attr_destroy(&attr);
+		free(t);
+		return pdFAIL;
+	}
+	pthread_attr_destroy(&attr);
+	return pdPASS;
+}
+
+// ****************************************************************************
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack,
+		void *param, UBaseType_t prio, TaskHandle_t *handle){
+
+	return xTaskCreatePinnedToCore(fn, name, stack, param, prio, handle,
+			tskNO_AFFINITY);
+}
+
+// ****************************************************************************
+void vTaskDelete(TaskHandle_t handle){
+	if ((handle == NULL) || (handle == current_task)){
+		//handle memory stays allocated, owners may still hold it
+		pthread_exit(NULL);
+	}
+	pthread_cancel(handle -> thread);
+}
+
+// ****************************************************************************
+void vTaskDelay(TickType_t ticks){
+	struct timespec ts;
+	uint64_t ms = (uint64_t)ticks * portTICK_PERIOD_MS;
+
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000;
+	while (nanosleep(&ts, &ts) != 0 && errno == EINTR);
+}
+
+// ****************************************************************************
+TickType_t xTaskGetTickCount(void){
+	return (TickType_t)(now_ms() / portTICK_PERIOD_MS);
+}
+
+// ****************************************************************************
+// QUEUES
+// ****************************************************************************
+QueueHandle_t host_queue_create(UBaseType_t length, UBaseType_t item_size,
+		UBaseType_t initial_count){
+	struct host_queue *q;
+
+	q = calloc(1, sizeof(struct host_queue));
+	if (q == NULL){
+		return NULL;
+	}
+	if (item_size > 0){
+		q -> storage = malloc(length * item_size);
+		if (q -> storage == NULL){
+			free(q);
+			return NULL;
+		}
+	}
+	q -> length = length;
+	q -> item_size = item_size;
+	q -> count = initial_count;
+	pthread_mutex_init(&q -> lock, NULL);
+	cond_init(&q -> not_empty);
+	cond_init(&q -> not_full);
+	return q;
+}
+
+// ****************************************************************************
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size){
+	return host_queue_create(length, item_size, 0);
+}
+
+// ****************************************************************************
+void vQueueDelete(QueueHandle_t q){
+	if (q == NULL){
+		return;
+	}
+	pthread_mutex_destroy(&q -> lock);
+	pthread_cond_destroy(&q -> not_empty);
+	pthread_cond_destroy(&q -> not_full);
+	free(q -> storage);
+	free(q);
+}
+
+// ****************************************************************************
+BaseType_t xQueueGenericSend(QueueHandle_t q, const void *item,
+		TickType_t ticks, BaseType_t position){
+	struct timespec ts;
+	UBaseType_t slot;
+
+	if (ticks != portMAX_DELAY){
+		deadline(&ts, ticks);
+	}
+	pthread_mutex_lock(&q -> lock);
+	while (q -> count == q -> length){
+		if ((ticks == 0) || !cond_wait(&q -> not_full, &q -> lock, ticks, &ts)){
+			pthread_mutex_unlock(&q -> lock);
+			return errQUEUE_FULL;
+		}
+	}
+	if (q -> item_size > 0){
+		if (position == queueSEND_TO_FRONT){
+			q -> head = (q -> head + q -> length - 1) % q -> length;
+			slot = q -> head;
+		}
+		else{
+			slot = (q -> head + q -> count) % q -> length;
+		}
+		memcpy(q -> storage + slot * q -> item_size, item, q -> item_size);
+	}
+	q -> count++;
+	pthread_cond_signal(&q -> not_empty);
+	pthread_mutex_unlock(&q -> lock);
+	return pdPASS;
+}
+
+// ****************************************************************************
+BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t ticks){
+	struct timespec ts;
+
+	if (ticks != portMAX_DELAY){
+		deadline(&ts, ticks);
+	}
+	pthread_mutex_lock(&q -> lock);
+	while (q -> count == 0){
+		if ((ticks == 0) || !cond_wait(&q -> not_empty, &q -> lock, ticks, &ts)){
+			pthread_mutex_unlock(&q -> lock);
+			return pdFALSE;
+		}
+	}
+	if (q -> item_size > 0){
+		memcpy(item, q -> storage + q -> head * q -> item_size, q -> item_size);
+		q -> head = (q -> head + 1) % q -> length;
+	}
+	q -> count--;
+	pthread_cond_signal(&q -> not_full);
+	pthread_mutex_unlock(&q -> lock);
+	return pdTRUE;
+}
+
+// ****************************************************************************
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q){
+	UBaseType_t n;
+
+	pthread_mutex_lock(&q -> lock);
+	n = q -> count;
+	pthread_mutex_unlock(&q -> lock);
+	return n;
+}
+
+// ****************************************************************************
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t q){
+	UBaseType_t n;
+
+	pthread_mutex_lock(&q -> lock);
+	n = q -> length - q -> count;
+	pthread_mutex_unlock(&q -> lock);
+	return n;
+}
+
+// ****************************************************************************
+// TIMERS
+// ****************************************************************************
+static void timer_unlink(struct host_timer *t){
+	struct host_timer **p;
+
+	for (p = &timer_list; *p != NULL; p = &(*p) -> next){
+		if (*p == t){
+			*p = t -> next;
+			break;
+		}
+	}
+}
+
+// ****************************************************************************
+//timer service thread, the equivalent of the FreeRTOS timer task
+static void *timer_thread(void *arg){
+	struct host_timer *t, *due;
+	struct timespec ts;
+	uint64_t now, next;
+
+	(void)arg;
+	pthread_mutex_lock(&timer_lock);
+	for (;;){
+		now = now_ms();
+		due = NULL;
+		next = UINT64_MAX;
+		for (t = timer_list; t != NULL; t = t -> next){
+			if (t -> active == 0){
+				continue;
+			}
+			if (t -> expiry_ms <= now){
+				due = t;
+				break;
+			}
+			if (t -> expiry_ms < next){
+				next = t -> expiry_ms;
+			}
+		}
+		if (due != NULL){
+			if (due -> auto_reload){
+				due -> expiry_ms = now + due -> period * portTICK_PERIOD_MS;
+			}
+			else{
+				due -> active = 0;
+			}
+			due -> running = 1;
+			pthread_mutex_unlock(&timer_lock);
+			due -> cb(due);
+			pthread_mutex_lock(&timer_lock);
+			due -> running = 0;
+			if (due -> deleted){
+				timer_unlink(due);
+				free(due);
+			}
+			continue;
+		}
+		if (next == UINT64_MAX){
+			pthread_cond_wait(&timer_cond, &timer_lock);
+		}
+		else{
+			ts.tv_sec = next / 1000;
+			ts.tv_nsec = (next % 1000) * 1000000;
+			pthread_cond_timedwait(&timer_cond, &timer_lock, &ts);
+		}
+	}
+	return NULL;
+}
+
+// ****************************************************************************
+static void timer_service_start(void){
+	pthread_t th;
+
+	cond_init(&timer_cond);
+	pthread_create(&th, NULL, timer_thread, NULL);
+	pthread_detach(th);
+}
+
+// ****************************************************************************
+TimerHandle_t xTimerCreate(const char *name, TickType_t period,
+		UBaseType_t auto_reload, void *id, TimerCallbackFunction_t cb){
+	struct host_timer *t;
+
+	(void)name;
+	pthread_once(&timer_once, timer_service_start);
+	t = calloc(1, sizeof(struct host_timer));
+	if (t == NULL){
+		return NULL;
+	}
+	t -> cb = cb;
+	t -> id = id;
+	t -> period = period;
+	t -> auto_reload = auto_reload ? 1 : 0;
+	pthread_mutex_lock(&timer_lock);
+	t -> next = timer_list;
+	timer_list = t;
+	pthread_mutex_unlock(&timer_lock);
+	return t;
+}
+
+// ****************************************************************************
+BaseType_t xTimerStart(TimerHandle_t t, TickType_t ticks){
+	(void)ticks;
+	pthread_mutex_lock(&timer_lock);
+	t -> expiry_ms = now_ms() + t -> period * portTICK_PERIOD_MS;
+	t -> active = 1;
+	pthread_cond_signal(&timer_cond);
+	pthread_mutex_unlock(&timer_lock);
+	return pdPASS;
+}
+
+// ****************************************************************************
+BaseType_t xTimerReset(TimerHandle_t t, TickType_t ticks){
+	return xTimerStart(t, ticks);
+}
+
+// ****************************************************************************
+BaseType_t xTimerStop(TimerHandle_t t, TickType_t ticks){
+	(void)ticks;
+	pthread_mutex_lock(&timer_lock);
+	t -> active = 0;
+	pthread_mutex_unlock(&timer_lock);
+	return pdPASS;
+}
+
+// ****************************************************************************
+BaseType_t xTimerDelete(TimerHandle_t t, TickType_t ticks){
+	(void)ticks;
+	pthread_mutex_lock(&timer_lock);
+	t -> active = 0;
+	if (t -> running){
+		//freed by the timer thread after the callback returns
+		t -> deleted = 1;
+	}
+	else{
+		timer_unlink(t);
+		free(t);
+	}
+	pthread_mutex_unlock(&timer_lock);
+	return pdPASS;
+}
+
+// ****************************************************************************
+BaseType_t xTimerIsTimerActive(TimerHandle_t t){
+	BaseType_t a;
+
+	pthread_mutex_lock(&timer_lock);
+	a = t -> active;
+	pthread_mutex_unlock(&timer_lock);
+	return a;
+}
+
+// ****************************************************************************
+void *pvTimerGetTimerID(TimerHandle_t t){
+	return t -> id;
+}
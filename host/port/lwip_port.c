@@ -0,0 +1,351 @@
+/*
+ * lwip_port.c
+ *
+ *  Host (Linux) implementation of the lwIP netconn subset used by the
+ *  WebSocket server, on top of blocking POSIX TCP sockets.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+
+#include "lwip/api.h"
+#include "lwip/tcp.h"
+
+#define HOST_RECV_LEN		(4 * HOST_TCP_MSS)
+
+struct netbuf_seg{
+	struct netbuf_seg *next;
+	u16_t len;
+	uint8_t data[];
+};
+
+struct netbuf{
+	struct netbuf_seg *first;
+	struct netbuf_seg *ptr;
+};
+
+static pthread_once_t seg_once = PTHREAD_ONCE_INIT;
+static size_t seg_len = HOST_TCP_MSS;
+
+// ****************************************************************************
+static void seg_len_init(void){
+	const char *env = getenv("HOST_LWIP_SEGMENT");
+
+	if ((env != NULL) && (atoi(env) > 0)){
+		seg_len = atoi(env);
+	}
+}
+
+// ****************************************************************************
+static err_t errno_to_err(int e){
+	switch (e){
+	case EAGAIN:
+		return ERR_WOULDBLOCK;
+	case ECONNRESET:
+		return ERR_RST;
+	case EPIPE:
+	case ENOTCONN:
+		return ERR_CLSD;
+	case ETIMEDOUT:
+		return ERR_TIMEOUT;
+	case ENOMEM:
+	case ENOBUFS:
+		return ERR_MEM;
+	default:
+		return ERR_ABRT;
+	}
+}
+
+// ****************************************************************************
+struct netconn *netconn_new(enum netconn_type type){
+	struct netconn *conn;
+	int one = 1;
+
+	(void)type;
+	conn = calloc(1, sizeof(struct netconn));
+	if (conn == NULL){
+		return NULL;
+	}
+	conn -> fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (conn -> fd < 0){
+		free(conn);
+		return NULL;
+	}
+	setsockopt(conn -> fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	conn -> pcb.tcp = (struct tcp_pcb *)conn;
+	return conn;
+}
+
+// ****************************************************************************
+err_t netconn_bind(struct netconn *conn, const ip_addr_t *addr, u16_t port){
+	struct sockaddr_in sa;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(port);
+	sa.sin_addr.s_addr = (addr != NULL) ? addr -> addr : htonl(INADDR_ANY);
+	if (bind(conn -> fd, (struct sockaddr *)&sa, sizeof(sa)) != 0){
+		return ERR_USE;
+	}
+	return ERR_OK;
+}
+
+// ****************************************************************************
+err_t netconn_listen(struct netconn *conn){
+	if (listen(conn -> fd, 16) != 0){
+		return ERR_VAL;
+	}
+	return ERR_OK;
+}
+
+// ****************************************************************************
+err_t netconn_accept(struct netconn *conn, struct netconn **new_conn){
+	struct timeval tv = {0};
+	struct netconn *nc;
+	int fd;
+
+	fd = accept(conn -> fd, NULL, NULL);
+	if (fd < 0){
+		if (errno == EAGAIN){
+			//receive timeout of the listener
+			return ERR_TIMEOUT;
+		}
+		return (errno == EINVAL) ? ERR_CLSD : errno_to_err(errno);
+	}
+	nc = calloc(1, sizeof(struct netconn));
+	if (nc == NULL){
+		close(fd);
+		return ERR_MEM;
+	}
+	//Linux copies the listener's receive timeout, a new lwIP netconn has none
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	nc -> fd = fd;
+	nc -> pcb.tcp = (struct tcp_pcb *)nc;
+	*new_conn = nc;
+	return ERR_OK;
+}
+
+// ****************************************************************************
+void tcp_nagle_disable(struct tcp_pcb *pcb){
+	struct netconn *conn = (struct netconn *)pcb;
+	int one = 1;
+
+	setsockopt(conn -> fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+// ****************************************************************************
+void netconn_set_recvtimeout(struct netconn *conn, int timeout_ms){
+	struct timeval tv;
+
+	tv.tv_sec = timeout_ms / 1000;
+	tv.tv_usec = (timeout_ms % 1000) * 1000;
+	setsockopt(conn -> fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+// ****************************************************************************
+//read what is available and split it into a chain of MSS sized segments
+err_t netconn_recv(struct netconn *conn, struct netbuf **new_buf){
+	uint8_t data[HOST_RECV_LEN];
+	struct netbuf *buf;
+	struct netbuf_seg **tail, *seg;
+	ssize_t n;
+	size_t pos, len;
+
+	pthread_once(&seg_once, seg_len_init);
+	*new_buf = NULL;
+	if (conn -> closed){
+		return ERR_CLSD;
+	}
+	do {
+		n = recv(conn -> fd, data, sizeof(data), 0);
+	} while ((n < 0) && (errno == EINTR));
+	if (n == 0){
+		return ERR_CLSD;
+	}
+	if (n < 0){
+		return (errno == EAGAIN) ? ERR_TIMEOUT : errno_to_err(errno);
+	}
+
+	buf = calloc(1, sizeof(struct netbuf));
+	if (buf == NULL){
+		return ERR_MEM;
+	}
+	tail = &buf -> first;
+	for (pos = 0; pos < (size_t)n; pos += len){
+		len = n - pos;
+		if (len > seg_len){
+			len = seg_len;
+		}
+		//one spare byte, pbufs are usually followed by more memory
+		seg = malloc(sizeof(struct netbuf_seg) + len + 1);
+		if (seg == NULL){
+			netbuf_delete(buf);
+			return ERR_MEM;
+		}
+		seg -> next = NULL;
+		seg -> len = len;
+		memcpy(seg -> data, data + pos, len);
+		seg -> data[len] = 0;
+		*tail = seg;
+		tail = &seg -> next;
+	}
+	buf -> ptr = buf -> first;
+	*new_buf = buf;
+	return ERR_OK;
+}
+
+// ****************************************************************************
+err_t netconn_write_vectors_partly(struct netconn *conn,
+		struct netvector *vectors, u16_t vectorcnt, u8_t apiflags,
+		size_t *bytes_written){
+	struct iovec iov[16];
+	struct msghdr msg;
+	size_t total = 0, done = 0;
+	ssize_t n;
+	int flags = MSG_NOSIGNAL, cnt;
+
+	if (vectorcnt > 16){
+		return ERR_ARG;
+	}
+	for (cnt = 0; cnt < vectorcnt; cnt++){
+		iov[cnt].iov_base = (void *)vectors[cnt].ptr;
+		iov[cnt].iov_len = vectors[cnt].len;
+		total += vectors[cnt].len;
+	}
+	if (apiflags & NETCONN_DONTBLOCK){
+		flags |= MSG_DONTWAIT;
+	}
+	if (apiflags & NETCONN_MORE){
+		flags |= MSG_MORE;
+	}
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = vectorcnt;
+	while (done < total){
+		n = sendmsg(conn -> fd, &msg, flags);
+		if (n < 0){
+			if (errno == EINTR){
+				continue;
+			}
+			if (bytes_written != NULL){
+				*bytes_written = done;
+			}
+			if ((errno == EAGAIN) && (done > 0)){
+				return ERR_OK;
+			}
+			return errno_to_err(errno);
+		}
+		done += n;
+		if (apiflags & NETCONN_DONTBLOCK){
+			break;
+		}
+		//skip what was written
+		while ((msg.msg_iovlen > 0) && ((size_t)n >= msg.msg_iov -> iov_len)){
+			n -= msg.msg_iov -> iov_len;
+			msg.msg_iov++;
+			msg.msg_iovlen--;
+		}
+		if (msg.msg_iovlen > 0){
+			msg.msg_iov -> iov_base = (uint8_t *)msg.msg_iov -> iov_base + n;
+			msg.msg_iov -> iov_len -= n;
+		}
+	}
+	if (bytes_written != NULL){
+		*bytes_written = done;
+	}
+	return ERR_OK;
+}
+
+// ****************************************************************************
+err_t netconn_write_partly(struct netconn *conn, const void *dataptr,
+		size_t size, u8_t apiflags, size_t *bytes_written){
+	struct netvector vec;
+
+	vec.ptr = dataptr;
+	vec.len = size;
+	return netconn_write_vectors_partly(conn, &vec, 1, apiflags, bytes_written);
+}
+
+// ****************************************************************************
+//shutdown only, the descriptor is released by netconn_delete
+err_t netconn_close(struct netconn *conn){
+	if (conn -> closed){
+		return ERR_OK;
+	}
+	conn -> closed = 1;
+	if (shutdown(conn -> fd, SHUT_RDWR) != 0){
+		return (errno == ENOTCONN) ? ERR_OK : errno_to_err(errno);
+	}
+	return ERR_OK;
+}
+
+// ****************************************************************************
+err_t netconn_delete(struct netconn *conn){
+	if (conn == NULL){
+		return ERR_OK;
+	}
+	close(conn -> fd);
+	free(conn);
+	return ERR_OK;
+}
+
+// ****************************************************************************
+err_t netbuf_data(struct netbuf *buf, void **dataptr, u16_t *len){
+	if (buf -> ptr == NULL){
+		return ERR_BUF;
+	}
+	*dataptr = buf -> ptr -> data;
+	*len = buf -> ptr -> len;
+	return ERR_OK;
+}
+
+// ****************************************************************************
+s8_t netbuf_next(struct netbuf *buf){
+	if (buf -> ptr -> next == NULL){
+		return -1;
+	}
+	buf -> ptr = buf -> ptr -> next;
+	if (buf -> ptr -> next == NULL){
+		return 1;
+	}
+	return 0;
+}
+
+// ****************************************************************************
+void netbuf_first(struct netbuf *buf){
+	buf -> ptr = buf -> first;
+}
+
+// ****************************************************************************
+u16_t netbuf_len(struct netbuf *buf){
+	struct netbuf_seg *seg;
+	u16_t len = 0;
+
+	for (seg = buf -> first; seg != NULL; seg = seg -> next){
+		len += seg -> len;
+	}
+	return len;
+}
+
+// ****************************************************************************
+void netbuf_delete(struct netbuf *buf){
+	struct netbuf_seg *seg, *next;
+
+	if (buf == NULL){
+		return;
+	}
+	for (seg = buf -> first; seg != NULL; seg = next){
+		next = seg -> next;
+		free(seg);
+	}
+	free(buf);
+}
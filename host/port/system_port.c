@@ -0,0 +1,42 @@
+/*
+ * system_port.c
+ *
+ *  Host (Linux) implementation of the ESP-IDF heap information functions:
+ *  free bytes held by malloc (glibc mallinfo2), the minimum is the lowest
+ *  value seen by the calls; and of esp_timer_get_time() (monotonic clock).
+ */
+
+#include <stdint.h>
+#include <malloc.h>
+#include <time.h>
+
+#include "esp_system.h"
+#include "esp_timer.h"
+
+static uint32_t min_free = UINT32_MAX;
+
+// ****************************************************************************
+uint32_t esp_get_free_heap_size(void){
+	struct mallinfo2 mi = mallinfo2();
+	uint32_t free_size;
+
+	free_size = (mi.fordblks > UINT32_MAX) ? UINT32_MAX : mi.fordblks;
+	if (free_size < min_free){
+		min_free = free_size;
+	}
+	return free_size;
+}
+
+// ****************************************************************************
+uint32_t esp_get_minimum_free_heap_size(void){
+	return (min_free == UINT32_MAX) ? esp_get_free_heap_size() : min_free;
+}
+
+// ****************************************************************************
+//microseconds since boot
+int64_t esp_timer_get_time(void){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
@@ -0,0 +1,1232 @@
+/*
+ * ws_load.c
+ *
+ *  Loopback load generator for the host build of the WebSocket server.
+ *  The server runs in this process (same code as on ESP32, on top of the
+ *  host FreeRTOS/lwIP ports), an application task echoes every received
+ *  message back, and N client threads drive it over real TCP sockets.
+ *
+ *  Scenarios:
+ *  - handshake: connect, upgrade, close handshake, repeated,
+ *  - echo: request/response round trips, latency is measured per message,
+ *    with -w several frames are sent in one write (pipelining), messages
+ *    longer than the server's MAX_PAYLOAD_LEN arrive at the application in
+ *    parts and are echoed as one frame made of those blocks (ws_send_vec),
+ *    with -f clients send messages in fragments with pings between them,
+ *    with -R the server passes every fragment on (WS_RX_STREAM) and the
+ *    application echoes the parts as fragments (ws_send_fragment),
+ *  - broadcast: the application sends with ws_send(index = -1), latency is
+ *    measured from ws_send() to reception in every client, with -x some
+ *    clients stop reading (slow consumers, handled by the -P policy) and
+ *    only the other clients are measured.
+ *
+ *  -E select runs the server with one task for all connections
+ *  (WS_ENGINE_SELECT, up to 32 clients) instead of a task per connection,
+ *  -M sets the max number of clients of the server.
+ *
+ *  -A takes queue items, frames and payloads from pools (item_pool_nr,
+ *  buf_pool) instead of the heap, pool statistics are printed at the end.
+ *
+ *  -D makes clients offer permessage-deflate (compressed with zlib, context
+ *  kept between messages if the server allows it), messages are JSON text
+ *  then, MB/s counts uncompressed bytes.
+ *
+ *  -H sets the server's heartbeat period (ping_period_ms), clients answer
+ *  the pings, except the stalled ones (-x), which are closed after 3 periods.
+ *
+ *  -C combines small frames of a connection in a buffer of this size
+ *  (tx_coalesce_len), -U sets how long they wait for more (tx_coalesce_us),
+ *  -S shows the number of writes.
+ *
+ *  -K gives the broadcast messages keys 1..keys (in turn), a slow client
+ *  gets only the latest message of every key, -S shows the replaced ones.
+ *
+ *  -B echoes whole messages from the receive callback (recv_cb), in the
+ *  receive task, instead of the application task.
+ *
+ *  -T async publishes from the application's own buffers with ws_send_to()
+ *  (a buffer is reused after its completion callback), -T sync waits for
+ *  every message with ws_send_to_sync(), the connections reached are
+ *  reported (-K is not used then). -T frame sends prepared frames
+ *  (ws_frame_prepare, ws_send_frame), only the timestamp is patched.
+ *
+ *  -N splits the connections among so many shards (send and select tasks
+ *  with own connections, pinned to the cores), "make shards" compares 1, 2
+ *  and 4 shards.
+ *
+ *  -S prints the server statistics (ws_get_stats) at the end, and the
+ *  latency of the pipeline stages when built with LATENCY=1.
+ *
+ *  Server log goes to /dev/null unless -v is given, the report is printed
+ *  on stdout.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <zlib.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "hwcrypto/sha.h"
+#include "wpa2/utils/base64.h"
+
+#include "websocket_server.h"
+
+#define RBUF_LEN		(1024 * 1024)
+#define PUB_BUFS		32		//buffers of the publisher with -T async
+#define APP_SLOTS		64		//connections with a message being collected
+#define RECV_TIMEOUT_S	5
+
+typedef struct{
+	int fd;
+	size_t start;
+	size_t end;
+	uint8_t fin;			//FIN bit of the last received frame
+	int rcvbuf;				//socket receive buffer, 0 - default
+	uint8_t rsv1;			//first frame of the last message is compressed
+	uint8_t pmd;			//permessage-deflate accepted by the server
+	uint8_t takeover;		//compression context kept between messages
+	z_stream zd;
+	z_stream zi;
+	uint8_t *zbuf;			//compressed message
+	uint8_t buf[RBUF_LEN];
+} client_t;
+
+typedef struct{
+	uint32_t *lat_us;		//latency samples
+	size_t lat_nr;
+	size_t lat_cap;
+	uint64_t msgs;
+	uint64_t bytes;
+	uint32_t errors;
+	uint32_t busy;
+} result_t;
+
+typedef struct{
+	pthread_t thread;
+	int id;
+	result_t res;
+} worker_t;
+
+//test parameters
+static uint16_t port = 8080;
+static int clients = 4;
+static int count = 10000;
+static int handshakes = 200;
+static int msg_size = 64;
+static int window = 1;
+static int frag_len = 0;
+static int stalled = 0;
+static WS_TX_POLICY tx_policy = WS_TX_DROP_OLDEST;
+static WS_ENGINE engine = WS_ENGINE_TASKS;
+static int max_clients = 0;
+static WS_RX_MODE rx_mode = WS_RX_REASSEMBLE;
+static int pools = 0;
+static int deflate_on = 0;
+static int ping_period = 0;
+static int coalesce_len = 0;
+static int coalesce_us = 0;
+static int keys = 0;
+static int recv_cb = 0;
+static int shard_nr = 0;
+static int send_to = 0;			//1 - ws_send_to(), 2 - ws_send_to_sync(),
+								//3 - ws_send_frame()
+static volatile int pub_busy[PUB_BUFS];
+static volatile uint64_t pub_reached;
+static volatile uint32_t pub_done;
+static FILE *report;
+
+static pthread_barrier_t start_barrier;
+static volatile int start_ready;		//workers waiting for the start
+static volatile int bcast_done;		//publisher queued all messages
+
+// ****************************************************************************
+static uint64_t now_ns(void){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// ****************************************************************************
+static void add_sample(result_t *r, uint64_t ns){
+	if (r -> lat_nr == r -> lat_cap){
+		r -> lat_cap = r -> lat_cap ? r -> lat_cap * 2 : 1024;
+		r -> lat_us = realloc(r -> lat_us, r -> lat_cap * sizeof(uint32_t));
+	}
+	r -> lat_us[r -> lat_nr++] = ns / 1000;
+}
+
+// ****************************************************************************
+// CLIENT SIDE WEBSOCKET
+// ****************************************************************************
+static int client_connect(client_t *c){
+	struct sockaddr_in sa;
+	struct timeval tv = {RECV_TIMEOUT_S, 0};
+	int one = 1;
+
+	c -> start = c -> end = 0;
+	c -> fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (c -> fd < 0){
+		return -1;
+	}
+	if (c -> rcvbuf > 0){
+		setsockopt(c -> fd, SOL_SOCKET, SO_RCVBUF, &c -> rcvbuf, sizeof(int));
+	}
+	setsockopt(c -> fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	setsockopt(c -> fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(port);
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (connect(c -> fd, (struct sockaddr *)&sa, sizeof(sa)) != 0){
+		close(c -> fd);
+		c -> fd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+// ****************************************************************************
+static void client_close(client_t *c){
+	if (c -> fd >= 0){
+		close(c -> fd);
+		c -> fd = -1;
+	}
+}
+
+// ****************************************************************************
+static void client_free(client_t *c){
+	if (c -> zbuf != NULL){
+		deflateEnd(&c -> zd);
+		inflateEnd(&c -> zi);
+		free(c -> zbuf);
+	}
+	free(c);
+}
+
+// ****************************************************************************
+static int send_all(int fd, const uint8_t *p, size_t len){
+	ssize_t n;
+
+	while (len > 0){
+		n = send(fd, p, len, MSG_NOSIGNAL);
+		if (n < 0){
+			if (errno == EINTR){
+				continue;
+			}
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+// ****************************************************************************
+//make sure at least "need" bytes are buffered
+static int client_fill(client_t *c, size_t need){
+	ssize_t n;
+
+	if (c -> end - c -> start >= need){
+		return 0;
+	}
+	if (c -> start > 0){
+		memmove(c -> buf, c -> buf + c -> start, c -> end - c -> start);
+		c -> end -= c -> start;
+		c -> start = 0;
+	}
+	while (c -> end < need){
+		n = recv(c -> fd, c -> buf + c -> end, RBUF_LEN - c -> end, 0);
+		if (n <= 0){
+			if ((n < 0) && (errno == EINTR)){
+				continue;
+			}
+			return -1;
+		}
+		c -> end += n;
+	}
+	return 0;
+}
+
+// ****************************************************************************
+//opening handshake, returns 1 on success, 0 if the server is busy, -1 on error
+static int client_handshake(client_t *c){
+	char req[320], key[32], accept[96], *resp, *hdr;
+	uint8_t raw[16], sha[20];
+	unsigned char *b64;
+	size_t len;
+	int n;
+
+	for (int i = 0; i < 16; i++){
+		raw[i] = rand();
+	}
+	b64 = base64_encode(raw, 16, &len);
+	memcpy(key, b64, 24);
+	key[24] = 0;
+	free(b64);
+	n = snprintf(req, sizeof(req), "GET / HTTP/1.1\r\nHost: localhost:%u\r\n"\
+			"Upgrade: websocket\r\nConnection: Upgrade\r\n"\
+			"Sec-WebSocket-Key: %s\r\nSec-WebSocket-Version: 13\r\n%s\r\n",
+			port, key, deflate_on ? "Sec-WebSocket-Extensions: "\
+			"permessage-deflate; client_max_window_bits\r\n" : "");
+	if (send_all(c -> fd, (uint8_t *)req, n) != 0){
+		return -1;
+	}
+
+	//read response up to the empty line
+	for (;;){
+		if (client_fill(c, c -> end - c -> start + 1) != 0){
+			return -1;
+		}
+		c -> buf[c -> end] = 0;
+		resp = (char *)c -> buf + c -> start;
+		if (strncmp(resp, "HTTP/1.1 503", 12) == 0){
+			return 0;
+		}
+		hdr = strstr(resp, "\n\r\n");
+		if (hdr != NULL){
+			break;
+		}
+		if (c -> end >= RBUF_LEN - 1){
+			return -1;
+		}
+	}
+	if (strncmp(resp, "HTTP/1.1 101", 12) != 0){
+		return -1;
+	}
+
+	//check accept key
+	snprintf(accept, sizeof(accept), "%s258EAFA5-E914-47DA-95CA-C5AB0DC85B11", key);
+	esp_sha(SHA1, (unsigned char *)accept, strlen(accept), sha);
+	b64 = base64_encode(sha, 20, &len);
+	b64[28] = 0;
+	if (strstr(resp, (char *)b64) == NULL){
+		free(b64);
+		return -1;
+	}
+	free(b64);
+	c -> pmd = 0;
+	*hdr = 0;
+	if (strstr(resp, "permessage-deflate") != NULL){
+		char *p = strstr(resp, "client_max_window_bits=");
+		int bits = (p != NULL) ? atoi(p + 23) : 15;
+
+		c -> pmd = 1;
+		c -> takeover = (strstr(resp, "client_no_context_takeover") == NULL);
+		if (c -> zbuf == NULL){
+			c -> zbuf = malloc(RBUF_LEN + 4);
+			inflateInit2(&c -> zi, -15);
+		}
+		else{
+			deflateEnd(&c -> zd);
+		}
+		//zlib does not make raw deflate with 8 bit windows, 9 bit window
+		//is used then and the context is not kept
+		if (bits < 9){
+			c -> takeover = 0;
+		}
+		deflateInit2(&c -> zd, 1, Z_DEFLATED, (bits < 9) ? -9 : -bits, 8,
+				Z_DEFAULT_STRATEGY);
+	}
+	c -> start += (hdr + 3) - resp;
+	return 1;
+}
+
+// ****************************************************************************
+//compress message into c -> zbuf (raw deflate, sync flush without its tail),
+//returns compressed length
+static size_t client_deflate(client_t *c, const uint8_t *msg, size_t len){
+	if (c -> takeover == 0){
+		deflateReset(&c -> zd);
+	}
+	c -> zd.next_in = (uint8_t *)msg;
+	c -> zd.avail_in = len;
+	c -> zd.next_out = c -> zbuf;
+	c -> zd.avail_out = RBUF_LEN;
+	deflate(&c -> zd, Z_SYNC_FLUSH);
+	return RBUF_LEN - c -> zd.avail_out - 4;
+}
+
+// ****************************************************************************
+//decompress message of len bytes in out (server never keeps the context),
+//returns -1 on error
+static int client_inflate(client_t *c, uint8_t *out, size_t cap, size_t *len){
+	static const uint8_t tail[4] = {0x00, 0x00, 0xFF, 0xFF};
+	int r;
+
+	memcpy(c -> zbuf, out, *len);
+	memcpy(c -> zbuf + *len, tail, 4);
+	inflateReset(&c -> zi);
+	c -> zi.next_in = c -> zbuf;
+	c -> zi.avail_in = *len + 4;
+	c -> zi.next_out = out;
+	c -> zi.avail_out = cap;
+	r = inflate(&c -> zi, Z_SYNC_FLUSH);
+	if (((r != Z_OK) && (r != Z_BUF_ERROR)) || (c -> zi.avail_in != 0)){
+		return -1;
+	}
+	*len = cap - c -> zi.avail_out;
+	return 0;
+}
+
+// ****************************************************************************
+//encode masked client frame into out, returns frame length
+static size_t client_frame(uint8_t *out, uint8_t opcode, const uint8_t *payload,
+		size_t len){
+	uint8_t mask[4];
+	size_t hlen = 2;
+
+	out[0] = 0x80 | opcode;
+	if (len <= 125){
+		out[1] = 0x80 | len;
+	}
+	else if (len <= 0xFFFF){
+		out[1] = 0x80 | 126;
+		out[2] = len >> 8;
+		out[3] = len;
+		hlen = 4;
+	}
+	else{
+		out[1] = 0x80 | 127;
+		for (int i = 0; i < 8; i++){
+			out[2 + i] = (uint64_t)len >> (56 - 8 * i);
+		}
+		hlen = 10;
+	}
+	for (int i = 0; i < 4; i++){
+		mask[i] = rand();
+		out[hlen + i] = mask[i];
+	}
+	hlen += 4;
+	for (size_t i = 0; i < len; i++){
+		out[hlen + i] = payload[i] ^ mask[i & 3];
+	}
+	return hlen + len;
+}
+
+// ****************************************************************************
+static int client_send(client_t *c, uint8_t opcode, const uint8_t *payload,
+		size_t len){
+	uint8_t *frame;
+	int ret;
+
+	frame = malloc(len + 14);
+	if (frame == NULL){
+		return -1;
+	}
+	ret = send_all(c -> fd, frame, client_frame(frame, opcode, payload, len));
+	free(frame);
+	return ret;
+}
+
+// ****************************************************************************
+//receive one frame, payload stays in the client buffer until the next call
+static int client_recv(client_t *c, uint8_t *opcode, uint8_t **payload,
+		size_t *len){
+	uint8_t *p;
+	size_t hlen = 2;
+	uint64_t plen;
+
+	if (client_fill(c, 2) != 0){
+		return -1;
+	}
+	p = c -> buf + c -> start;
+	plen = p[1] & 0x7F;
+	if (plen == 126){
+		hlen = 4;
+	}
+	else if (plen == 127){
+		hlen = 10;
+	}
+	if (client_fill(c, hlen) != 0){
+		return -1;
+	}
+	p = c -> buf + c -> start;
+	if (plen == 126){
+		plen = ((uint16_t)p[2] << 8) | p[3];
+	}
+	else if (plen == 127){
+		plen = 0;
+		for (int i = 0; i < 8; i++){
+			plen = (plen << 8) | p[2 + i];
+		}
+	}
+	if (hlen + plen > RBUF_LEN){
+		return -1;
+	}
+	if (client_fill(c, hlen + plen) != 0){
+		return -1;
+	}
+	p = c -> buf + c -> start;
+	*opcode = p[0] & 0x0F;
+	c -> fin = p[0] >> 7;
+	if (*opcode != WS_OP_CON){
+		c -> rsv1 = (p[0] >> 6) & 1;
+	}
+	*payload = p + hlen;
+	*len = plen;
+	c -> start += hlen + plen;
+	return 0;
+}
+
+// ****************************************************************************
+//receive whole data message (fragments are joined, pings are answered,
+//pongs skipped) into out
+static int client_recv_msg(client_t *c, uint8_t *out, size_t cap, size_t *len){
+	uint8_t opcode, *payload;
+	size_t plen;
+
+	*len = 0;
+	for (;;){
+		if (client_recv(c, &opcode, &payload, &plen) != 0){
+			return -1;
+		}
+		if (opcode & 0x08){
+			if (opcode == WS_OP_CLS){
+				return -1;
+			}
+			if ((opcode == WS_OP_PIN) &&
+					(client_send(c, WS_OP_PON, payload, plen) != 0)){
+				return -1;
+			}
+			continue;
+		}
+		if (*len + plen > cap){
+			return -1;
+		}
+		memcpy(out + *len, payload, plen);
+		*len += plen;
+		if (c -> fin == 1){
+			return (c -> rsv1 == 1) ? client_inflate(c, out, cap, len) : 0;
+		}
+	}
+}
+
+// ****************************************************************************
+//encode message as masked fragments of frag_len bytes with a ping after each
+//but the last one, returns length
+static size_t client_fragments(uint8_t *out, const uint8_t *msg, size_t len){
+	size_t pos = 0, n, start, out_len = 0;
+	uint8_t opcode = WS_OP_BIN;
+
+	do {
+		n = (len - pos > (size_t)frag_len) ? (size_t)frag_len : len - pos;
+		start = out_len;
+		out_len += client_frame(out + out_len, opcode, msg + pos, n);
+		pos += n;
+		if (pos < len){
+			//clear FIN bit
+			out[start] &= 0x7F;
+			out_len += client_frame(out + out_len, WS_OP_PIN, (uint8_t *)"p", 1);
+		}
+		opcode = WS_OP_CON;
+	} while (pos < len);
+	return out_len;
+}
+
+// ****************************************************************************
+static int client_open(client_t *c, result_t *r){
+	int res;
+
+	for (int retry = 0; retry < 1000; retry++){
+		if (client_connect(c) != 0){
+			usleep(1000);
+			continue;
+		}
+		res = client_handshake(c);
+		if (res == 1){
+			return 0;
+		}
+		client_close(c);
+		if (res < 0){
+			return -1;
+		}
+		r -> busy++;
+		usleep(1000);
+	}
+	return -1;
+}
+
+// ****************************************************************************
+//client sends close frame and waits for the server's close frame
+static void client_shutdown(client_t *c){
+	uint8_t code[2] = {1000 >> 8, 1000 & 0xFF};
+	uint8_t opcode, *payload;
+	size_t len;
+
+	if (client_send(c, WS_OP_CLS, code, 2) == 0){
+		while (client_recv(c, &opcode, &payload, &len) == 0){
+			if (opcode == WS_OP_CLS){
+				break;
+			}
+		}
+	}
+	client_close(c);
+}
+
+// ****************************************************************************
+// SCENARIOS
+// ****************************************************************************
+//message content: the same byte or, with -D, JSON sensor readings
+static void fill_msg(uint8_t *msg, size_t len, uint8_t c){
+	char part[80];
+	size_t n = 0, k;
+
+	if (deflate_on == 0){
+		memset(msg, c, len);
+		return;
+	}
+	while (n < len){
+		k = snprintf(part, sizeof(part), "{\"sensor\":%i,\"value\":%i.%02i,"\
+				"\"unit\":\"C\"},", rand() % 16, rand() % 100, rand() % 100);
+		k = (k > len - n) ? len - n : k;
+		memcpy(msg + n, part, k);
+		n += k;
+	}
+}
+
+// ****************************************************************************
+//wait until all workers are ready (busy clients retry for a while), an
+//open client c answers heartbeat pings meanwhile, as a browser would
+static void start_wait(client_t *c){
+	uint8_t opcode, *payload;
+	size_t len;
+	struct pollfd pfd;
+
+	__atomic_add_fetch(&start_ready, 1, __ATOMIC_SEQ_CST);
+	while ((c != NULL) &&
+			(__atomic_load_n(&start_ready, __ATOMIC_SEQ_CST) < clients)){
+		pfd.fd = c -> fd;
+		pfd.events = POLLIN;
+		if ((poll(&pfd, 1, 10) == 1) &&
+				(client_recv(c, &opcode, &payload, &len) == 0) &&
+				(opcode == WS_OP_PIN)){
+			client_send(c, WS_OP_PON, payload, len);
+		}
+	}
+	pthread_barrier_wait(&start_barrier);
+}
+
+// ****************************************************************************
+static void *handshake_worker(void *arg){
+	worker_t *w = arg;
+	client_t *c = calloc(1, sizeof(client_t));
+	uint64_t t0;
+
+	start_wait(NULL);
+	for (int i = 0; i < handshakes; i++){
+		t0 = now_ns();
+		if (client_open(c, &w -> res) != 0){
+			w -> res.errors++;
+			continue;
+		}
+		add_sample(&w -> res, now_ns() - t0);
+		w -> res.msgs++;
+		client_shutdown(c);
+	}
+	client_free(c);
+	return NULL;
+}
+
+// ****************************************************************************
+//"window" frames are sent in one write, so they share TCP segments
+static void *echo_worker(void *arg){
+	worker_t *w = arg;
+	client_t *c = calloc(1, sizeof(client_t));
+	uint8_t *msg, *rmsg, *batch, *data;
+	uint64_t t0;
+	size_t len, batch_len, frags, start;
+	int n;
+
+	frags = (frag_len > 0) ? msg_size / frag_len + 1 : 1;
+	msg = malloc(msg_size);
+	rmsg = malloc(msg_size + 1);
+	//compressed message may be a bit longer
+	batch = malloc((msg_size + msg_size / 64 + 64 + 20 * frags) * window);
+	fill_msg(msg, msg_size, 'a' + w -> id % 26);
+	if (client_open(c, &w -> res) != 0){
+		w -> res.errors++;
+		start_wait(NULL);
+		goto out;
+	}
+	start_wait(c);
+	for (int i = 0; i < count; i += n){
+		n = (count - i < window) ? count - i : window;
+		t0 = now_ns();
+		if (msg_size >= 8){
+			memcpy(msg, &t0, 8);
+		}
+		batch_len = 0;
+		for (int j = 0; j < n; j++){
+			data = msg;
+			len = msg_size;
+			if (c -> pmd == 1){
+				data = c -> zbuf;
+				len = client_deflate(c, msg, msg_size);
+			}
+			start = batch_len;
+			if (frag_len > 0){
+				batch_len += client_fragments(batch + batch_len, data, len);
+			}
+			else{
+				batch_len += client_frame(batch + batch_len, WS_OP_BIN, data, len);
+			}
+			if (c -> pmd == 1){
+				//RSV1 in the first frame
+				batch[start] |= 0x40;
+			}
+		}
+		if (send_all(c -> fd, batch, batch_len) != 0){
+			w -> res.errors++;
+			break;
+		}
+		for (int j = 0; j < n; j++){
+			if ((client_recv_msg(c, rmsg, msg_size, &len) != 0) ||
+					(len != (size_t)msg_size) || (memcmp(rmsg, msg, len) != 0)){
+				w -> res.errors++;
+				goto close;
+			}
+			add_sample(&w -> res, now_ns() - t0);
+			w -> res.msgs++;
+			w -> res.bytes += len;
+		}
+	}
+close:
+	client_shutdown(c);
+out:
+	free(batch);
+	free(rmsg);
+	free(msg);
+	client_free(c);
+	return NULL;
+}
+
+// ****************************************************************************
+static void *broadcast_worker(void *arg){
+	worker_t *w = arg;
+	client_t *c = calloc(1, sizeof(client_t));
+	uint8_t opcode, *payload, *rmsg = malloc(msg_size + 1);
+	uint64_t t0;
+	size_t len;
+
+	if (w -> id < stalled){
+		//slow consumer, small window and nothing read
+		c -> rcvbuf = 4096;
+	}
+	if (client_open(c, &w -> res) != 0){
+		w -> res.errors++;
+		start_wait(NULL);
+		goto out;
+	}
+	start_wait(c);
+	if (w -> id < stalled){
+		while (__atomic_load_n(&bcast_done, __ATOMIC_ACQUIRE) == 0){
+			usleep(1000);
+		}
+		client_close(c);
+		goto out;
+	}
+	for (int i = 0; i < count; i++){
+		if (client_recv(c, &opcode, &payload, &len) != 0){
+			//timeout, server dropped messages
+			break;
+		}
+		if (opcode == WS_OP_PIN){
+			//heartbeat (-H)
+			client_send(c, WS_OP_PON, payload, len);
+			i--;
+			continue;
+		}
+		if (c -> rsv1 == 1){
+			memcpy(rmsg, payload, len);
+			if (client_inflate(c, rmsg, msg_size, &len) != 0){
+				w -> res.errors++;
+				break;
+			}
+			payload = rmsg;
+		}
+		if (len >= 8){
+			memcpy(&t0, payload, 8);
+			add_sample(&w -> res, now_ns() - t0);
+		}
+		w -> res.msgs++;
+		w -> res.bytes += len;
+		if ((keys > 0) && (len > 8) && (payload[len - 1] == 'E')){
+			break;
+		}
+	}
+	//wait for the publisher before closing, it sends to all open clients
+	while (__atomic_load_n(&bcast_done, __ATOMIC_ACQUIRE) == 0){
+		usleep(1000);
+	}
+	client_shutdown(c);
+out:
+	free(rmsg);
+	client_free(c);
+	return NULL;
+}
+
+// ****************************************************************************
+//completion of a message sent with ws_send_to(), its buffer is free
+static void pub_send_done(void *ctx, uint8_t sent){
+	__atomic_add_fetch(&pub_reached, sent, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&pub_done, 1, __ATOMIC_RELAXED);
+	__atomic_store_n((int *)ctx, 0, __ATOMIC_RELEASE);
+}
+
+// ****************************************************************************
+//broadcast from the publisher's own buffers, nothing is allocated per
+//message
+static void publish_borrowed(void){
+	static uint8_t *bufs;
+	uint8_t *msg;
+	uint64_t t0;
+	int16_t n;
+	int k;
+
+	if (bufs == NULL){
+		bufs = malloc((size_t)PUB_BUFS * (msg_size + 1));
+	}
+	pub_reached = 0;
+	pub_done = 0;
+	for (int i = 0; i < count; i++){
+		k = i % PUB_BUFS;
+		while (__atomic_load_n(&pub_busy[k], __ATOMIC_ACQUIRE) != 0){
+			usleep(100);
+		}
+		msg = bufs + (size_t)k * (msg_size + 1);
+		fill_msg(msg, msg_size, 'b');
+		t0 = now_ns();
+		if (msg_size >= 8){
+			memcpy(msg, &t0, 8);
+		}
+		if (send_to == 2){
+			n = ws_send_to_sync(-1, msg, msg_size, WS_OP_BIN, 0, 10000);
+			pub_reached += (n > 0) ? n : 0;
+			pub_done++;
+			continue;
+		}
+		pub_busy[k] = 1;
+		if (ws_send_to(-1, msg, msg_size, WS_OP_BIN, 0, pub_send_done,
+				(void *)&pub_busy[k], 10000) != 1){
+			pub_busy[k] = 0;
+		}
+	}
+}
+
+// ****************************************************************************
+//broadcast of prepared frames, a frame is patched when no connection holds
+//it any more
+static void publish_prepared(void){
+	static ws_frame_t *frames[PUB_BUFS];
+	uint8_t *msg;
+	uint64_t t0;
+	int k;
+
+	msg = malloc(msg_size + 1);
+	fill_msg(msg, msg_size, 'b');
+	for (k = 0; k < PUB_BUFS; k++){
+		if (frames[k] == NULL){
+			frames[k] = ws_frame_prepare(WS_OP_BIN, msg, msg_size);
+		}
+	}
+	free(msg);
+	pub_done = 0;
+	for (int i = 0; i < count; i++){
+		k = i % PUB_BUFS;
+		t0 = now_ns();
+		while ((msg_size >= 8) &&
+				(ws_frame_patch(frames[k], 0, (uint8_t *)&t0, 8) == 0)){
+			usleep(100);
+			t0 = now_ns();
+		}
+		if (ws_send_frame(-1, frames[k], 10000) == 1){
+			pub_done++;
+		}
+	}
+}
+
+// ****************************************************************************
+//application side of the broadcast test
+static void publish(void){
+	ws_queue_item_t *q_item;
+	uint8_t *msg;
+	uint64_t t0;
+
+	//give the server time to switch the last client to WS_OPEN
+	usleep(100000);
+	if (send_to == 3){
+		publish_prepared();
+		return;
+	}
+	if (send_to > 0){
+		publish_borrowed();
+		return;
+	}
+	for (int i = 0; i < count; i++){
+		msg = ws_buf_alloc(msg_size);
+		q_item = ws_item_alloc();
+		fill_msg(msg, msg_size, 'b');
+		t0 = now_ns();
+		if (msg_size >= 8){
+			memcpy(msg, &t0, 8);
+		}
+		if ((keys > 0) && (msg_size > 8) && (i == count - 1)){
+			//last message is never replaced, clients stop at it
+			msg[msg_size - 1] = 'E';
+		}
+		q_item -> payload = msg;
+		q_item -> len = msg_size;
+		q_item -> index = -1;
+		q_item -> opcode = WS_OP_BIN;
+		q_item -> ws_frame = 1;
+		ws_send_key(q_item, (keys > 0) ? i % keys + 1 : 0, 10000);
+	}
+}
+
+// ****************************************************************************
+//application task, echo every message back to its sender
+static void app_echo_task(void *arg){
+	static ws_vec_t *parts[APP_SLOTS];
+	static uint16_t parts_nr[APP_SLOTS];
+	ws_queue_item_t *item;
+	int8_t i;
+
+	(void)arg;
+	for (;;){
+		ws_recv(&item, -1);
+		if ((rx_mode == WS_RX_STREAM) && ((item -> first == 0) || (item -> last == 0))){
+			//echo every part as a fragment
+			item -> opcode = (item -> first == 0) ? WS_OP_CON :
+					((item -> text == 1) ? WS_OP_TXT : WS_OP_BIN);
+			item -> ws_frame = 1;
+			if (ws_send_fragment(item, item -> last, 10000) != pdTRUE){
+				ws_item_free(item);
+			}
+			continue;
+		}
+		if ((item -> first == 0) || (item -> last == 0)){
+			//long message, keep the parts and send them back as blocks
+			i = item -> index;
+			parts[i] = realloc(parts[i], (parts_nr[i] + 1) * sizeof(ws_vec_t));
+			parts[i][parts_nr[i]].data = item -> payload;
+			parts[i][parts_nr[i]].len = item -> len;
+			parts_nr[i]++;
+			if (item -> last == 1){
+				if (ws_send_vec(i, (item -> text == 1) ? WS_OP_TXT : WS_OP_BIN,
+						parts[i], parts_nr[i], 10000) != 1){
+					for (int k = 0; k < parts_nr[i]; k++){
+						ws_buf_free(parts[i][k].data);
+					}
+					free(parts[i]);
+				}
+				parts[i] = NULL;
+				parts_nr[i] = 0;
+			}
+			item -> payload = NULL;
+			ws_item_free(item);
+			continue;
+		}
+		item -> opcode = (item -> text == 1) ? WS_OP_TXT : WS_OP_BIN;
+		item -> ws_frame = 1;
+		if (ws_send(item, 10000) != pdTRUE){
+			ws_item_free(item);
+		}
+	}
+}
+
+// ****************************************************************************
+//receive callback, whole messages are echoed with their buffer, parts go to
+//the application task
+static WS_RECV_ACTION app_echo_cb(ws_queue_item_t *msg){
+	ws_queue_item_t *item;
+
+	if ((msg -> first == 0) || (msg -> last == 0)){
+		return WS_RECV_QUEUE;
+	}
+	item = ws_item_alloc();
+	if (item == NULL){
+		return WS_RECV_DONE;
+	}
+	item -> payload = msg -> payload;
+	item -> len = msg -> len;
+	item -> index = msg -> index;
+	item -> opcode = (msg -> text == 1) ? WS_OP_TXT : WS_OP_BIN;
+	item -> ws_frame = 1;
+	if (ws_send(item, 10000) != pdTRUE){
+		item -> payload = NULL;
+		ws_item_free(item);
+		return WS_RECV_DONE;
+	}
+	return WS_RECV_KEEP;
+}
+
+// ****************************************************************************
+static int cmp_u32(const void *a, const void *b){
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+// ****************************************************************************
+static void run(const char *name, void *(*fn)(void *), int publisher){
+	worker_t *w = calloc(clients, sizeof(worker_t));
+	result_t total;
+	uint64_t t0, t1;
+	double sec;
+
+	memset(&total, 0, sizeof(total));
+	bcast_done = 0;
+	start_ready = 0;
+	pthread_barrier_init(&start_barrier, NULL, clients + 1);
+	for (int i = 0; i < clients; i++){
+		w[i].id = i;
+		pthread_create(&w[i].thread, NULL, fn, &w[i]);
+	}
+	pthread_barrier_wait(&start_barrier);
+	t0 = now_ns();
+	if (publisher){
+		publish();
+		//all messages are queued, clients may close after reception
+		__atomic_store_n(&bcast_done, 1, __ATOMIC_RELEASE);
+	}
+	for (int i = 0; i < clients; i++){
+		pthread_join(w[i].thread, NULL);
+	}
+	t1 = now_ns();
+	pthread_barrier_destroy(&start_barrier);
+
+	for (int i = 0; i < clients; i++){
+		result_t *r = &w[i].res;
+
+		total.msgs += r -> msgs;
+		total.bytes += r -> bytes;
+		total.errors += r -> errors;
+		total.busy += r -> busy;
+		for (size_t j = 0; j < r -> lat_nr; j++){
+			add_sample(&total, (uint64_t)r -> lat_us[j] * 1000);
+		}
+		free(r -> lat_us);
+	}
+	free(w);
+	if (total.lat_nr > 0){
+		qsort(total.lat_us, total.lat_nr, sizeof(uint32_t), cmp_u32);
+	}
+	sec = (t1 - t0) / 1e9;
+	fprintf(report, "%-10s %7d %9llu %11.0f %9.2f %9u %9u %6u %6u\n",
+			name, clients, (unsigned long long)total.msgs, total.msgs / sec,
+			total.bytes / sec / 1e6,
+			total.lat_nr ? total.lat_us[total.lat_nr * 50 / 100] : 0,
+			total.lat_nr ? total.lat_us[total.lat_nr * 99 / 100] : 0,
+			total.busy, total.errors);
+	if (publisher && (send_to == 3)){
+		fprintf(report, "prepared frames: %u messages sent\n",
+				__atomic_load_n(&pub_done, __ATOMIC_RELAXED));
+	}
+	else if (publisher && (send_to > 0)){
+		fprintf(report, "send_to: %u messages completed, %llu connections "\
+				"reached\n", __atomic_load_n(&pub_done, __ATOMIC_RELAXED),
+				(unsigned long long)__atomic_load_n(&pub_reached, __ATOMIC_RELAXED));
+	}
+	fflush(report);
+	free(total.lat_us);
+}
+
+// ****************************************************************************
+//pool usage after the runs
+static void print_pools(void){
+	static const char *names[] = {"items", "frames", "buf", "buf", "buf"};
+	ws_pool_stats_t st[2 + WS_POOL_CLASSES];
+	uint8_t n;
+
+	n = ws_get_pool_stats(st, 2 + WS_POOL_CLASSES);
+	fprintf(report, "\n%-10s %7s %7s %7s %10s %10s %10s\n", "pool", "size",
+			"blocks", "used", "high_water", "allocs", "misses");
+	for (int i = 0; i < n; i++){
+		fprintf(report, "%-10s %7u %7u %7u %10u %10u %10u\n", names[i],
+				st[i].size, st[i].nr, st[i].used, st[i].high_water,
+				st[i].allocs, st[i].misses);
+	}
+	fflush(report);
+}
+
+// ****************************************************************************
+//server counters after the runs
+static void print_stats(void){
+	ws_server_stats_t st;
+
+	ws_get_stats(&st, NULL, 0);
+	fprintf(report, "\nserver: accepts %u, busy %u, handshakes %u, errors %u, "\
+			"ping timeouts %u, idle timeouts %u, stall timeouts %u, open %u\n",
+			st.accepts, st.busy, st.handshakes, st.handshake_errors,
+			st.ping_timeouts, st.idle_timeouts, st.stall_timeouts, st.open);
+	fprintf(report, "in:  frames %u, messages %u, bytes %llu\n", st.frames_in,
+			st.msgs_in, (unsigned long long)st.bytes_in);
+	fprintf(report, "out: frames %u, bytes %llu, writes %u, drops %u, "\
+			"conflated %u, write errors %u\n", st.frames_out,
+			(unsigned long long)st.bytes_out, st.writes, st.drops, st.conflated,
+			st.write_errors);
+	fprintf(report, "queue high water: out %u, in %u\n",
+			st.out_queue_high_water, st.in_queue_high_water);
+	fprintf(report, "close codes (sent/received):");
+	for (int i = 0; i < WS_STATS_CLOSE_NR; i++){
+		if (st.close_sent[i] + st.close_recv[i] > 0){
+			fprintf(report, " %s%i %u/%u", (i == WS_STATS_CLOSE_OTHER) ? ">" : "",
+					(i == WS_STATS_CLOSE_OTHER) ? 1011 : 1000 + i, st.close_sent[i],
+					st.close_recv[i]);
+		}
+	}
+	fprintf(report, "\nheap free %u, min %u\n", st.heap_free, st.heap_min_free);
+#if WS_LATENCY
+	static const char *stages[WS_LAT_STAGES] = {"out_queue", "tx", "write",
+			"rx", "in_queue"};
+	ws_lat_hist_t h;
+
+	fprintf(report, "\n%-10s %9s %9s %9s %9s %9s\n", "stage", "count", "p50_us",
+			"p90_us", "p99_us", "max_us");
+	for (int i = 0; i < WS_LAT_STAGES; i++){
+		ws_lat_get(i, &h);
+		fprintf(report, "%-10s %9u %9u %9u %9u %9u\n", stages[i], h.count,
+				ws_lat_percentile(&h, 50), ws_lat_percentile(&h, 90),
+				ws_lat_percentile(&h, 99), h.max);
+	}
+#endif
+	fflush(report);
+}
+
+// ****************************************************************************
+static void usage(const char *prog){
+	fprintf(stderr, "usage: %s [-p port] [-c clients] [-n messages] "\
+			"[-k handshakes] [-s size] [-w window] [-f fragment] [-R] [-x stalled] "\
+			"[-P oldest|newest|disconnect] [-E tasks|select] [-M max_clients] [-A] [-D] "\
+			"[-H ping_ms] [-C coalesce_len] [-U coalesce_us] [-K keys] [-B] [-N shards] [-T async|sync|frame] [-S] [-m handshake|echo|broadcast|all] [-v]\n",
+			prog);
+	exit(1);
+}
+
+// ****************************************************************************
+int main(int argc, char **argv){
+	ws_server_cfg_t cfg;
+	const char *mode = "all";
+	int opt, verbose = 0, stats = 0;
+
+	while ((opt = getopt(argc, argv, "p:c:n:k:s:w:f:Rx:P:E:M:ADH:C:U:K:BN:T:Sm:v")) != -1){
+		switch (opt){
+		case 'p': port = atoi(optarg); break;
+		case 'c': clients = atoi(optarg); break;
+		case 'n': count = atoi(optarg); break;
+		case 'k': handshakes = atoi(optarg); break;
+		case 's': msg_size = atoi(optarg); break;
+		case 'w': window = atoi(optarg); break;
+		case 'f': frag_len = atoi(optarg); break;
+		case 'R': rx_mode = WS_RX_STREAM; break;
+		case 'x': stalled = atoi(optarg); break;
+		case 'M': max_clients = atoi(optarg); break;
+		case 'A': pools = 1; break;
+		case 'D': deflate_on = 1; break;
+		case 'H': ping_period = atoi(optarg); break;
+		case 'C': coalesce_len = atoi(optarg); break;
+		case 'U': coalesce_us = atoi(optarg); break;
+		case 'K': keys = atoi(optarg); break;
+		case 'B': recv_cb = 1; break;
+		case 'N': shard_nr = atoi(optarg); break;
+		case 'T':
+			send_to = !strcmp(optarg, "sync") ? 2 : !strcmp(optarg, "frame") ? 3 : 1;
+			break;
+		case 'S': stats = 1; break;
+		case 'E':
+			engine = !strcmp(optarg, "select") ? WS_ENGINE_SELECT : WS_ENGINE_TASKS;
+			break;
+		case 'P':
+			if (!strcmp(optarg, "newest")){
+				tx_policy = WS_TX_DROP_NEWEST;
+			}
+			else if (!strcmp(optarg, "disconnect")){
+				tx_policy = WS_TX_DISCONNECT;
+			}
+			else{
+				tx_policy = WS_TX_DROP_OLDEST;
+			}
+			break;
+		case 'm': mode = optarg; break;
+		case 'v': verbose = 1; break;
+		default: usage(argv[0]);
+		}
+	}
+	if ((clients < 1) || (count < 1) || (msg_size < 0) || (window < 1) ||
+			(msg_size > RBUF_LEN - 14) || (frag_len < 0)){
+		usage(argv[0]);
+	}
+
+	report = fdopen(dup(STDOUT_FILENO), "w");
+	if (!verbose){
+		if (freopen("/dev/null", "w", stdout) == NULL){
+			perror("freopen");
+		}
+	}
+	srand(time(NULL));
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.port = port;
+	cfg.max_stream_len = RBUF_LEN;
+	cfg.rx_mode = rx_mode;
+	cfg.tx_policy = tx_policy;
+	cfg.engine = engine;
+	cfg.max_clients = max_clients;
+	cfg.ping_period_ms = ping_period;
+	cfg.tx_coalesce_len = coalesce_len;
+	cfg.tx_coalesce_us = coalesce_us;
+	cfg.recv_cb = (recv_cb == 1) ? app_echo_cb : NULL;
+	cfg.shards = shard_nr;
+	if (pools){
+		cfg.item_pool_nr = 256;
+		cfg.buf_pool[0] = (ws_pool_cfg_t){128, 256};
+		cfg.buf_pool[1] = (ws_pool_cfg_t){1025, 128};
+		cfg.buf_pool[2] = (ws_pool_cfg_t){16385, 16};
+	}
+	if (deflate_on){
+		cfg.deflate = 1;
+		cfg.deflate_client_bits = 15;
+		//compressed messages are not passed on in parts
+		cfg.max_msg_len = (msg_size > 1024) ? msg_size : 0;
+	}
+	ws_server_init(&cfg);
+	xTaskCreate(app_echo_task, "app_echo", 4096, NULL, 1, NULL);
+	//server task waits 1 s after listen before the first accept
+	vTaskDelay(1100 / portTICK_PERIOD_MS);
+
+	fprintf(report, "%-10s %7s %9s %11s %9s %9s %9s %6s %6s\n", "scenario",
+			"clients", "messages", "msg/s", "MB/s", "p50_us", "p99_us",
+			"busy", "errors");
+	if (!strcmp(mode, "handshake") || !strcmp(mode, "all")){
+		run("handshake", handshake_worker, 0);
+	}
+	if (!strcmp(mode, "echo") || !strcmp(mode, "all")){
+		run("echo", echo_worker, 0);
+	}
+	if (!strcmp(mode, "broadcast") || !strcmp(mode, "all")){
+		run("broadcast", broadcast_worker, 1);
+	}
+	if (pools){
+		print_pools();
+	}
+	if (stats){
+		print_stats();
+	}
+	return 0;
+}
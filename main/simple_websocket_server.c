@@ -25,12 +25,14 @@
 #include "driver/spi_master.h"
 #include "esp_adc_cal.h"
 #include "esp_attr.h"
+#include "esp_timer.h"
 
 #include "lwip/err.h"
 #include "lwip/sys.h"
 
 #include "simple_websocket_server.h"
 #include "websocket_server.h"
+#include "ws_sensor.h"
 
 //wifi configuration data
 #define ESP_WIFI_SSID      "wifi_name"
@@ -38,6 +40,10 @@
 #define ESP_MAXIMUM_RETRY  5
 //mDNS
 #define MDNS_INSTANCE "esp32-device"
+//binary sensor records (ws_sensor.h), ids as in www_test/sensors.js
+#define SENSOR_COUNTER		0
+#define SENSOR_HEAP			1
+#define SENSOR_BATCH		8	//records in one frame
 
 //global variables
 static uint8_t ws_server_started = 0;
@@ -67,10 +73,15 @@ xQueueHandle recv_queue;
 void app_main(){
 	uint32_t i = 0;
 	static httpd_handle_t http_server = NULL;
-	char ws_msg[] = "{\"type\":\"message\",\"data\":{\"sensor\":\"counter\""\
-					",\"value\":%i}}";
-	char *msg;
-	ws_queue_item_t *q_item;
+	//value is patched in place (10 digits, padded with spaces)
+	static const char ws_msg[] = "{\"type\":\"message\",\"data\":"\
+					"{\"sensor\":\"counter\",\"value\":         0}}";
+	const uint32_t value_off = sizeof(ws_msg) - 1 - 12;
+	ws_frame_t *counter_frame = NULL;
+	int8_t counter_topic, sensor_topic;
+	static uint8_t sensor_buf[WS_SENSOR_LEN(SENSOR_BATCH)];
+	ws_sensor_batch_t sensors;
+	uint32_t tick = 0, t_ms;
 
 	//chip information
 	chipInfo();
@@ -92,26 +103,37 @@ void app_main(){
 
 	//start here additional non-network tasks
 
+	//only clients subscribed to "counter" get its values, "sensors" gets
+	//binary batches: free heap every second and the counter
+	counter_topic = ws_topic("counter");
+	sensor_topic = ws_topic("sensors");
+	ws_sensor_init(&sensors, sensor_buf, SENSOR_BATCH);
 	vTaskDelay(5000 / portTICK_PERIOD_MS);
 	for (;;) {
+		vTaskDelay(1000 / portTICK_PERIOD_MS);
+		t_ms = esp_timer_get_time() / 1000;
+		ws_sensor_add(&sensors, SENSOR_HEAP, esp_get_free_heap_size(), 0, t_ms);
+		if (++tick % 5 != 0){
+			continue;
+		}
 		i++;
-		vTaskDelay(5000 / portTICK_PERIOD_MS);
-
-		//prepare json message and send it
+		ws_sensor_add(&sensors, SENSOR_COUNTER, i, 0, t_ms);
 		if (ws_server_started == 1){
-			msg = malloc(strlen(ws_msg) + 11);
-			if (msg != NULL){
-				sprintf(msg, ws_msg, i);
-				q_item = malloc(sizeof(ws_queue_item_t));
-				if (q_item != NULL){
-					q_item -> payload = (uint8_t *)msg;
-					q_item -> len = strlen(msg);
-					q_item -> index = -1;
-					q_item -> opcode = WS_OP_TXT;
-					q_item -> ws_frame = 1;
-					ws_send(q_item, 0); //send message to client
-				}
-			}
+			//one WS_OP_BIN frame for all readings since the last one
+			ws_publish(sensor_topic, WS_OP_BIN, sensor_buf,
+					ws_sensor_len(&sensors), 0);
+		}
+		ws_sensor_reset(&sensors);
+
+		//json message is encoded once, only the value changes; it is skipped
+		//while the previous one is still queued for a slow client
+		if ((ws_server_started == 1) && (counter_frame == NULL)){
+			counter_frame = ws_frame_prepare(WS_OP_TXT, (const uint8_t *)ws_msg,
+					sizeof(ws_msg) - 1);
+		}
+		if ((counter_frame != NULL) &&
+				(ws_frame_patch_dec(counter_frame, value_off, 10, i) == 1)){
+			ws_publish_frame(counter_topic, counter_frame, 0);
 		}
 	}
 
@@ -128,15 +150,14 @@ static void ws_recv_task(void* arg){
 
 	for(;;){
 		//wait for data from websocket
-		xQueueReceive(recv_queue, &ws_queue_item, portMAX_DELAY);
+		ws_recv(&ws_queue_item, -1);
 		msg = (char *)ws_queue_item -> payload;
 
 		//process received message here
 		printf("%s\n", msg);
 
-		//free buffers
-		free(ws_queue_item -> payload);
-		free(ws_queue_item);
+		//free buffers (payload and item)
+		ws_item_free(ws_queue_item);
 	}
 }
 
@@ -162,7 +183,9 @@ static esp_err_t event_handler(void *ctx, system_event_t *event){
     		s_retry_num = 0;
     		xEventGroupSetBits(wifi_event_group, IP4_CONNECTED_BIT);
     		//initialize websocket server
-    		ws_server_cfg_t ws_cfg = {.port = 8080};
+    		//items and short payloads come from pools, not from the heap
+    		ws_server_cfg_t ws_cfg = {.port = 8080, .item_pool_nr = 16,
+    				.buf_pool = {{64, 16}, {256, 8}, {1025, 4}}};
     		ws_server_init(&ws_cfg);
     		recv_queue = ws_get_recv_queue();
     		printf("websocket server started\n");
@@ -8,6 +8,7 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/param.h>
 #include <string.h>
 
@@ -16,281 +17,427 @@
 #include "freertos/semphr.h"
 #include "freertos/queue.h"
 #include "freertos/timers.h"
-#include "hwcrypto/sha.h"
-#include "wpa2/utils/base64.h"
 
 #include "lwip/api.h"
+#include "lwip/sockets.h"
+#include "lwip/tcp.h"
 
 #include "websocket_server.h"
+#include "ws_frame.h"
+#include "ws_codec.h"
+#include "ws_deflate.h"
+#include "ws_handshake.h"
+#include "ws_wheel.h"
+#include "esp_system.h"
+#include "esp_timer.h"
 
 #define MAX_PAYLOAD_LEN		1024
-#define MAX_OPEN_WS_NR		5	//max number of opened websockets
-#define SHA1_RES_LEN		20	//sha1 result length
+#define MAX_OPEN_WS_NR		5	//default max number of opened websockets
+#define WS_SELECT_MAX_NR	32	//default max number of websockets, select engine
+#define WS_MAX_CLIENTS		127	//index must fit in int8_t
+#define WS_QUEUE_LEN		10	//default length of input and output queue
+#define WS_SERVER_STACK		4096
+#define WS_SERVER_PRIO		3
+#define WS_RECV_STACK		2048
+#define WS_RECV_PRIO		3
+#define WS_SEND_STACK		2048
+#define WS_SEND_PRIO		1
+#define WS_SELECT_RECV_LEN	1460
+#define WS_SELECT_TIMEOUT_MS	100
+#define WS_ACCEPT_TIMEOUT_MS	100	//netconn accept checks for ws_server_stop
+#define WS_STOP_WAIT_MS		5000 //tasks and connections going down at stop
 #define CLOSE_TIMEOUT_MS	2000 //ms
+#define WS_HS_TIMEOUT_MS	10000 //default time for the upgrade request
+#define WS_TX_QUEUE_LEN		16	//default frames queued per connection
+#define WS_TX_CTRL_RESERVE	4	//extra queue places for control frames
+#define WS_TX_BATCH			16	//items taken from output queue at once
+#define WS_TX_RETRY_MS		10	//retry period of blocked connections
+#define WS_CB_FRAMES		32	//frames combined in one write at most
+#define WS_DEFLATE_MIN_LEN	32	//default shortest compressed message
+#define WS_RX_KEEP_LEN		1024	//largest buffer kept for the next message
+#define WS_EXT_LEN			160	//Sec-WebSocket-Extensions answer
+#define WS_RSV1				0x04	//RSV1 in parser's rsv field
+#define WS_PING_MAX_MISSED	3	//default unanswered heartbeat pings
+#define WS_PING_LEN			4	//heartbeat ping payload: time in us
+
+//deadlines of a connection (ws_wheel timers), heartbeat is a server timer
+enum {WS_DL_HANDSHAKE = 0, WS_DL_CLOSE, WS_DL_IDLE, WS_DL_STALL, WS_DL_NR,
+	WS_DL_PING = WS_DL_NR};
 
 struct ws_list_item{
 	struct netconn *netconn_ptr;
+	int sock;				//socket (select engine), -1 if not used
 	xTaskHandle ws_task_handl;
-	TimerHandle_t ws_timer;
-	uint32_t pings;
-	uint32_t pongs;
+	ws_tm_t dl[WS_DL_NR];	//deadlines
+	ws_conn_stats_t st;		//counters, see ws_get_stats
 	uint8_t index;
-	WS_RUNING run:1;
-	WS_STATE ws_state:2;
+	WS_RUNING run;			//written by more tasks, WS_SET/WS_GET
+	WS_STATE ws_state;
+	ws_hs_t hs;				//upgrade request parser state
+	ws_parser_t parser;		//frame parser state
+	uint8_t *rx_msg;		//message (or its part) being received
+	uint8_t *rx_ctl;		//payload of control frame being received
+	uint32_t rx_pos;		//bytes in rx_msg
+	uint32_t rx_cap;		//size of rx_msg
+	uint64_t rx_total;		//message length so far
+	uint64_t rx_len;		//message length, 0 if fragmented
+	uint8_t rx_opcode;		//opcode of the first fragment
+	uint8_t tx_frag;		//fragmented message being sent (send task, not
+							//in the bit fields of the receiving side)
+	uint8_t rx_utf8;		//UTF-8 check state of the text message
+	uint8_t rx_in_msg:1;	//data message not finished yet
+	uint8_t rx_first:1;		//next part is the first one
+	uint8_t pmd:1;			//permessage-deflate negotiated
+	uint8_t rx_comp:1;		//message being received is compressed
+	uint8_t pmd_bits;		//window bits of compressed frames to the client
+	uint8_t rx_dict_bits;	//window kept between received messages, 0 - none
+	uint8_t *rx_dict;		//last bytes of received messages
+	uint16_t rx_dict_len;
+	ws_inflate_t *rx_inf;	//decompressor state, kept for the connection
+	ws_frame_t **txq;		//outbound frames (ring)
+	uint16_t tx_head;		//first frame in txq
+	uint16_t tx_nr;			//number of frames in txq
+	uint64_t tx_off;		//bytes of the first frame already written
+	uint64_t tx_bytes;		//bytes queued
+	ws_frame_t cb;			//combined small frames: payload is the buffer
+							//(tx_coalesce_len), len bytes in it
+	uint64_t cb_off;		//bytes of cb already written
+	uint32_t cb_t_us;		//first frame copied to cb
+	uint8_t cb_flush;		//cb is written without waiting
+	uint8_t cb_nr;			//frames copied to cb
+	ws_frame_t *cb_frames[WS_CB_FRAMES]; //they are kept until cb is written
+	uint32_t hb_t_us;		//time of the unanswered heartbeat ping, 0 - none
+							//(shard mutex)
+	uint8_t hb_missed;		//heartbeat pings not answered in a row (shard
+							//mutex)
+	uint32_t topics;		//subscribed topics, WS_TOPIC_BIT (shard mutex)
+#if WS_LATENCY
+	uint32_t rx_t_us;		//start of the message part being received
+#endif
 };
 
+//connections are split among shards: connection i belongs to shard
+//i % ws_shard_nr, its send task (and select task) serve only them
+typedef struct ws_shard{
+	uint8_t n;
+	xQueueHandle queue;		//output queue of the shard
+	xSemaphoreHandle mutex;	//send state of the shard's connections
+	ws_deflate_t *deflater;	//used by the send task only
+	xTaskHandle select_task;
+} ws_shard_t;
+
 //global server variables
 static int8_t server_is_running = 0;
+static ws_server_cfg_t ws_cfg;
 static xTaskHandle server_task_handle;
-struct ws_list_item ws_list[MAX_OPEN_WS_NR];
+struct ws_list_item *ws_list;	//max_clients places
+static int8_t ws_max_nr;		//number of places in ws_list
 static struct netconn *server_conn;
-xQueueHandle ws_output_queue;
 xQueueHandle ws_input_queue;
 static xSemaphoreHandle xServerMutex;
-static xSemaphoreHandle xSendMutex;
+//ws_server_stop: 1 - no new connections, 2 - server tasks exit, every one
+//gives ws_stop_sem
+static uint8_t ws_stopping;
+static xSemaphoreHandle ws_stop_sem;
+static ws_shard_t shards[WS_SHARD_MAX];
+static uint8_t ws_shard_nr;
+static ws_server_stats_t ws_stats;	//server counters, closed connections
+static TimerHandle_t wheel_timer;	//ticks the wheel
+static ws_wheel_t wheel;			//all deadlines and the heartbeat
+static ws_tm_t hb_tm;
+static uint8_t topic_subs[WS_TOPIC_MAX];	//subscribers of topics (atomic)
+static TickType_t ws_start_tick;
 
 //tasks functions
 static void server_task(void* arg);
 static void ws_receive_task(void* arg);
 static void ws_send_task(void* arg);
-static uint8_t head_buff[MAX_PAYLOAD_LEN + 4]; //sending buffer
+static void ws_select_task(void* arg);
+static void ws_receive_frames(int8_t index, const uint8_t *data, size_t len);
+static void ws_rx_reset(struct ws_list_item *ws);
+static void ws_tx_clear(int8_t i);
+static void ws_disconnect(int8_t i, const char *why);
+static void ws_dispatch(int8_t index, uint8_t opcode, uint8_t *msg,
+		uint32_t len);
 
 //functions prototypes
-void add_ws_header(ws_queue_item_t *q, ws_send_data *ws_data);
 uint8_t close_ws(uint16_t error_nr, int8_t i);
-int8_t ws_handshake(uint8_t *rq, uint8_t index, ws_queue_item_t *ws_item);
-void vCloseTimeoutCallback(TimerHandle_t xTimer);
+int8_t ws_handshake(uint8_t index, ws_queue_item_t *ws_item);
+static void ws_deadline(int8_t index, uint8_t kind, uint32_t id);
 
 // This is the data from the busy server
 static char error_busy_page[] =
 		"HTTP/1.1 503 Service Unavailable\r\n\r\n";
+//answer to a request which is not a websocket upgrade
+static char error_request_page[] =
+		"HTTP/1.1 400 Bad Request\r\nSec-WebSocket-Version: 13\r\n\r\n";
 //handshake strings
-const char ws_sec_key[] = "Sec-WebSocket-Key";
-const char ws_upgrade[] = "Upgrade: websocket";
-const char ws_conn_1[] = "Connection: Upgrade";
-const char ws_conn_2[] = "Connection: keep-alive, Upgrade";
-const char ws_ver[] = "Sec-WebSocket-Version: 13";
-const char ws_sec_conKey[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+const char ws_ext[] = "Sec-WebSocket-Extensions:";
+const char ws_pmd[] = "permessage-deflate";
 const char ws_server_hs[] = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: "\
-		"websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n";
+		"websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n%s\r\n";
+
+//counters written by more tasks are updated atomically, without locks
+#define WS_STAT_ADD(x, v)	__atomic_add_fetch(&(x), (v), __ATOMIC_RELAXED)
+#define WS_STAT_INC(x)		WS_STAT_ADD(x, 1)
+#define WS_STAT_GET(x)		__atomic_load_n(&(x), __ATOMIC_RELAXED)
+
+//run, sock and netconn_ptr are read by tasks without the shard mutex: a
+//slot is published by storing sock or netconn_ptr last (release) and
+//released by clearing them after the rest of the slot (acquire loads)
+#define WS_SET(x, v)		__atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+#define WS_GET(x)			__atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+
+//shard of connection i, items without connection go to the first one
+//(a function: the index is int8_t or uint8_t at the callers)
+#define WS_SHARD(i)			ws_shard(i)
+
+// ****************************************************************************
+static inline ws_shard_t *ws_shard(int i){
+	return &shards[(i < 0) ? 0 : i % ws_shard_nr];
+}
+
+// ****************************************************************************
+//count close code sent or received by a connection
+static void ws_stat_close(int8_t index, uint32_t *codes, uint16_t code){
+	uint16_t i = code - 1000;
+
+	WS_STAT_INC(codes[(i < WS_STATS_CLOSE_OTHER) ? i : WS_STATS_CLOSE_OTHER]);
+	ws_list[index].st.close_code = code;
+}
+
+// ****************************************************************************
+//raise high-water mark written by more tasks
+static void ws_stat_max(uint16_t *hw, uint16_t v){
+	uint16_t old = __atomic_load_n(hw, __ATOMIC_RELAXED);
+
+	while ((v > old) && !__atomic_compare_exchange_n(hw, &old, v, 1,
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+// ****************************************************************************
+//received data of one connection: http request or websocket frames, both
+//can be split over segments
+static void ws_receive_data(int8_t index, uint8_t *rq, size_t len){
+	ws_queue_item_t *ws_item;
+	size_t used;
+	int8_t res;
+
+	//64 bit, read by ws_get_stats in other tasks
+	WS_STAT_ADD(ws_list[index].st.bytes_in, len);
+	if (ws_list[index].ws_state != WS_CLOSED){
+		if (ws_cfg.idle_timeout_ms > 0){
+			ws_wheel_arm(&wheel, &ws_list[index].dl[WS_DL_IDLE],
+					ws_cfg.idle_timeout_ms);
+		}
+		//websocket frames, they can be split over or share segments
+		ws_receive_frames(index, rq, len);
+		return;
+	}
+	//client must not send frames before the answer, bytes after the request
+	//are ignored
+	res = ws_hs_parse(&ws_list[index].hs, rq, len, &used);
+	if (res == WS_HS_MORE){
+		return;
+	}
+	if (res == WS_HS_DONE){
+		ws_item = ws_item_alloc();
+		if ((ws_item != NULL) && (ws_handshake(index, ws_item) == 1)){
+			WS_STAT_INC(ws_stats.handshakes);
+			ws_wheel_cancel(&wheel, &ws_list[index].dl[WS_DL_HANDSHAKE]);
+			if (ws_cfg.idle_timeout_ms > 0){
+				ws_wheel_arm(&wheel, &ws_list[index].dl[WS_DL_IDLE],
+						ws_cfg.idle_timeout_ms);
+			}
+			xQueueSendToFront(WS_SHARD(index) -> queue, &ws_item, portMAX_DELAY);
+			return;
+		}
+		ws_item_free(ws_item);
+		printf("handshake, no heap memory\n");
+	}
+	else{
+		printf("ERROR: bad http request at handshake, flags = %X\n",
+				ws_list[index].hs.flags);
+		//nothing is queued before the answer, the send task does not write
+		//to the connection yet
+		if (WS_GET(ws_list[index].sock) >= 0){
+			lwip_send(ws_list[index].sock, error_request_page,
+					sizeof(error_request_page) - 1, 0);
+		}
+		else{
+			netconn_write(ws_list[index].netconn_ptr, error_request_page,
+					sizeof(error_request_page) - 1, NETCONN_COPY);
+		}
+	}
+	//wrong, open request, close connection
+	WS_STAT_INC(ws_stats.handshake_errors);
+	WS_SET(ws_list[index].run, WS_STOP);
+}
+
+// ****************************************************************************
+//close TCP connection (netconn or socket), it is released later
+static err_t ws_conn_close(int8_t index){
+	int sock = WS_GET(ws_list[index].sock);
+
+	if (sock >= 0){
+		return (lwip_shutdown(sock, SHUT_RDWR) == 0) ? ERR_OK : ERR_CLSD;
+	}
+	return netconn_close(WS_GET(ws_list[index].netconn_ptr));
+}
+
+// ****************************************************************************
+//add counters of a closing connection to the server totals, caller holds
+//the shard mutex (shards fold at the same time)
+static void ws_stats_fold(int8_t index){
+	ws_conn_stats_t *c = &ws_list[index].st;
+
+	WS_STAT_ADD(ws_stats.frames_in, c -> frames_in);
+	WS_STAT_ADD(ws_stats.msgs_in, c -> msgs_in);
+	WS_STAT_ADD(ws_stats.bytes_in, c -> bytes_in);
+	WS_STAT_ADD(ws_stats.frames_out, c -> frames_out);
+	WS_STAT_ADD(ws_stats.bytes_out, c -> bytes_out);
+	WS_STAT_ADD(ws_stats.writes, c -> writes);
+	WS_STAT_ADD(ws_stats.drops, c -> drops);
+	WS_STAT_ADD(ws_stats.conflated, c -> conflated);
+	WS_STAT_ADD(ws_stats.write_errors, c -> write_errors);
+}
+
+// ****************************************************************************
+//release closed connection and its place in ws_list
+static void ws_conn_release(int8_t index){
+	struct netconn *conn = ws_list[index].netconn_ptr;
+	int sock = ws_list[index].sock;
+
+	//no deadline of this connection may fire for the next one
+	for (int k = 0; k < WS_DL_NR; k++){
+		ws_wheel_cancel(&wheel, &ws_list[index].dl[k]);
+	}
+	//message interrupted by closing
+	ws_buf_free(ws_list[index].rx_msg);
+	ws_buf_free(ws_list[index].rx_ctl);
+	ws_rx_reset(&ws_list[index]);
+	ws_buf_free(ws_list[index].rx_dict);
+	ws_list[index].rx_dict = NULL;
+	free(ws_list[index].rx_inf);
+	ws_list[index].rx_inf = NULL;
+
+	//release connection, send task must not be writing to it
+	xSemaphoreTake(WS_SHARD(index) -> mutex, portMAX_DELAY);
+	if (ws_list[index].st.drops > 0){
+		printf("frames dropped, index = %i, nr = %u\n", index,
+				ws_list[index].st.drops);
+	}
+	ws_stats_fold(index);
+	ws_tx_clear(index);
+	for (int t = 1; t <= WS_TOPIC_MAX; t++){
+		if (ws_list[index].topics & WS_TOPIC_BIT(t)){
+			__atomic_sub_fetch(&topic_subs[t - 1], 1, __ATOMIC_RELAXED);
+		}
+	}
+	ws_list[index].topics = 0;
+	ws_list[index].ws_state = WS_CLOSED;
+	WS_SET(ws_list[index].run, WS_STOP);
+	//place is free for ws_slot_find from here
+	WS_SET(ws_list[index].netconn_ptr, NULL);
+	WS_SET(ws_list[index].sock, -1);
+	xSemaphoreGive(WS_SHARD(index) -> mutex);
+	if (sock >= 0){
+		lwip_close(sock);
+	}
+	else{
+		netconn_delete(conn);
+	}
+}
+
+// ****************************************************************************
+//place in ws_list is taken by a connection
+static int8_t ws_slot_used(int8_t index){
+	return (WS_GET(ws_list[index].netconn_ptr) != NULL) ||
+			(WS_GET(ws_list[index].sock) >= 0);
+}
+
+// ****************************************************************************
+//free place for a new connection in the shard with the fewest connections,
+//-1 if there is none
+static int8_t ws_slot_find(void){
+	uint8_t used[WS_SHARD_MAX] = {0};
+	int8_t index = -1;
+
+	for (int i = 0; i < ws_max_nr; i++){
+		used[i % ws_shard_nr] += ws_slot_used(i) ? 1 : 0;
+	}
+	for (int i = 0; i < ws_max_nr; i++){
+		if ((ws_slot_used(i) == 0) && ((index < 0) ||
+				(used[i % ws_shard_nr] < used[index % ws_shard_nr]))){
+			index = i;
+		}
+	}
+	return index;
+}
+
+// ****************************************************************************
+//prepare place in ws_list for a new connection
+static void ws_slot_init(int8_t index){
+	ws_list[index].ws_state = WS_CLOSED;
+	ws_list[index].index = index;
+	memset(&ws_list[index].st, 0, sizeof(ws_conn_stats_t));
+	ws_list[index].st.id = WS_STAT_GET(ws_stats.accepts);
+	ws_list[index].tx_frag = 0;
+	ws_list[index].pmd = 0;
+	ws_list[index].rx_comp = 0;
+	ws_list[index].rx_dict_bits = 0;
+	ws_list[index].rx_dict_len = 0;
+	ws_list[index].hb_t_us = 0;
+	ws_list[index].hb_missed = 0;
+	ws_hs_init(&ws_list[index].hs);
+	ws_parser_init(&ws_list[index].parser);
+	ws_rx_reset(&ws_list[index]);
+	//deadlines of the previous connection still running are ignored
+	for (int k = 0; k < WS_DL_NR; k++){
+		ws_list[index].dl[k].id = ws_list[index].st.id;
+	}
+	ws_wheel_arm(&wheel, &ws_list[index].dl[WS_DL_HANDSHAKE],
+			ws_cfg.handshake_timeout_ms);
+	WS_SET(ws_list[index].run, WS_RUN);
+}
 
 // ****************************************************************************
 //websocket task function
 static void ws_receive_task(void* arg){
 	struct netconn *ws_conn;
-	int msg_ok = 0, msg_start = 0;
-	uint16_t ws_len = 0, tcp_len = 0;
+	uint16_t tcp_len = 0;
 	struct netbuf *inbuf;
-	uint8_t *rq, *msg;
-	ws_frame_header_t *ws_header;
-	uint8_t masking_key[4];
-	uint8_t offset = 2, mask = 0, finish;
-	WS_OPCODES opcode;
+	uint8_t *rq;
 	int8_t ws_tab_index;
 	err_t err, rcv_err;
-	ws_queue_item_t *ws_item;
 
 	ws_tab_index = *(int8_t *)arg;
 	printf("receive task starting, index: %i\n", ws_tab_index);
-	ws_conn = ws_list[ws_tab_index].netconn_ptr; //open websocket connection
-	msg = NULL;
-	opcode = 0;
+	ws_conn = WS_GET(ws_list[ws_tab_index].netconn_ptr); //open websocket connection
 	rcv_err = ERR_OK;
 	xSemaphoreGive(xServerMutex);
 
 	while(1){
-		if (ws_list[ws_tab_index].run == WS_STOP){
+		if (WS_GET(ws_list[ws_tab_index].run) == WS_STOP){
 			break;
 		}
 		rcv_err = netconn_recv(ws_conn, &inbuf);
 		if (rcv_err == ERR_OK){
-			msg_ok = 0;
-
-			//read data from input buffer
-			netbuf_data(inbuf, (void**) &rq, &tcp_len);
-
-			if (ws_list[ws_tab_index].ws_state != WS_CLOSED){
-				//receive websocket data from client
-				offset = 0;
-				if (msg_start == 0){
-					//start of the message
-					ws_header = (ws_frame_header_t *)rq;
-					ws_len = ws_header -> payload_len;
-					opcode = ws_header -> opcode;
-					finish = ws_header -> fin;
-					if (finish == 0){
-						//fragmentation not supported
-						close_ws(1007, ws_tab_index);
-						break;
-					}
-					offset = 2;
-					if (ws_len == 126){
-						//message length are bytes 2 and 3
-						ws_len = (rq[offset] << 8) + rq[offset + 1];
-						offset = 4;
-						if (ws_len > MAX_PAYLOAD_LEN){
-							close_ws(1009, ws_tab_index);
-							msg_ok = -1;
-						}
-					}
-					else if (ws_len == 127){
-						//64bit addresses are not supported
-						close_ws(1009, ws_tab_index);
-						msg_ok = -1;
-					}
-					//printf("received msg len = %i\n", ws_len);
-					mask = ws_header -> mask;
-					if (mask == 0x1){
-						masking_key[0] = rq[offset];
-						masking_key[1] = rq[offset + 1];
-						masking_key[2] = rq[offset + 2];
-						masking_key[3] = rq[offset + 3];
-						offset += 4;
-					}
-					//allocate memory for message
-					msg = malloc(ws_len + 1);
-				}
-				//copy data to buffer
-				memcpy(msg + msg_start, rq + offset, tcp_len - offset);
-				msg_start += tcp_len - offset;
-				if (msg_start == ws_len){
-					//all data received, unmask data
-					printf("msg len ok, %i\n", ws_len);
-					if (mask == 1){
-						//unmask data
-						for (int i = 0; i < ws_len; i++){
-							msg[i] = msg[i] ^ masking_key[i%4];
-						}
-					}
-					msg_ok = 1;
-					msg[ws_len] = 0;
-					msg_start = 0;
-				}
-				else if (msg_start > ws_len){
-					//message length error, close connection
-					printf("msg length error, %i, %i\n", msg_start, ws_len);
-					close_ws(1011, ws_tab_index);
-					free(msg);
-					msg = NULL; //is it necessary?
-					msg_ok = -1;
-				}
-			}
+			do {
+				netbuf_data(inbuf, (void**) &rq, &tcp_len);
+				ws_receive_data(ws_tab_index, rq, tcp_len);
+			} while ((WS_GET(ws_list[ws_tab_index].run) == WS_RUN) &&
+					(netbuf_next(inbuf) >= 0));
 			netbuf_delete(inbuf);
-
-			//collect message, check it
-			switch (ws_list[ws_tab_index].ws_state){
-			case WS_OPEN:
-				if (msg_ok == 1){
-					switch(opcode){
-					case WS_OP_TXT:
-					case WS_OP_BIN:
-						//application data received
-						//printf("app data received: %s\n", msg);
-						ws_item = malloc(sizeof(ws_queue_item_t));
-						ws_item -> payload = msg;
-						ws_item -> len = ws_len;
-						ws_item -> index = ws_tab_index;
-						ws_item -> opcode = 0x0;
-						ws_item -> ws_frame = 0x1;
-						if (opcode == WS_OP_TXT){
-							ws_item -> text = 0x1;
-						}
-						else{
-							ws_item -> text = 0x0;
-						}
-						//send websocket data to application
-						xQueueSend(ws_input_queue, &ws_item, portMAX_DELAY);
-						break;
-					case WS_OP_CLS:
-						//close connection
-						printf("close connection, index = %i\n", ws_tab_index);
-						close_ws((msg[0] << 8) + msg[1], ws_tab_index);
-						free(msg);
-						msg = NULL;
-						break;
-					case WS_OP_PIN:
-						//ping control frame
-						ws_item = malloc(sizeof(ws_queue_item_t));
-						ws_item -> payload = msg;
-						ws_item -> len = ws_len;
-						ws_item -> index = ws_tab_index;
-						ws_item -> opcode = WS_OP_PON;
-						ws_item -> ws_frame = 0x1;
-						ws_item -> text = 0x0;
-						//increment ping number
-						ws_list[ws_tab_index].pings++;
-						//printf("ping received, %i\n", ws_list[ws_tab_index].pings);
-						//send pong
-						xQueueSend(ws_output_queue, ws_item, portMAX_DELAY);
-						break;
-					case WS_OP_PON:
-						ws_list[ws_tab_index].pongs++;
-						//printf("pong received, %i\n", ws_list[ws_tab_index].pongs);
-						break;
-					case WS_OP_CON:
-					default:
-						//TODO: what to do if happen?
-						printf("incorrect opcode received: %X\n", opcode);
-						close_ws(1008, ws_tab_index);
-						free(msg);
-						break;
-					}
-				}
-				break;
-
-			case WS_CLOSED:
-				//check if request was http 'GET /\r\n'
-				if(rq[0] == 'G' && rq[1] == 'E' && rq[2] == 'T'
-						&& rq[3] == ' ' && rq[4] == '/') {
-					ws_item = malloc(sizeof(ws_queue_item_t));
-					//printf("hs, ws_item addr = %p\n", ws_item);
-					if (ws_item != NULL){
-						uint8_t res = ws_handshake(rq, ws_tab_index, ws_item);
-						if (res == 1){
-							xQueueSendToFront(ws_output_queue, &ws_item, portMAX_DELAY);
-						}
-						else{
-							printf("ws_handshake returned error\n");
-						}
-					}
-					else{
-						printf("handshake, no heap memory\n");
-					}
-				}
-				else{
-					//wrong, open request, close connection
-					ws_list[ws_tab_index].run = WS_STOP;
-					printf("ERROR: bad http request at handshake\n");
-				}
-				break;
-			case WS_OPENING:
-				//should not happen
-				printf("ws state is OPENING, received opcode = %X, msg = %s\n", opcode, msg);
-				break;
-			case WS_CLOSING:
-				if (opcode == WS_OP_CLS){
-					printf("client answer on close frame, close code = %i", (msg[0] << 8) + msg[1]);
-					ws_list[ws_tab_index].run = WS_STOP;
-					//TODO: if this is not answer for server's CLOSE, but client's fist
-					//CLOSE frame, then client is waiting for server's CLOSE
-				}
-				else{
-					printf("state CLOSING, incorrect ws frame, opcode = %X\n", opcode);
-				}
-				//ignore other opcodes
-				break;
-			default:
-				ws_list[ws_tab_index].run = WS_STOP;
-			}//switch(ws_state)
 		} //netconn_recv
 		else{
-			if (rcv_err == -15){
+			if (rcv_err == ERR_CLSD){
 				printf("TCP was closed by client\n");
 			}
 			else{
 				printf("Incorrect data received, index: %i, error = %i\n", ws_tab_index, rcv_err);
 			}
-			ws_list[ws_tab_index].run = WS_STOP;
+			WS_SET(ws_list[ws_tab_index].run, WS_STOP);
 		}
 	} //while
 
@@ -303,363 +450,2035 @@ static void ws_receive_task(void* arg){
 			printf("Receive task, recv error, connection can't be closed, error %i\n", err);
 		}
 	}
-
-	//stop time-out timer
-	if (ws_list[ws_tab_index].ws_timer != NULL){
-		xTimerStop(ws_list[ws_tab_index].ws_timer, 0);
-		xTimerDelete(ws_list[ws_tab_index].ws_timer, 0);
-		ws_list[ws_tab_index].ws_timer = NULL;
-	}
-
-	ws_list[ws_tab_index].netconn_ptr = NULL;
-	ws_list[ws_tab_index].ws_state = WS_CLOSED;
-	ws_list[ws_tab_index].run = WS_STOP;
+	ws_conn_release(ws_tab_index);
 	//delete websocket task
 	vTaskDelete(NULL);
 }
 
+// ****************************************************************************
+//stop parsing input of the connection, the rest is ignored until closing
+static void ws_fail(int8_t index, uint16_t code){
+	ws_list[index].parser.state = WS_PS_ERROR;
+	ws_buf_free(ws_list[index].rx_msg);
+	ws_list[index].rx_msg = NULL;
+	ws_buf_free(ws_list[index].rx_ctl);
+	ws_list[index].rx_ctl = NULL;
+	ws_list[index].rx_in_msg = 0;
+	close_ws(code, index);
+}
 
-// ***************************************************************************
-int8_t ws_handshake(uint8_t *rq, uint8_t index, ws_queue_item_t *ws_item){
-	uint8_t msg_flags = 0;
-	int8_t ret;
-	char *buff_1, *buff_2, *buff_3, *server_ans;
-	char *res1, *res2;
-
-	server_ans = NULL;
+// ****************************************************************************
+//reset message collecting
+static void ws_rx_reset(struct ws_list_item *ws){
+	ws -> rx_msg = NULL;
+	ws -> rx_ctl = NULL;
+	ws -> rx_pos = 0;
+	ws -> rx_cap = 0;
+	ws -> rx_total = 0;
+	ws -> rx_in_msg = 0;
+}
 
-	//upgrade
-	if (strstr((char *)rq, ws_upgrade)){
-		msg_flags |= 0x01;
+// ****************************************************************************
+//pass collected data to application as one part of the message, rx_msg is
+//handed over (or lent to recv_cb)
+static int8_t ws_part_send(int8_t index, uint8_t last){
+	struct ws_list_item *ws = &ws_list[index];
+	ws_queue_item_t *ws_item, view;
+	WS_RECV_ACTION action = WS_RECV_QUEUE;
+	uint32_t cap = ws -> rx_cap;
+	uint8_t *msg, sub;
+	int8_t topic = 0;
+
+	msg = ws -> rx_msg;
+	if (msg == NULL){
+		//empty part
+		msg = ws_buf_alloc(1);
+		if (msg == NULL){
+			return -1;
+		}
 	}
-	//connection
-	if (strstr((char *)rq, ws_conn_1)){
-		msg_flags |= 0x02;
+	msg[ws -> rx_pos] = 0;
+	ws -> rx_msg = NULL;
+	ws -> rx_cap = 0;
+	if (ws -> ws_state != WS_OPEN){
+		//connection is closing, data is ignored
+		ws_buf_free(msg);
+		ws -> rx_pos = 0;
+		return 0;
 	}
-	else if (strstr((char *)rq, ws_conn_2)){
-		msg_flags |= 0x02;
+	//subscribe and unsubscribe messages are handled by the server
+	if ((ws -> rx_first == 1) && (last == 1) && (ws -> rx_opcode == WS_OP_TXT)){
+		topic = ws_topic_ctrl(msg, ws -> rx_pos, &sub);
 	}
-	//ver
-	if (strstr((char *)rq, ws_ver)){
-		msg_flags |= 0x04;
+	if (topic != 0){
+		if (topic > 0){
+			ws_subscribe(index, topic, sub);
+		}
+		else{
+			printf("unknown topic refused, index = %i\n", index);
+		}
+		ws_buf_free(msg);
+		ws -> rx_first = 0;
+		ws -> rx_pos = 0;
+		ws -> st.msgs_in++;
+		return 0;
 	}
-	if (msg_flags == 0x07){
-		size_t  out_len;
-
-		res1 = strstr((char *)rq, ws_sec_key);
-		if (res1 != NULL){
-			msg_flags |= 0x08;
-
-			res2 = strstr(res1, ": ");
-			res1 = strstr(res2, "\r\n");
-			buff_1 = malloc(80);
-			memset(buff_1, 0, 80);
-			memcpy(buff_1, res2 + 2, res1 - res2 - 2);
-
-			//concatenate websocket GUID
-			strcpy((char *)&buff_1[res1 - res2 - 2], ws_sec_conKey);
-			buff_1[res1 - res2 - 2 + strlen(ws_sec_conKey)] = 0;
-
-			buff_2 = malloc(20);
-			esp_sha(SHA1, (unsigned char*)buff_1, strlen(buff_1), (unsigned char*)buff_2);
-			free(buff_1);
-
-			out_len = 4 + SHA1_RES_LEN*4/3 + 1;
-			buff_3 = (char*)base64_encode((unsigned char*)buff_2, SHA1_RES_LEN, (size_t*)&out_len);
-			free(buff_2);
-
-			//prepare server answer
-			server_ans = malloc(out_len + strlen(ws_server_hs) + 10);
-			sprintf(server_ans, ws_server_hs, buff_3);
-			//printf("%s\n", server_ans);
-			free(buff_3);
+	memset(&view, 0, sizeof(view));
+	view.payload = msg;
+	view.len = ws -> rx_pos;
+	view.index = index;
+	view.ws_frame = 0x1;
+	view.text = (ws -> rx_opcode == WS_OP_TXT) ? 0x1 : 0x0;
+	view.first = ws -> rx_first;
+	view.last = last;
+	view.msg_len = (last == 1) ? ws -> rx_total : ws -> rx_len;
+	ws -> rx_first = 0;
+	ws -> rx_pos = 0;
+	ws -> st.msgs_in += last;
+	WS_LAT_SINCE(WS_LAT_RX, ws -> rx_t_us);
+	WS_LAT_STAMP(ws -> rx_t_us);
+	if (ws_cfg.recv_cb != NULL){
+		//handled in this task, without queue item and context switch
+		action = ws_cfg.recv_cb(&view);
+	}
+	if (action == WS_RECV_DONE){
+		if ((cap > 0) && (cap <= WS_RX_KEEP_LEN)){
+			//small buffer is used for the next message
+			ws -> rx_msg = msg;
+			ws -> rx_cap = cap;
+		}
+		else{
+			ws_buf_free(msg);
 		}
+		return 0;
 	}
-
-	//send answer to the client
-	if ((msg_flags == 0x0F) & (server_ans != NULL)){
-
-		ws_list[index].ws_state = WS_OPENING;
-
-		ws_item -> payload = (uint8_t *)server_ans;
-		ws_item -> len = strlen(server_ans);
-		ws_item -> opcode = 0;
-		ws_item -> ws_frame = 0;
-		ws_item -> index = index;
-		//printf("data length = %i\n", ws_item -> len);
-		ret = 1;
+	if (action == WS_RECV_KEEP){
+		return 0;
 	}
-	else{
-		ret = -1;
-		printf("ws_handshake error, msg_flags = %X\n", msg_flags);
+	ws_item = ws_item_alloc();
+	if (ws_item == NULL){
+		ws_buf_free(msg);
+		return -1;
 	}
-	return ret;
+	memcpy(ws_item, &view, sizeof(view));
+	WS_LAT_STAMP(ws_item -> t_us);
+	//send websocket data to application
+	xQueueSend(ws_input_queue, &ws_item, portMAX_DELAY);
+	ws_stat_max(&ws_stats.in_queue_high_water,
+			uxQueueMessagesWaiting(ws_input_queue));
+	return 0;
 }
 
 // ****************************************************************************
-//close websocket
-uint8_t close_ws(uint16_t error_nr, int8_t ws_tab_index){
-	char *payload;
-	ws_queue_item_t *ws_item;
-	TimerHandle_t timeout_timer;
-
-	printf("connection will be closed, i = %i\n", ws_tab_index);
-
-	//prepare close frame with close code
-	payload = malloc(2);
-	payload[0] = error_nr >> 8;
-	payload[1] = error_nr;
-
-	ws_item = malloc(sizeof(ws_queue_item_t));
-	ws_item -> payload = (uint8_t *)payload;
-	ws_item -> len = 2;
-	ws_item -> index = ws_tab_index;
-	ws_item -> opcode = WS_OP_CLS; //close
-	ws_item -> ws_frame = 0x1;
-	xQueueSend(ws_output_queue, &ws_item, portMAX_DELAY);
-
-	//create time-out timer
-	timeout_timer = xTimerCreate("timeout", pdMS_TO_TICKS(CLOSE_TIMEOUT_MS),
-			pdFALSE, (void *)&ws_list[ws_tab_index].index,
-			vCloseTimeoutCallback);
-
-	ws_list[ws_tab_index].ws_timer = timeout_timer;
-	if (ws_list[ws_tab_index].ws_state == WS_OPEN){
-		ws_list[ws_tab_index].ws_state = WS_CLOSING;
+//make space in rx_msg for the next bytes of the message, left is number of
+//bytes until the end of the current frame
+//buffer grows up to the part length, a full part is passed on
+static int8_t ws_rx_space(int8_t index, uint64_t left){
+	struct ws_list_item *ws = &ws_list[index];
+	uint32_t part_len = ws_cfg.max_msg_len, cap;
+	uint8_t *buf;
+
+	if (ws -> rx_cap == part_len){
+		if (ws_part_send(index, 0) != 0){
+			return -1;
+		}
 	}
-	else{
-		ws_list[ws_tab_index].ws_state = WS_CLOSED;
-		ws_list[ws_tab_index].netconn_ptr = NULL;
-		printf("conn closed, index = %i\n", ws_tab_index);
+	cap = MIN(part_len, MAX((uint64_t)ws -> rx_cap * 2, ws -> rx_pos + left));
+	buf = ws_buf_realloc(ws -> rx_msg, ws -> rx_pos, cap + 1);
+	if (buf == NULL){
+		printf("receive, no heap memory\n");
+		return -1;
 	}
-	//start timer
-	xTimerStart(timeout_timer, 0);
-
-	return 1;
+	ws -> rx_msg = buf;
+	ws -> rx_cap = cap;
+	return 0;
 }
 
 // ****************************************************************************
-//closing timer callback
-void vCloseTimeoutCallback( TimerHandle_t xTimer ){
-	uint8_t index;
-	struct netconn *conn;
-	err_t err;
-
-	index = *(uint8_t *) pvTimerGetTimerID(xTimer);
+//keep the last bytes of received messages for the next ones (client uses
+//context takeover)
+static int8_t ws_rx_dict_add(struct ws_list_item *ws, const uint8_t *data,
+		size_t len){
+	size_t window = 1 << ws -> rx_dict_bits;
+
+	if (ws -> rx_dict == NULL){
+		ws -> rx_dict = ws_buf_alloc(window);
+		if (ws -> rx_dict == NULL){
+			return -1;
+		}
+		ws -> rx_dict_len = 0;
+	}
+	if (len >= window){
+		memcpy(ws -> rx_dict, data + len - window, window);
+		ws -> rx_dict_len = window;
+		return 0;
+	}
+	if (ws -> rx_dict_len + len > window){
+		memmove(ws -> rx_dict, ws -> rx_dict + ws -> rx_dict_len + len - window,
+				window - len);
+		ws -> rx_dict_len = window - len;
+	}
+	memcpy(ws -> rx_dict + ws -> rx_dict_len, data, len);
+	ws -> rx_dict_len += len;
+	return 0;
+}
 
-	conn = ws_list[index].netconn_ptr;
-	printf("timeout, index = %i\n", index);
-	if (conn != NULL){
-		ws_list[index].run = WS_STOP;
-		err = netconn_close(conn);
-		if (err != ERR_OK){
-			//TODO: what if can't be closed?
-			printf("Timeout callback, connection can't be closed, error %i\n", err);
+// ****************************************************************************
+//decompress message collected in rx_msg, the output buffer starts small
+//and grows up to max_msg_len, returns close code on error
+static uint16_t ws_rx_inflate(int8_t index){
+	struct ws_list_item *ws = &ws_list[index];
+	ws_inflate_t *s;
+	uint8_t *out = NULL;
+	size_t cap, len = 0;
+	int8_t ret = WS_INFLATE_ERROR;
+
+	//decompressor state is too large for the receive task stack, it is
+	//allocated with the first compressed message of the connection
+	if (ws -> rx_inf == NULL){
+		ws -> rx_inf = malloc(sizeof(ws_inflate_t));
+	}
+	s = ws -> rx_inf;
+	cap = MIN(ws_cfg.max_msg_len, 4 * (size_t)ws -> rx_pos + 64);
+	while (s != NULL){
+		out = ws_buf_alloc(cap + 1);
+		if (out == NULL){
+			break;
 		}
-		else{
-			printf("conn closed in timer\n");
+		ret = ws_inflate(s, ws -> rx_msg, ws -> rx_pos, out, cap, &len,
+				ws -> rx_dict, ws -> rx_dict_len);
+		if ((ret != WS_INFLATE_FULL) || (cap == ws_cfg.max_msg_len)){
+			break;
 		}
+		ws_buf_free(out);
+		out = NULL;
+		cap = MIN(ws_cfg.max_msg_len, cap * 4);
+	}
+	if ((s == NULL) || (out == NULL)){
+		printf("receive, no heap memory\n");
+		return 1011;
+	}
+	if (ret != WS_INFLATE_OK){
+		ws_buf_free(out);
+		printf("compressed message not accepted, index = %i, err = %i\n",
+				index, ret);
+		return (ret == WS_INFLATE_FULL) ? 1009 : 1007;
+	}
+	if ((ws -> rx_opcode == WS_OP_TXT) &&
+			(ws_utf8_check(WS_UTF8_ACCEPT, out, len) != WS_UTF8_ACCEPT)){
+		ws_buf_free(out);
+		printf("text is not UTF-8, index = %i\n", index);
+		return 1007;
+	}
+	if ((ws -> rx_dict_bits > 0) && (ws_rx_dict_add(ws, out, len) != 0)){
+		ws_buf_free(out);
+		return 1011;
 	}
+	ws_buf_free(ws -> rx_msg);
+	ws -> rx_msg = out;
+	ws -> rx_cap = cap;
+	ws -> rx_pos = len;
+	ws -> rx_total = len;
+	return 0;
 }
 
 // ****************************************************************************
-//prepare websocket header and send data to client
-static void ws_send_task(void* arg){
-	ws_queue_item_t *q_item;
-	ws_send_data ws_data;
-	int8_t index, data_sent;
-
-	for(;;){
-		xQueueReceive(ws_output_queue, &q_item, portMAX_DELAY);
-
-		data_sent = 0;
-		memset(head_buff, 0, q_item -> len + 4);
-		if (q_item -> ws_frame == 0x1){
-			add_ws_header(q_item, &ws_data);
+//frame header of a data frame (first or continuation fragment), returns
+//close code on error
+static uint16_t ws_data_header(int8_t index){
+	struct ws_list_item *ws = &ws_list[index];
+	ws_parser_t *p = &ws -> parser;
+	uint64_t limit;
+
+	if (p -> opcode == WS_OP_CON){
+		if ((ws -> rx_in_msg == 0) || (p -> rsv != 0)){
+			//nothing to continue, RSV1 is set only in the first fragment
+			return 1002;
 		}
-		else{
-			memcpy(head_buff, q_item -> payload, q_item -> len);
-			ws_data.payload = head_buff;
-			ws_data.len = q_item -> len;
-		}
-		index = q_item -> index;
-		free(q_item -> payload);
-
-		//send data to one or all clients
-		if (ws_data.payload != NULL){
-			if (index == -1){
-				//send to all clients
-				for (int i = 0; i < MAX_OPEN_WS_NR; i++){
-					if (ws_list[i].ws_state == WS_OPEN){
-						err_t err = netconn_write(ws_list[i].netconn_ptr,
-								ws_data.payload,
-								ws_data.len,
-								NETCONN_COPY);
-						if (err != ERR_OK){
-							printf("data not sent to multi, index = %i, err = %i, \ndata: %s\n",
-									i, err, (char *)ws_data.payload);
-						}
-						else{
-							data_sent++;
-						}
-					}
+	}
+	else{
+		if (ws -> rx_in_msg == 1){
+			//new message before the end of the fragmented one
+			return 1002;
+		}
+		ws -> rx_in_msg = 1;
+		ws -> rx_first = 1;
+		ws -> rx_opcode = p -> opcode;
+		ws -> rx_total = 0;
+		ws -> rx_len = (p -> fin == 1) ? p -> len : 0;
+		ws -> rx_comp = (p -> rsv & WS_RSV1) ? 0x1 : 0x0;
+		ws -> rx_utf8 = WS_UTF8_ACCEPT;
+		WS_LAT_STAMP(ws -> rx_t_us);
+	}
+	limit = MAX(ws_cfg.max_msg_len, ws_cfg.max_stream_len);
+	if (ws -> rx_comp == 1){
+		//compressed messages are decompressed whole
+		limit = ws_cfg.max_msg_len;
+	}
+	if (p -> len > limit - ws -> rx_total){
+		return 1009;
+	}
+	ws -> rx_total += p -> len;
+	return 0;
+}
+
+// ****************************************************************************
+//run received bytes through the frame parser
+static void ws_receive_frames(int8_t index, const uint8_t *data, size_t len){
+	struct ws_list_item *ws = &ws_list[index];
+	ws_parser_t *p = &ws -> parser;
+	ws_chunk_t chunk;
+	uint8_t *msg;
+	uint16_t code;
+	size_t n;
+
+	while (p -> state != WS_PS_ERROR){
+		switch (ws_parser_run(p, &data, &len, &chunk)){
+		case WS_PARSE_NEED_MORE:
+			return;
+		case WS_PARSE_HEADER:
+			if (p -> opcode & 0x08){
+				//control frame, it may come between fragments
+				if (p -> rsv != 0){
+					ws_fail(index, 1002);
+					break;
+				}
+				ws -> rx_ctl = ws_buf_alloc(p -> len + 1);
+				if (ws -> rx_ctl == NULL){
+					printf("receive, no heap memory\n");
+					ws_fail(index, 1011);
 				}
 			}
 			else{
-				//send to only one given client
-				WS_STATE state;
-
-				state = ws_list[index].ws_state;
-				if ((state == WS_OPEN) || (state == WS_OPENING) || (state == WS_CLOSING)){
-					err_t err = netconn_write(ws_list[index].netconn_ptr,
-							ws_data.payload,
-							ws_data.len,
-							NETCONN_COPY);
-					if (err != ERR_OK){
-						//TODO: what if answer for open handshake was not sent?
-						printf("data not sent to one, index = %i, err = %i, \ndata:%s\n",
-								index, err, (char *)ws_data.payload);
-					}
-					else{
-						if (ws_list[index].ws_state == WS_OPENING){
-							ws_list[index].ws_state = WS_OPEN;
-						}
-						data_sent++;
+				code = ws_data_header(index);
+				if (code != 0){
+					ws_fail(index, code);
+				}
+			}
+			break;
+		case WS_PARSE_PAYLOAD:
+			if (p -> opcode & 0x08){
+				ws_unmask(ws -> rx_ctl + chunk.offset, chunk.data, chunk.len,
+						p -> mask, chunk.offset);
+				break;
+			}
+			//copy data to message buffer, parts are passed on when full
+			while (chunk.len > 0){
+				if ((ws -> rx_pos == ws -> rx_cap) &&
+						(ws_rx_space(index, p -> len - chunk.offset) != 0)){
+					ws_fail(index, 1011);
+					break;
+				}
+				n = MIN(chunk.len, ws -> rx_cap - ws -> rx_pos);
+				if ((ws -> rx_opcode == WS_OP_TXT) && (ws -> rx_comp == 0)){
+					//text is checked while it is unmasked
+					ws -> rx_utf8 = ws_unmask_utf8(ws -> rx_msg + ws -> rx_pos,
+							chunk.data, n, p -> mask, chunk.offset, ws -> rx_utf8);
+					if (ws -> rx_utf8 == WS_UTF8_REJECT){
+						printf("text is not UTF-8, index = %i\n", index);
+						ws_fail(index, 1007);
+						break;
 					}
 				}
 				else{
-					printf("ERROR: single, websocket incorrect state\n");
+					ws_unmask(ws -> rx_msg + ws -> rx_pos, chunk.data, n, p -> mask,
+							chunk.offset);
 				}
+				chunk.data += n;
+				chunk.len -= n;
+				chunk.offset += n;
+				ws -> rx_pos += n;
 			}
-			if (data_sent > 0){
-				//for test
-				/*
-				if (q_item -> ws_frame == 0x1){
-					if (ws_data.len <= 125){
-						printf("header: 0x%X 0x%X\n", ws_data.payload[0], ws_data.payload[1]);
-						printf("server data for client: %s\n", &ws_data.payload[2]);
-					}
-					else{
-						printf("header: 0x%X 0x%X 0x%X 0x%X\n", ws_data.payload[0],
-								ws_data.payload[1], ws_data.payload[2], ws_data.payload[3]);
-						printf("server data for client: %s\n", &ws_data.payload[4]);
-					}
+			break;
+		case WS_PARSE_FRAME_END:
+			ws -> st.frames_in++;
+			if (p -> opcode & 0x08){
+				msg = ws -> rx_ctl;
+				ws -> rx_ctl = NULL;
+				msg[p -> len] = 0;
+				ws_dispatch(index, p -> opcode, msg, p -> len);
+				break;
+			}
+			if (p -> fin == 1){
+				//end of message
+				ws -> rx_in_msg = 0;
+				if ((ws -> rx_comp == 1) && ((code = ws_rx_inflate(index)) != 0)){
+					ws_fail(index, code);
 				}
-				else{
-					printf("server data for client: %s\n", ws_data.payload);
+				else if (ws -> rx_utf8 != WS_UTF8_ACCEPT){
+					//text ends inside a code point
+					printf("text is not UTF-8, index = %i\n", index);
+					ws_fail(index, 1007);
+				}
+				else if (ws_part_send(index, 1) != 0){
+					ws_fail(index, 1011);
 				}
-				*/
-				//end of "for test"
 			}
+			else if ((ws_cfg.rx_mode == WS_RX_STREAM) && (ws -> rx_pos > 0) &&
+					(ws -> rx_comp == 0)){
+				//fragment is passed on as it is
+				if (ws_part_send(index, 0) != 0){
+					ws_fail(index, 1011);
+				}
+			}
+			break;
+		case WS_PARSE_ERROR:
+			printf("incorrect frame received, index = %i\n", index);
+			ws_fail(index, p -> error);
+			break;
 		}
-		else{
-			printf("ws_send, no heap memory\n");
-		}
-		free(q_item);
-	} //for
+	}
 }
 
 // ****************************************************************************
-//add websocket header to sending data
-void add_ws_header(ws_queue_item_t *q, ws_send_data *out){
-	ws_frame_header_u_t header;
-
-	out -> payload = head_buff;
-	//add websocket header
-	header.h.opcode = q -> opcode;
-	header.h.fin = 0x1;
-	header.h.mask = 0x0;	//only client masks data
-	if (q -> len <= 125){
-		header.h.payload_len = q -> len;
-		head_buff[0] = header.bytes[0];
-		head_buff[1] = header.bytes[1];
-		memcpy(head_buff + 2, q -> payload, q -> len);
-		out -> len = q -> len + 2;
-	}
-	else if (q -> len <= MAX_PAYLOAD_LEN){
-		header.h.payload_len = 126;
-		head_buff[0] = header.bytes[0];
-		head_buff[1] = header.bytes[1];
-		head_buff[2] = (q -> len) >> 8;
-		head_buff[3] = (q -> len) & 0x00FF;
-		memcpy(head_buff + 4, q -> payload, q -> len);
-		out -> len = q -> len + 4;
+//pong with the payload of a heartbeat ping (the last one or an older one,
+//when the round trip is longer than the period) gives round trip time and
+//shows the client is alive, other pongs are only counted
+static void ws_hb_pong(int8_t index, const uint8_t *msg, uint32_t len){
+	struct ws_list_item *ws = &ws_list[index];
+	uint32_t t, rtt;
+
+	if ((len != WS_PING_LEN) || (ws_cfg.ping_period_ms == 0)){
+		return;
 	}
-	else{
-		//too long message
-		out -> len = 0;
-		out -> payload = NULL;
+	t = ((uint32_t)msg[0] << 24) | ((uint32_t)msg[1] << 16) |
+			((uint32_t)msg[2] << 8) | msg[3];
+	rtt = (uint32_t)esp_timer_get_time() - t;
+	if (((t & 1) == 0) || (rtt > (uint64_t)(ws_cfg.ping_max_missed + 1) *
+			ws_cfg.ping_period_ms * 1000)){
+		//not a heartbeat time
+		return;
+	}
+	//ws_hb_run (timer task) updates the fields under the shard mutex too
+	xSemaphoreTake(WS_SHARD(index) -> mutex, portMAX_DELAY);
+	ws -> hb_missed = 0;
+	if (t == ws -> hb_t_us){
+		ws -> hb_t_us = 0;
 	}
+	ws -> st.rtt_last_us = rtt;
+	//smoothed like TCP SRTT (RFC 6298), new sample has weight 1/8
+	ws -> st.rtt_us = (ws -> st.rtt_us == 0) ? MAX(rtt, 1) :
+			ws -> st.rtt_us - (ws -> st.rtt_us >> 3) + (rtt >> 3);
+	xSemaphoreGive(WS_SHARD(index) -> mutex);
 }
 
-
-// ***************************************************************************
-//initialize WebSocket server
-int8_t ws_server_init(void *param){
-	int8_t ret;
-	ws_queue_item_t *item_ptr;
-
-	//ws_server_handler = NULL;
-	xServerMutex = xSemaphoreCreateMutex();
-	xSendMutex = xSemaphoreCreateMutex();
-	//initialize ws_list
-	for (int i = 0; i < MAX_OPEN_WS_NR; i++){
-		ws_list[i].netconn_ptr = NULL;
-		ws_list[i].ws_timer = NULL;
-		ws_list[i].index = i;
-		ws_list[i].pings = 0;
-		ws_list[i].run = WS_STOP;
-		ws_list[i].ws_state = WS_CLOSED;
-	}
-	//start server task
-	if (server_is_running == 0){
-		//printf("ws server init, q item size: %i\n", sizeof(item_ptr));
-		vTaskDelay(1000 / portTICK_PERIOD_MS);
-		ws_output_queue = xQueueCreate(10, sizeof(item_ptr));
-		if (ws_output_queue != NULL){
-			printf("OUT queue created\n");
+// ****************************************************************************
+//control frame received, msg is freed or passed on
+static void ws_dispatch(int8_t index, uint8_t opcode, uint8_t *msg,
+		uint32_t len){
+	ws_queue_item_t *ws_item;
+	uint16_t code;
+
+	//close code is optional
+	code = (len >= 2) ? (msg[0] << 8) + msg[1] : 1000;
+
+	switch (ws_list[index].ws_state){
+	case WS_OPEN:
+		switch(opcode){
+		case WS_OP_CLS:
+			//close connection
+			printf("close connection, index = %i\n", index);
+			ws_stat_close(index, ws_stats.close_recv, code);
+			if ((len > 2) && (ws_utf8_check(WS_UTF8_ACCEPT, msg + 2, len - 2) !=
+					WS_UTF8_ACCEPT)){
+				//close reason is not UTF-8 text
+				code = 1007;
+			}
+			close_ws(code, index);
+			ws_buf_free(msg);
+			break;
+		case WS_OP_PIN:
+			//ping control frame
+			ws_item = ws_item_alloc();
+			if (ws_item == NULL){
+				ws_buf_free(msg);
+				break;
+			}
+			ws_item -> payload = msg;
+			ws_item -> len = len;
+			ws_item -> index = index;
+			ws_item -> opcode = WS_OP_PON;
+			ws_item -> ws_frame = 0x1;
+			ws_item -> text = 0x0;
+			//increment ping number
+			ws_list[index].st.pings++;
+			//send pong
+			xQueueSend(WS_SHARD(index) -> queue, &ws_item, portMAX_DELAY);
+			break;
+		case WS_OP_PON:
+			ws_list[index].st.pongs++;
+			ws_hb_pong(index, msg, len);
+			ws_buf_free(msg);
+			break;
+		default:
+			ws_buf_free(msg);
+			break;
+		}
+		break;
+
+	case WS_CLOSING:
+		if (opcode == WS_OP_CLS){
+			printf("client answer on close frame, close code = %i\n", code);
+			ws_stat_close(index, ws_stats.close_recv, code);
+			WS_SET(ws_list[index].run, WS_STOP);
+			//TODO: if this is not answer for server's CLOSE, but client's fist
+			//CLOSE frame, then client is waiting for server's CLOSE
 		}
 		else{
-			printf("OUT queue not created\n");
+			printf("state CLOSING, incorrect ws frame, opcode = %X\n", opcode);
 		}
-		//open input (receiving) queue
-		ws_input_queue = xQueueCreate(10, sizeof(item_ptr));
-		printf("IN queue created\n");
+		//ignore other opcodes
+		ws_buf_free(msg);
+		break;
+
+	default:
+		printf("ws state is %i, received opcode = %X\n",
+				ws_list[index].ws_state, opcode);
+		ws_buf_free(msg);
+		break;
+	}
+}
 
-		if ((ws_output_queue != NULL) && (ws_input_queue != NULL)){
-			xTaskCreate(server_task, "ws_server_task", 1024*4, param, 3, &server_task_handle);
-			printf("server task created\n");
-			server_is_running = 1;
+// ***************************************************************************
+//one permessage-deflate offer (parameters separated by ';'), returns 1 and
+//the answer in ext if it is accepted
+static int8_t ws_pmd_offer(const char *p, const char *end, uint8_t index,
+		char *ext, size_t ext_len){
+	const char *t, *eq;
+	size_t n;
+	int val, server_bits = 0, client_bits = -1;
+	uint8_t dict_bits;
+
+	for (uint8_t first = 1; p < end; first = 0){
+		//token without spaces
+		while ((p < end) && ((*p == ' ') || (*p == '\t'))){
+			p++;
+		}
+		t = memchr(p, ';', end - p);
+		t = (t == NULL) ? end : t;
+		n = t - p;
+		while ((n > 0) && ((p[n - 1] == ' ') || (p[n - 1] == '\t'))){
+			n--;
+		}
+		eq = memchr(p, '=', n);
+		val = -1;
+		if (eq != NULL){
+			//value may be quoted
+			val = atoi((*(eq + 1) == '"') ? eq + 2 : eq + 1);
+		}
+		if (first == 1){
+			if ((n != strlen(ws_pmd)) || (strncmp(p, ws_pmd, n) != 0)){
+				return 0;
+			}
+		}
+		else if ((n == 26) && (strncmp(p, "server_no_context_takeover", n) == 0)){
+			//server never keeps the context
+		}
+		else if ((n == 26) && (strncmp(p, "client_no_context_takeover", n) == 0)){
+			client_bits = 0;
+		}
+		else if ((eq != NULL) && (eq - p == 22) &&
+				(strncmp(p, "server_max_window_bits", 22) == 0)){
+			if ((val < WS_DEFLATE_MIN_BITS) || (val > WS_DEFLATE_MAX_BITS)){
+				return 0;
+			}
+			server_bits = val;
+		}
+		else if ((((eq != NULL) ? (size_t)(eq - p) : n) == 22) &&
+				(strncmp(p, "client_max_window_bits", 22) == 0)){
+			if (eq == NULL){
+				val = WS_DEFLATE_MAX_BITS;
+			}
+			else if ((val < WS_DEFLATE_MIN_BITS) || (val > WS_DEFLATE_MAX_BITS)){
+				return 0;
+			}
+			if (client_bits != 0){
+				client_bits = val;
+			}
 		}
 		else{
-			printf("ws server not created\n");
+			//unknown parameter, offer is declined
+			return 0;
 		}
-		//open output (sending) queue
-		xTaskCreate(ws_send_task, "ws_send_task", 2048, NULL, 1, NULL);
-		ret = 1;
+		p = t + 1;
+	}
+
+	//client keeps its context unless it offered or was told not to
+	if (client_bits == -1){
+		dict_bits = (ws_cfg.deflate_client_bits == WS_DEFLATE_MAX_BITS) ?
+				WS_DEFLATE_MAX_BITS : 0;
 	}
 	else{
-		ret = -1;
+		dict_bits = MIN(ws_cfg.deflate_client_bits, client_bits);
 	}
-	return ret;
+	ws_list[index].pmd = 1;
+	ws_list[index].pmd_bits = (server_bits == 0) ? ws_cfg.deflate_server_bits :
+			MIN(ws_cfg.deflate_server_bits, server_bits);
+	ws_list[index].rx_dict_bits = dict_bits;
+	ws_list[index].parser.rsv_allowed = WS_RSV1;
+
+	n = snprintf(ext, ext_len, "%s %s; server_no_context_takeover", ws_ext,
+			ws_pmd);
+	if (server_bits != 0){
+		n += snprintf(ext + n, ext_len - n, "; server_max_window_bits=%u",
+				ws_list[index].pmd_bits);
+	}
+	if (dict_bits == 0){
+		n += snprintf(ext + n, ext_len - n, "; client_no_context_takeover");
+	}
+	else if (client_bits > 0){
+		n += snprintf(ext + n, ext_len - n, "; client_max_window_bits=%u",
+				dict_bits);
+	}
+	snprintf(ext + n, ext_len - n, "\r\n");
+	return 1;
 }
 
-// ****************************************************************************
-//send data via websocket
-int8_t ws_send(ws_queue_item_t *item, int32_t wait_ms){
+// ***************************************************************************
+//negotiate permessage-deflate (RFC 7692), the first acceptable offer of
+//Sec-WebSocket-Extensions is taken, ext is empty if none is accepted
+static void ws_pmd_negotiate(const char *offers, uint8_t index, char *ext,
+		size_t ext_len){
+	const char *p = offers, *end = offers + strlen(offers), *comma;
+
+	ext[0] = 0;
+	ws_list[index].pmd = 0;
+	if ((ws_cfg.deflate == 0) || (WS_SHARD(index) -> deflater == NULL)){
+		return;
+	}
+	while (p < end){
+		comma = memchr(p, ',', end - p);
+		comma = (comma == NULL) ? end : comma;
+		if (ws_pmd_offer(p, comma, index, ext, ext_len) == 1){
+			return;
+		}
+		p = comma + 1;
+	}
+}
+
+// ***************************************************************************
+//answer to the parsed upgrade request, accept key is computed on the stack,
+//the answer is the only buffer (from pool if configured)
+int8_t ws_handshake(uint8_t index, ws_queue_item_t *ws_item){
+	char accept[WS_HS_ACCEPT_LEN + 1], ext[WS_EXT_LEN];
+	char *server_ans;
+	size_t len;
+
+	ws_hs_accept(ws_list[index].hs.key, accept);
+	ws_pmd_negotiate(ws_list[index].hs.ext, index, ext, sizeof(ext));
+
+	//two "%s" are replaced
+	len = sizeof(ws_server_hs) - 5 + WS_HS_ACCEPT_LEN + strlen(ext);
+	server_ans = ws_buf_alloc(len + 1);
+	if (server_ans == NULL){
+		return -1;
+	}
+	snprintf(server_ans, len + 1, ws_server_hs, accept, ext);
+
+	//send answer to the client
+	xSemaphoreTake(WS_SHARD(index) -> mutex, portMAX_DELAY);
+	ws_list[index].ws_state = WS_OPENING;
+	xSemaphoreGive(WS_SHARD(index) -> mutex);
+	ws_item -> payload = (uint8_t *)server_ans;
+	ws_item -> len = len;
+	ws_item -> opcode = 0;
+	ws_item -> ws_frame = 0;
+	ws_item -> index = index;
+	return 1;
+}
+
+// ****************************************************************************
+//close websocket, the close frame is queued waiting up to wait ticks,
+//returns 1 if it was queued, 0 if not; the state is changed under the
+//shard mutex (send task reads it), with wait 0 (timer task) the mutex is
+//only tried and -1 is returned without doing anything if it is taken
+static int8_t ws_close_send(uint16_t error_nr, int8_t ws_tab_index,
+		TickType_t wait){
+	xSemaphoreHandle mutex = WS_SHARD(ws_tab_index) -> mutex;
+	char *payload;
+	ws_queue_item_t *ws_item;
+	int8_t sent = 0;
+
+	//frame is queued under the mutex only without waiting (send task may
+	//wait for the mutex with the queue full)
+	if ((wait == 0) && (xSemaphoreTake(mutex, 0) != pdTRUE)){
+		return -1;
+	}
+	printf("connection will be closed, i = %i\n", ws_tab_index);
+	ws_stat_close(ws_tab_index, ws_stats.close_sent, error_nr);
+
+	//prepare close frame with close code
+	payload = ws_buf_alloc(2);
+	ws_item = ws_item_alloc();
+	if ((payload != NULL) && (ws_item != NULL)){
+		payload[0] = error_nr >> 8;
+		payload[1] = error_nr;
+		ws_item -> payload = (uint8_t *)payload;
+		ws_item -> len = 2;
+		ws_item -> index = ws_tab_index;
+		ws_item -> opcode = WS_OP_CLS; //close
+		ws_item -> ws_frame = 0x1;
+		sent = (xQueueSend(WS_SHARD(ws_tab_index) -> queue, &ws_item, wait) ==
+				pdTRUE) ? 1 : 0;
+	}
+	if (sent == 0){
+		//connection is closed by the timer without close frame
+		ws_buf_free(payload);
+		ws_item_free(ws_item);
+	}
+
+	if (wait != 0){
+		xSemaphoreTake(mutex, portMAX_DELAY);
+	}
+	if (ws_list[ws_tab_index].ws_state == WS_OPEN){
+		ws_list[ws_tab_index].ws_state = WS_CLOSING;
+	}
+	else{
+		//netconn is released by the receive task
+		ws_list[ws_tab_index].ws_state = WS_CLOSED;
+		printf("conn closed, index = %i\n", ws_tab_index);
+	}
+	xSemaphoreGive(mutex);
+	//connection is closed if the client does not answer
+	ws_wheel_arm(&wheel, &ws_list[ws_tab_index].dl[WS_DL_CLOSE],
+			ws_cfg.close_timeout_ms);
+
+	return sent;
+}
 
-	return xQueueSend(ws_output_queue, &item, wait_ms / portTICK_RATE_MS);
+// ****************************************************************************
+uint8_t close_ws(uint16_t error_nr, int8_t ws_tab_index){
+	ws_close_send(error_nr, ws_tab_index, portMAX_DELAY);
+	return 1;
 }
 
 // ****************************************************************************
+//close TCP connection at once (handshake or close deadline)
+static void ws_timeout_close(int8_t index){
+	err_t err;
+
+	printf("timeout, index = %i\n", index);
+	if (ws_slot_used(index)){
+		WS_SET(ws_list[index].run, WS_STOP);
+		err = ws_conn_close(index);
+		if (err != ERR_OK){
+			//TODO: what if can't be closed?
+			printf("Timeout callback, connection can't be closed, error %i\n", err);
+		}
+		else{
+			printf("conn closed in timer\n");
+		}
+	}
+}
+
+// ****************************************************************************
+//heartbeat: ping with the current time to every open connection,
+//connections which did not answer ping_max_missed pings in a row are
+//dropped; the miss counter and the ping time are shared with ws_hb_pong
+//(receive task) and changed under the shard mutex, which is only tried
+//here (timer task), a busy connection is checked in the next period
+static void ws_hb_run(void){
+	struct ws_list_item *ws;
+	ws_queue_item_t *item;
+	uint8_t *payload;
+	uint32_t now;
+
+	for (int i = 0; i < ws_max_nr; i++){
+		ws = &ws_list[i];
+		//state is read under the mutex only (slot may be set up meanwhile)
+		if ((ws_slot_used(i) == 0) ||
+				(xSemaphoreTake(WS_SHARD(i) -> mutex, 0) != pdTRUE)){
+			continue;
+		}
+		if (ws -> ws_state != WS_OPEN){
+			xSemaphoreGive(WS_SHARD(i) -> mutex);
+			continue;
+		}
+		ws -> hb_missed = (ws -> hb_t_us != 0) ?
+				MIN(ws -> hb_missed + 1, 0xFF) : 0;
+		if (ws -> hb_missed >= ws_cfg.ping_max_missed){
+			WS_STAT_INC(ws_stats.ping_timeouts);
+			ws_disconnect(i, "no answer to pings");
+			xSemaphoreGive(WS_SHARD(i) -> mutex);
+			continue;
+		}
+		payload = ws_buf_alloc(WS_PING_LEN);
+		item = ws_item_alloc();
+		if ((payload == NULL) || (item == NULL)){
+			xSemaphoreGive(WS_SHARD(i) -> mutex);
+			ws_buf_free(payload);
+			ws_item_free(item);
+			break;
+		}
+		//0 means no ping
+		now = (uint32_t)esp_timer_get_time() | 1;
+		payload[0] = now >> 24;
+		payload[1] = now >> 16;
+		payload[2] = now >> 8;
+		payload[3] = now;
+		item -> payload = payload;
+		item -> len = WS_PING_LEN;
+		item -> index = i;
+		item -> opcode = WS_OP_PIN;
+		item -> ws_frame = 0x1;
+		//ping is skipped if the output queue is full
+		if (xQueueSend(WS_SHARD(i) -> queue, &item, 0) == pdTRUE){
+			ws -> hb_t_us = now;
+		}
+		else{
+			ws_item_free(item);
+		}
+		xSemaphoreGive(WS_SHARD(i) -> mutex);
+	}
+}
+
+// ****************************************************************************
+//deadline expired (timer task), id is the connection it was armed for;
+//the close frame is not waited for here, the timer task must not block
+static void ws_deadline(int8_t index, uint8_t kind, uint32_t id){
+	struct ws_list_item *ws = (index >= 0) ? &ws_list[index] : NULL;
+	int8_t res;
+
+	if ((ws != NULL) && (ws -> st.id != id)){
+		//place was released and used again while the deadline fired
+		return;
+	}
+	switch (kind){
+	case WS_DL_PING:
+		ws_hb_run();
+		ws_wheel_arm(&wheel, &hb_tm, ws_cfg.ping_period_ms);
+		break;
+	case WS_DL_HANDSHAKE:
+		//TCP connection without upgrade request (slowloris)
+		if ((ws -> ws_state == WS_CLOSED) && (WS_GET(ws -> run) == WS_RUN)){
+			WS_STAT_INC(ws_stats.handshake_errors);
+			ws_timeout_close(index);
+		}
+		break;
+	case WS_DL_CLOSE:
+		ws_timeout_close(index);
+		break;
+	case WS_DL_IDLE:
+		if (ws -> ws_state == WS_OPEN){
+			res = ws_close_send(1001, index, 0);
+			if (res < 0){
+				//send task is writing, tried again soon
+				ws_wheel_arm(&wheel, &ws -> dl[WS_DL_IDLE], WS_TX_RETRY_MS);
+				break;
+			}
+			printf("idle connection, index = %i\n", index);
+			WS_STAT_INC(ws_stats.idle_timeouts);
+			if (res == 0){
+				//output queue is full
+				ws_timeout_close(index);
+			}
+		}
+		break;
+	case WS_DL_STALL:
+		if (xSemaphoreTake(WS_SHARD(index) -> mutex, 0) != pdTRUE){
+			//send task is writing, checked again soon
+			ws_wheel_arm(&wheel, &ws -> dl[WS_DL_STALL], WS_TX_RETRY_MS);
+			break;
+		}
+		if ((ws -> st.id == id) && (ws -> tx_nr > 0) &&
+				(ws -> ws_state != WS_CLOSED)){
+			WS_STAT_INC(ws_stats.stall_timeouts);
+			ws_disconnect(index, "write stalled");
+		}
+		xSemaphoreGive(WS_SHARD(index) -> mutex);
+		break;
+	}
+}
+
+// ****************************************************************************
+//wheel timer callback
+static void ws_wheel_callback(TimerHandle_t timer){
+	(void)timer;
+	ws_wheel_tick(&wheel);
+}
+
+// ****************************************************************************
+//frames which can be dropped by the slow consumer policy: whole data
+//messages, not control frames, fragments or the handshake answer
+static int8_t ws_tx_droppable(ws_frame_t *f){
+	if ((f -> head_len == 0) || (f -> head[0] & 0x08)){
+		return 0;
+	}
+	//FIN bit and not continuation
+	return ((f -> head[0] & 0x80) && ((f -> head[0] & 0x0F) != WS_OP_CON));
+}
+
+// ****************************************************************************
+//remove n-th queued frame
+static void ws_tx_remove(int8_t i, uint16_t n){
+	struct ws_list_item *ws = &ws_list[i];
+	uint16_t cap = ws_cfg.tx_queue_len + WS_TX_CTRL_RESERVE, from, to;
+
+	ws -> tx_bytes -= ws_frame_size(ws -> txq[(ws -> tx_head + n) % cap]);
+	ws_frame_unref(ws -> txq[(ws -> tx_head + n) % cap]);
+	for (uint16_t k = n; k + 1 < ws -> tx_nr; k++){
+		to = (ws -> tx_head + k) % cap;
+		from = (ws -> tx_head + k + 1) % cap;
+		ws -> txq[to] = ws -> txq[from];
+	}
+	ws -> tx_nr--;
+	if (n == 0){
+		ws -> tx_off = 0;
+	}
+}
+
+// ****************************************************************************
+//release all queued frames
+static void ws_tx_clear(int8_t i){
+	while (ws_list[i].tx_nr > 0){
+		ws_tx_remove(i, ws_list[i].tx_nr - 1);
+	}
+	ws_list[i].tx_off = 0;
+	ws_list[i].cb.len = 0;
+	ws_list[i].cb_off = 0;
+	ws_list[i].cb_flush = 0;
+	//combined frames were not written
+	for (int n = 0; n < ws_list[i].cb_nr; n++){
+		ws_frame_unref(ws_list[i].cb_frames[n]);
+	}
+	ws_list[i].cb_nr = 0;
+}
+
+// ****************************************************************************
+//connection is dropped without close handshake (slow consumer, no answer
+//to pings), receive task releases it, caller holds the shard mutex
+static void ws_disconnect(int8_t i, const char *why){
+	printf("%s, index = %i, queued = %u\n", why, i, ws_list[i].tx_nr);
+	ws_tx_clear(i);
+	ws_list[i].ws_state = WS_CLOSED;
+	WS_SET(ws_list[i].run, WS_STOP);
+	ws_conn_close(i);
+}
+
+// ****************************************************************************
+//queue frame for one client, apply policy if the client does not read fast
+//enough, caller holds the shard mutex
+static void ws_tx_push(int8_t i, ws_frame_t *f){
+	struct ws_list_item *ws = &ws_list[i];
+	uint16_t cap = ws_cfg.tx_queue_len + WS_TX_CTRL_RESERVE, n, slot;
+	uint64_t size = ws_frame_size(f);
+
+	if (f -> key != 0){
+		//latest value replaces the queued one in its place, partly written
+		//frame must be finished
+		for (n = (ws -> tx_off > 0) ? 1 : 0; n < ws -> tx_nr; n++){
+			slot = (ws -> tx_head + n) % cap;
+			if (ws -> txq[slot] -> key == f -> key){
+				ws -> tx_bytes += size - ws_frame_size(ws -> txq[slot]);
+				ws_frame_unref(ws -> txq[slot]);
+				ws -> txq[slot] = ws_frame_ref(f);
+				ws -> st.conflated++;
+				return;
+			}
+		}
+	}
+	for (;;){
+		if ((ws -> tx_nr < ws_cfg.tx_queue_len) && ((ws_cfg.tx_high_water == 0)
+				|| (ws -> tx_bytes + size <= ws_cfg.tx_high_water))){
+			break;
+		}
+		if ((ws_tx_droppable(f) == 0) && (ws -> tx_nr < cap)){
+			//control frames use the reserve
+			break;
+		}
+		if ((ws_cfg.tx_policy == WS_TX_DISCONNECT) || (ws -> tx_nr == cap)){
+			ws_disconnect(i, "slow client disconnected");
+			return;
+		}
+		if (ws_cfg.tx_policy == WS_TX_DROP_OLDEST){
+			//partly written frame must be finished
+			for (n = (ws -> tx_off > 0) ? 1 : 0; n < ws -> tx_nr; n++){
+				if (ws_tx_droppable(ws -> txq[(ws -> tx_head + n) % cap])){
+					break;
+				}
+			}
+			if (n < ws -> tx_nr){
+				ws_tx_remove(i, n);
+				ws -> st.drops++;
+				continue;
+			}
+		}
+		//drop newest or nothing older to drop
+		if (ws_tx_droppable(f)){
+			ws -> st.drops++;
+		}
+		else{
+			ws_disconnect(i, "slow client disconnected");
+		}
+		return;
+	}
+	ws -> txq[(ws -> tx_head + ws -> tx_nr) % cap] = ws_frame_ref(f);
+	ws -> tx_nr++;
+	ws -> tx_bytes += size;
+	ws -> st.tx_high_water = MAX(ws -> st.tx_high_water, ws -> tx_nr);
+}
+
+// ****************************************************************************
+//write frame (or the combined frames) from *off without blocking
+static err_t ws_tx_write(struct ws_list_item *ws, ws_frame_t *f,
+		uint64_t *off){
+	err_t err;
+#if WS_LATENCY
+	uint32_t t_wr;
+#endif
+
+	WS_LAT_STAMP(t_wr);
+	if (ws -> sock >= 0){
+		err = ws_frame_write_sock(ws -> sock, f, off);
+	}
+	else{
+		err = ws_frame_write(ws -> netconn_ptr, f, off, NETCONN_DONTBLOCK);
+	}
+	WS_LAT_SINCE(WS_LAT_WRITE, t_wr);
+	if (err == ERR_OK){
+		ws -> st.writes++;
+	}
+	return err;
+}
+
+// ****************************************************************************
+//frame is written to the connection: counters, latency, completion
+static void ws_tx_sent(struct ws_list_item *ws, ws_frame_t *f){
+	ws -> st.bytes_out += ws_frame_size(f);
+	ws -> st.frames_out += (f -> head_len > 0) ? 1 : 0;
+	WS_LAT_SINCE(WS_LAT_TX, f -> t_us);
+	ws_frame_written(f);
+	ws_frame_unref(f);
+}
+
+// ****************************************************************************
+//write combined frames, cb is empty if ERR_OK is returned; its frames
+//count as sent only then
+static err_t ws_cb_write(struct ws_list_item *ws){
+	err_t err;
+
+	err = ws_tx_write(ws, &ws -> cb, &ws -> cb_off);
+	if (err == ERR_OK){
+		for (int n = 0; n < ws -> cb_nr; n++){
+			ws_tx_sent(ws, ws -> cb_frames[n]);
+		}
+		ws -> cb_nr = 0;
+		ws -> cb.len = 0;
+		ws -> cb_off = 0;
+		ws -> cb_flush = 0;
+	}
+	return err;
+}
+
+// ****************************************************************************
+//small data frame which is copied to cb instead of being written alone
+static uint8_t ws_cb_fits(struct ws_list_item *ws, ws_frame_t *f){
+	return (ws -> cb.payload != NULL) && (ws -> tx_off == 0) &&
+			(f -> head_len > 0) && ((f -> head[0] & 0x08) == 0) &&
+			(ws_frame_size(f) <= ws_cfg.tx_coalesce_len);
+}
+
+// ****************************************************************************
+//us until the combined frames must be written, 0 - now
+static uint32_t ws_cb_due(struct ws_list_item *ws){
+	uint32_t age = (uint32_t)esp_timer_get_time() - ws -> cb_t_us;
+
+	return (age >= ws_cfg.tx_coalesce_us) ? 0 : ws_cfg.tx_coalesce_us - age;
+}
+
+// ****************************************************************************
+//write queued frames without blocking, a partly written frame is resumed
+//next time, returns ERR_WOULDBLOCK if frames are left in the queue
+//small data frames are combined in cb (tx_coalesce_len), it is written when
+//it is full, before a large or control frame, after tx_coalesce_us or when
+//ws_flush() asks for it
+static err_t ws_tx_flush(int8_t i){
+	struct ws_list_item *ws = &ws_list[i];
+	uint16_t cap = ws_cfg.tx_queue_len + WS_TX_CTRL_RESERVE, nr = ws -> tx_nr;
+	uint64_t off = ws -> tx_off, cb_len = ws -> cb.len, cb_off = ws -> cb_off;
+	ws_frame_t *f;
+	err_t err = ERR_OK;
+
+	while ((ws -> tx_nr > 0) && (err == ERR_OK)){
+		f = ws -> txq[ws -> tx_head];
+		if (ws_cb_fits(ws, f)){
+			if ((ws_frame_size(f) > ws_cfg.tx_coalesce_len - ws -> cb.len) ||
+					(ws -> cb_nr == WS_CB_FRAMES)){
+				//cb is full
+				err = ws_cb_write(ws);
+				continue;
+			}
+			if (ws -> cb.len == 0){
+				ws -> cb_t_us = (uint32_t)esp_timer_get_time();
+			}
+			ws_frame_copy(f, ws -> cb.payload + ws -> cb.len);
+			ws -> cb.len += ws_frame_size(f);
+			//queue reference is kept until cb is written
+			ws -> cb_frames[ws -> cb_nr++] = f;
+			ws -> tx_bytes -= ws_frame_size(f);
+			ws -> tx_head = (ws -> tx_head + 1) % cap;
+			ws -> tx_nr--;
+			continue;
+		}
+		else if (ws -> cb.len > 0){
+			//combined frames go first
+			err = ws_cb_write(ws);
+			continue;
+		}
+		else{
+			err = ws_tx_write(ws, f, &ws -> tx_off);
+			if (err != ERR_OK){
+				continue;
+			}
+		}
+		ws -> tx_bytes -= ws_frame_size(f);
+		ws_tx_sent(ws, f);
+		ws -> tx_head = (ws -> tx_head + 1) % cap;
+		ws -> tx_nr--;
+		ws -> tx_off = 0;
+	}
+	if ((err == ERR_OK) && (ws -> cb.len > 0) &&
+			((ws -> cb_flush == 1) || (ws_cb_due(ws) == 0))){
+		err = ws_cb_write(ws);
+	}
+	if (err == ERR_WOULDBLOCK){
+		//deadline is moved while some data goes out
+		if ((ws_cfg.tx_stall_ms > 0) && ((nr != ws -> tx_nr) ||
+				(off != ws -> tx_off) || (cb_len != ws -> cb.len) ||
+				(cb_off != ws -> cb_off) || !ws_tm_armed(&ws -> dl[WS_DL_STALL]))){
+			ws_wheel_arm(&wheel, &ws -> dl[WS_DL_STALL], ws_cfg.tx_stall_ms);
+		}
+		return err;
+	}
+	if (err != ERR_OK){
+		printf("data not sent, index = %i, err = %i\n", i, err);
+		ws -> st.write_errors++;
+		ws_tx_clear(i);
+		return err;
+	}
+	if (ws_tm_armed(&ws -> dl[WS_DL_STALL])){
+		ws_wheel_cancel(&wheel, &ws -> dl[WS_DL_STALL]);
+	}
+	return ERR_OK;
+}
+
+// ****************************************************************************
+//data frames must not break a fragmented message: continuation only after
+//the first fragment, no new message before the final one; control frames
+//may be sent between fragments, returns 1 if the frame can be sent
+static int8_t ws_frag_check(int8_t i, uint8_t opcode, uint8_t fin){
+	if (opcode & 0x08){
+		return 1;
+	}
+	if ((opcode == WS_OP_CON) != (ws_list[i].tx_frag == 1)){
+		printf("fragment out of order, index = %i, opcode = %X\n", i, opcode);
+		return 0;
+	}
+	ws_list[i].tx_frag = (fin == 0) ? 0x1 : 0x0;
+	return 1;
+}
+
+// ****************************************************************************
+//connection i gets a frame for index (-1 all) and topic (0 any)
+static uint8_t ws_target(int8_t i, int8_t index, uint8_t topic){
+	if (index != -1){
+		return index == i;
+	}
+	return (topic == 0) || ((ws_list[i].topics & WS_TOPIC_BIT(topic)) != 0);
+}
+
+// ****************************************************************************
+//frame of a queue item, payload (or blocks) is taken over unless keep is 1
+static ws_frame_t *ws_item_frame(ws_queue_item_t *q_item, uint8_t keep){
+	ws_frame_t *frame;
+	uint8_t fin = (q_item -> more == 0) ? 0x1 : 0x0;
+
+	if (q_item -> vec != NULL){
+		frame = ws_frame_new_vec(q_item -> opcode, fin, q_item -> vec,
+				q_item -> vec_nr, keep);
+	}
+	else{
+		frame = ws_frame_new(q_item -> opcode, fin, q_item -> ws_frame,
+				q_item -> payload, q_item -> len, keep);
+	}
+	if (frame == NULL){
+		return NULL;
+	}
+	//only whole data messages are conflated
+	if ((fin == 1) && (q_item -> ws_frame == 1) &&
+			((q_item -> opcode == WS_OP_TXT) || (q_item -> opcode == WS_OP_BIN))){
+		frame -> key = q_item -> key;
+	}
+	frame -> done = q_item -> done;
+	frame -> ctx = q_item -> done_ctx;
+	return frame;
+}
+
+// ****************************************************************************
+//compressed copy of a data frame for clients of the shard using
+//permessage-deflate, it is made once for all of them (no context
+//takeover), NULL if no target client uses the extension or the message
+//does not get shorter
+static ws_frame_t *ws_deflate_frame(ws_shard_t *s, ws_queue_item_t *q_item,
+		int8_t index, uint8_t topic){
+	ws_frame_t *zframe;
+	uint8_t *out, bits = 0;
+	size_t len;
+
+	if ((s -> deflater == NULL) || (q_item -> vec != NULL) ||
+			(q_item -> ws_frame == 0) || (q_item -> more == 1) ||
+			(q_item -> plain == 1) ||
+			((q_item -> opcode != WS_OP_TXT) && (q_item -> opcode != WS_OP_BIN)) ||
+			(q_item -> len < ws_cfg.deflate_min_len)){
+		return NULL;
+	}
+	//smallest window of all target clients
+	for (int i = s -> n; i < ws_max_nr; i += ws_shard_nr){
+		if (ws_target(i, index, topic) && (ws_list[i].pmd == 1) &&
+				(ws_list[i].ws_state == WS_OPEN)){
+			bits = (bits == 0) ? ws_list[i].pmd_bits : MIN(bits, ws_list[i].pmd_bits);
+		}
+	}
+	if (bits == 0){
+		return NULL;
+	}
+	out = ws_buf_alloc(q_item -> len);
+	if (out == NULL){
+		return NULL;
+	}
+	len = ws_deflate(s -> deflater, q_item -> payload, q_item -> len, out,
+			q_item -> len - 1, bits);
+	if (len == 0){
+		ws_buf_free(out);
+		return NULL;
+	}
+	zframe = ws_frame_new(q_item -> opcode, 1, 1, out, len, 0);
+	if (zframe != NULL){
+		zframe -> head[0] |= WS_FRAME_RSV1;
+	}
+	return zframe;
+}
+
+// ****************************************************************************
+//frame of a client: compressed one if it uses permessage-deflate
+static ws_frame_t *ws_client_frame(int8_t i, ws_frame_t *frame,
+		ws_frame_t *zframe){
+	return ((zframe != NULL) && (ws_list[i].pmd == 1)) ? zframe : frame;
+}
+
+// ****************************************************************************
+//encode websocket frame once and queue it for one or all clients of the
+//shard, caller holds the shard mutex
+static void ws_queue_frame(ws_shard_t *s, ws_queue_item_t *q_item){
+	ws_frame_t *frame, *zframe;
+	int8_t index;
+	uint8_t opcode, fin, data, topic;
+
+	if (q_item -> flush == 1){
+		//frames queued before are written without waiting
+		for (int i = s -> n; i < ws_max_nr; i += ws_shard_nr){
+			if (((q_item -> index == -1) || (q_item -> index == i)) &&
+					((ws_list[i].cb.len > 0) || (ws_list[i].tx_nr > 0))){
+				ws_list[i].cb_flush = 1;
+			}
+		}
+		ws_item_free(q_item);
+		return;
+	}
+	//frame takes over the payload, all clients share it, broadcast of more
+	//shards is encoded by the sender (payload is borrowed from it)
+	frame = (q_item -> frame != NULL) ? q_item -> frame :
+			ws_item_frame(q_item, q_item -> keep);
+	fin = (q_item -> more == 0) ? 0x1 : 0x0;
+	index = q_item -> index;
+	topic = (index == -1) ? q_item -> topic : 0;
+	opcode = q_item -> opcode;
+	data = q_item -> ws_frame;
+	WS_LAT_SINCE(WS_LAT_OUT_QUEUE, q_item -> t_us);
+	zframe = (frame != NULL) ? ws_deflate_frame(s, q_item, index, topic) : NULL;
+	q_item -> payload = NULL;
+	ws_item_free(q_item);
+	if (frame == NULL){
+		printf("ws_send, no heap memory\n");
+		return;
+	}
+	if (zframe != NULL){
+		zframe -> key = frame -> key;
+		if (frame -> done != NULL){
+			//completion waits for the compressed copy too
+			zframe -> origin = ws_frame_ref(frame);
+		}
+	}
+#if WS_LATENCY
+	if (zframe != NULL){
+		//compression time is counted too
+		zframe -> t_us = frame -> t_us;
+	}
+#endif
+
+	if (index == -1){
+		//send to all clients or to the subscribers of the topic
+		for (int i = s -> n; i < ws_max_nr; i += ws_shard_nr){
+			if (ws_target(i, index, topic) && (ws_list[i].ws_state == WS_OPEN) &&
+					(ws_frag_check(i, opcode, fin) == 1)){
+				ws_tx_push(i, ws_client_frame(i, frame, zframe));
+			}
+		}
+	}
+	else{
+		//send to only one given client
+		WS_STATE state;
+
+		state = ws_list[index].ws_state;
+		if (((state == WS_OPEN) || (state == WS_OPENING) || (state == WS_CLOSING))
+				&& ws_slot_used(index)
+				&& ((data == 0) || (ws_frag_check(index, opcode, fin) == 1))){
+			if (state == WS_OPENING){
+				//client may send frames as soon as it gets the answer
+				ws_list[index].ws_state = WS_OPEN;
+			}
+			ws_tx_push(index, ws_client_frame(index, frame, zframe));
+		}
+		else{
+			printf("ERROR: single, websocket incorrect state\n");
+		}
+	}
+	//queues hold their own references, payload is released with the last one
+	ws_frame_unref(frame);
+	ws_frame_unref(zframe);
+}
+
+// ****************************************************************************
+//move frames from the shard's output queue to the connection queues and
+//write them, while some client can not take more data the queues are
+//retried every WS_TX_RETRY_MS
+static void ws_send_task(void* arg){
+	ws_shard_t *s = (ws_shard_t *)arg;
+	ws_queue_item_t *q_item;
+	TickType_t wait = portMAX_DELAY;
+	uint32_t hold, due;
+	uint8_t pending, nr, stop = 0;
+
+	for(;;){
+		nr = 0;
+		if (xQueueReceive(s -> queue, &q_item, wait) == pdTRUE){
+			//the received item was waiting too (queue may be refilled already)
+			ws_stat_max(&ws_stats.out_queue_high_water,
+					MIN(uxQueueMessagesWaiting(s -> queue) + 1,
+					ws_cfg.out_queue_len));
+			xSemaphoreTake(s -> mutex, portMAX_DELAY);
+			do {
+				if (q_item == NULL){
+					//ws_server_stop, the last item
+					stop = 1;
+					break;
+				}
+				ws_queue_frame(s, q_item);
+				nr++;
+			} while ((nr < WS_TX_BATCH) &&
+					(xQueueReceive(s -> queue, &q_item, 0) == pdTRUE));
+		}
+		else{
+			xSemaphoreTake(s -> mutex, portMAX_DELAY);
+		}
+
+		pending = 0;
+		hold = 0;
+		for (int i = s -> n; i < ws_max_nr; i += ws_shard_nr){
+			if (((ws_list[i].tx_nr > 0) || (ws_list[i].cb.len > 0)) &&
+					(ws_tx_flush(i) == ERR_WOULDBLOCK)){
+				pending = 1;
+			}
+			else if (ws_list[i].cb.len > 0){
+				//combined frames wait for more until their deadline
+				due = MAX(ws_cb_due(&ws_list[i]), 1);
+				hold = (hold == 0) ? due : MIN(hold, due);
+			}
+		}
+		xSemaphoreGive(s -> mutex);
+		if (stop == 1){
+			xSemaphoreGive(ws_stop_sem);
+			vTaskDelete(NULL);
+			return;
+		}
+		wait = (pending == 1) ? pdMS_TO_TICKS(WS_TX_RETRY_MS) : portMAX_DELAY;
+		if (hold > 0){
+			wait = MIN(wait, MAX(pdMS_TO_TICKS((hold + 999) / 1000), 1));
+		}
+		if (nr == WS_TX_BATCH){
+			//more items may be waiting
+			wait = 0;
+		}
+	} //for
+}
+
+
+// ***************************************************************************
+//fill configuration fields equal to 0 with default values
+static void ws_cfg_defaults(ws_server_cfg_t *cfg){
+	if (cfg -> max_clients == 0){
+		cfg -> max_clients = (cfg -> engine == WS_ENGINE_SELECT) ?
+				WS_SELECT_MAX_NR : MAX_OPEN_WS_NR;
+	}
+	cfg -> max_clients = MIN(cfg -> max_clients, WS_MAX_CLIENTS);
+	if (cfg -> in_queue_len == 0){
+		cfg -> in_queue_len = WS_QUEUE_LEN;
+	}
+	if (cfg -> out_queue_len == 0){
+		cfg -> out_queue_len = WS_QUEUE_LEN;
+	}
+	if (cfg -> max_msg_len == 0){
+		cfg -> max_msg_len = MAX_PAYLOAD_LEN;
+	}
+	if (cfg -> tx_queue_len == 0){
+		cfg -> tx_queue_len = WS_TX_QUEUE_LEN;
+	}
+	if (cfg -> server_task.stack == 0){
+		cfg -> server_task.stack = WS_SERVER_STACK;
+	}
+	if (cfg -> server_task.prio == 0){
+		cfg -> server_task.prio = WS_SERVER_PRIO;
+	}
+	if (cfg -> recv_task.stack == 0){
+		cfg -> recv_task.stack = WS_RECV_STACK;
+	}
+	if (cfg -> recv_task.prio == 0){
+		cfg -> recv_task.prio = WS_RECV_PRIO;
+	}
+	if (cfg -> send_task.stack == 0){
+		cfg -> send_task.stack = WS_SEND_STACK;
+	}
+	if (cfg -> send_task.prio == 0){
+		cfg -> send_task.prio = WS_SEND_PRIO;
+	}
+	if (cfg -> deflate_server_bits == 0){
+		cfg -> deflate_server_bits = WS_DEFLATE_MAX_BITS;
+	}
+	cfg -> deflate_server_bits = MAX(MIN(cfg -> deflate_server_bits,
+			WS_DEFLATE_MAX_BITS), WS_DEFLATE_MIN_BITS);
+	if (cfg -> deflate_client_bits != 0){
+		cfg -> deflate_client_bits = MAX(MIN(cfg -> deflate_client_bits,
+				WS_DEFLATE_MAX_BITS), WS_DEFLATE_MIN_BITS);
+	}
+	if (cfg -> deflate_min_len == 0){
+		cfg -> deflate_min_len = WS_DEFLATE_MIN_LEN;
+	}
+	if (cfg -> ping_max_missed == 0){
+		cfg -> ping_max_missed = WS_PING_MAX_MISSED;
+	}
+	if (cfg -> handshake_timeout_ms == 0){
+		cfg -> handshake_timeout_ms = WS_HS_TIMEOUT_MS;
+	}
+	if (cfg -> close_timeout_ms == 0){
+		cfg -> close_timeout_ms = CLOSE_TIMEOUT_MS;
+	}
+	cfg -> shards = MAX(MIN(MIN(cfg -> shards, WS_SHARD_MAX), cfg -> max_clients), 1);
+	for (int n = 0; n < cfg -> shards; n++){
+		if (cfg -> shard_core[n] == 0){
+			//shard 0 on APP core, away from Wi-Fi and lwIP on PRO core
+			cfg -> shard_core[n] = WS_CORE((n + 1) % portNUM_PROCESSORS);
+		}
+	}
+}
+
+// ***************************************************************************
+//create task with configured stack, priority and core, tasks of shard n
+//(-1 none) run on the core of the shard if connections are sharded
+static BaseType_t ws_task_create(TaskFunction_t fn, const char *name,
+		const ws_task_cfg_t *t, int8_t n, void *arg, xTaskHandle *handle){
+	BaseType_t core;
+	uint8_t c;
+
+	c = ((n >= 0) && (ws_shard_nr > 1)) ? ws_cfg.shard_core[n] : t -> core;
+	core = (c == WS_CORE_ANY) ? tskNO_AFFINITY : c - 1;
+	return xTaskCreatePinnedToCore(fn, name, t -> stack, arg, t -> prio,
+			handle, core);
+}
+
+// ***************************************************************************
+//release what ws_server_init created (also after a failed init), server
+//tasks must be gone; pools and the input queue stay, the application may
+//still hold their items
+static void ws_server_free(void){
+	for (int n = 0; n < WS_SHARD_MAX; n++){
+		if (shards[n].queue != NULL){
+			vQueueDelete(shards[n].queue);
+		}
+		if (shards[n].mutex != NULL){
+			vSemaphoreDelete(shards[n].mutex);
+		}
+		free(shards[n].deflater);
+	}
+	memset(shards, 0, sizeof(shards));
+	if (ws_list != NULL){
+		for (int i = 0; i < ws_max_nr; i++){
+			free(ws_list[i].txq);
+			free(ws_list[i].cb.payload);
+		}
+		free(ws_list);
+		ws_list = NULL;
+	}
+	if (xServerMutex != NULL){
+		vSemaphoreDelete(xServerMutex);
+		xServerMutex = NULL;
+	}
+	if (ws_stop_sem != NULL){
+		vSemaphoreDelete(ws_stop_sem);
+		ws_stop_sem = NULL;
+	}
+}
+
+// ***************************************************************************
+//initialize WebSocket server
+int8_t ws_server_init(void *param){
+	ws_queue_item_t *item_ptr;
+
+	if (server_is_running != 0){
+		return -1;
+	}
+	//caller's configuration may be a local variable
+	ws_cfg = *(ws_server_cfg_t *)param;
+	ws_cfg_defaults(&ws_cfg);
+	ws_max_nr = ws_cfg.max_clients;
+	ws_shard_nr = ws_cfg.shards;
+	ws_stopping = 0;
+	memset(&ws_stats, 0, sizeof(ws_stats));
+	ws_start_tick = xTaskGetTickCount();
+	if (ws_pools_init(ws_cfg.item_pool_nr, ws_cfg.buf_pool) != 0){
+		return -1;
+	}
+	memset(shards, 0, sizeof(shards));
+	for (int n = 0; n < ws_shard_nr; n++){
+		shards[n].n = n;
+		shards[n].mutex = xSemaphoreCreateMutex();
+		shards[n].queue = xQueueCreate(ws_cfg.out_queue_len, sizeof(item_ptr));
+		if ((shards[n].mutex == NULL) || (shards[n].queue == NULL)){
+			goto fail;
+		}
+		if (ws_cfg.deflate != 0){
+			shards[n].deflater = malloc(sizeof(ws_deflate_t));
+			if (shards[n].deflater == NULL){
+				goto fail;
+			}
+		}
+	}
+	printf("OUT queue created, shards: %u\n", ws_shard_nr);
+	xServerMutex = xSemaphoreCreateMutex();
+	//every server task gives it when it exits
+	ws_stop_sem = xSemaphoreCreateCounting(2 * WS_SHARD_MAX, 0);
+	if ((xServerMutex == NULL) || (ws_stop_sem == NULL)){
+		goto fail;
+	}
+	ws_wheel_init(&wheel, ws_deadline);
+	//initialize ws_list
+	ws_list = calloc(ws_max_nr, sizeof(struct ws_list_item));
+	if (ws_list == NULL){
+		goto fail;
+	}
+	for (int i = 0; i < ws_max_nr; i++){
+		ws_list[i].netconn_ptr = NULL;
+		ws_list[i].sock = -1;
+		ws_list[i].index = i;
+		for (int k = 0; k < WS_DL_NR; k++){
+			ws_tm_init(&ws_list[i].dl[k], i, k);
+		}
+		ws_list[i].run = WS_STOP;
+		ws_list[i].ws_state = WS_CLOSED;
+		ws_list[i].txq = malloc((ws_cfg.tx_queue_len + WS_TX_CTRL_RESERVE) *
+				sizeof(ws_frame_t *));
+		ws_list[i].tx_head = 0;
+		ws_list[i].tx_nr = 0;
+		ws_list[i].tx_off = 0;
+		ws_list[i].tx_bytes = 0;
+		memset(&ws_list[i].cb, 0, sizeof(ws_frame_t));
+		ws_list[i].cb.refs = 1;
+		ws_list[i].cb.keep = 1;
+		if (ws_cfg.tx_coalesce_len > 0){
+			ws_list[i].cb.payload = malloc(ws_cfg.tx_coalesce_len);
+			if (ws_list[i].cb.payload == NULL){
+				goto fail;
+			}
+		}
+		if (ws_list[i].txq == NULL){
+			goto fail;
+		}
+	}
+	//input (receiving) queue is created once, the application reads it
+	if (ws_input_queue == NULL){
+		ws_input_queue = xQueueCreate(ws_cfg.in_queue_len, sizeof(item_ptr));
+		if (ws_input_queue == NULL){
+			goto fail;
+		}
+		printf("IN queue created\n");
+	}
+	//start server task
+	vTaskDelay(1000 / portTICK_PERIOD_MS);
+	if (ws_cfg.engine == WS_ENGINE_SELECT){
+		//select task of every shard, the first one accepts
+		for (int n = 0; n < ws_shard_nr; n++){
+			ws_task_create(ws_select_task, "ws_select_task",
+					&ws_cfg.server_task, n, &shards[n], &shards[n].select_task);
+		}
+	}
+	else{
+		ws_task_create(server_task, "ws_server_task", &ws_cfg.server_task,
+				-1, &ws_cfg, &server_task_handle);
+	}
+	printf("server task created\n");
+	//send task of every shard
+	for (int n = 0; n < ws_shard_nr; n++){
+		ws_task_create(ws_send_task, "ws_send_task", &ws_cfg.send_task, n,
+				&shards[n], NULL);
+	}
+	if (ws_cfg.ping_period_ms > 0){
+		ws_tm_init(&hb_tm, -1, WS_DL_PING);
+		ws_wheel_arm(&wheel, &hb_tm, ws_cfg.ping_period_ms);
+	}
+	wheel_timer = xTimerCreate("ws_wheel", pdMS_TO_TICKS(WS_WHEEL_TICK_MS),
+			pdTRUE, NULL, ws_wheel_callback);
+	if (wheel_timer != NULL){
+		xTimerStart(wheel_timer, 0);
+	}
+	server_is_running = 1;
+	return 1;
+
+fail:
+	printf("ws server not created, no heap memory\n");
+	ws_server_free();
+	return -1;
+}
+
+// ****************************************************************************
+//broadcast for more shards: frame is encoded once by the caller (or it is
+//prepared) and every shard gets an item referencing it, pdFALSE if no
+//shard takes it (item is left to the caller), a shard whose queue stays
+//full misses the message
+static BaseType_t ws_out_broadcast(ws_queue_item_t *item, TickType_t wait){
+	ws_queue_item_t *copy;
+	ws_frame_t *frame = item -> frame;
+	uint8_t sent = 0, prepared = (item -> frame != NULL);
+
+	if ((item -> flush == 0) && (prepared == 0)){
+		//payload is borrowed until it is known that some shard has it
+		frame = ws_item_frame(item, 1);
+		if (frame == NULL){
+			return pdFALSE;
+		}
+	}
+	for (int n = 0; n < ws_shard_nr; n++){
+		copy = ws_item_alloc();
+		if (copy == NULL){
+			continue;
+		}
+		*copy = *item;
+		copy -> keep = 0x1;
+		copy -> frame = (frame != NULL) ? ws_frame_ref(frame) : NULL;
+		if (xQueueSend(shards[n].queue, &copy, wait) == pdTRUE){
+			sent++;
+		}
+		else{
+			ws_frame_unref(copy -> frame);
+			ws_item_free(copy);
+		}
+	}
+	if (sent == 0){
+		if ((frame != NULL) && (prepared == 0)){
+			//not sent, not completed
+			frame -> done = NULL;
+			ws_frame_unref(frame);
+		}
+		return pdFALSE;
+	}
+	if ((frame != NULL) && (prepared == 0)){
+		//the last reference releases payload (caller's ref keeps it so far)
+		frame -> keep = (item -> vec != NULL) ? 0 : item -> keep;
+		item -> payload = NULL;
+	}
+	//reference of the item or of the caller
+	ws_frame_unref(frame);
+	ws_item_free(item);
+	return pdTRUE;
+}
+
+// ****************************************************************************
+//queue item for the shard of its connection, broadcast for all shards
+static BaseType_t ws_out_send(ws_queue_item_t *item, TickType_t wait){
+	if (server_is_running != 1){
+		//not started or being stopped
+		return pdFALSE;
+	}
+	if ((item -> index != -1) || (ws_shard_nr == 1)){
+		return xQueueSend(WS_SHARD(item -> index) -> queue, &item, wait);
+	}
+	return ws_out_broadcast(item, wait);
+}
+
+// ****************************************************************************
+//items are often allocated without clearing, only the payload fields are
+//taken from the caller
+static int8_t ws_send_item(ws_queue_item_t *item, uint8_t more, uint16_t key,
+		int32_t wait_ms){
+	item -> vec = NULL;
+	item -> vec_nr = 0;
+	item -> more = more;
+	item -> keep = 0;
+	item -> flush = 0;
+	item -> plain = 0;
+	item -> key = key;
+	item -> topic = 0;
+	item -> done = NULL;
+	item -> frame = NULL;
+	WS_LAT_STAMP(item -> t_us);
+	return ws_out_send(item, wait_ms / portTICK_RATE_MS);
+}
+
+// ****************************************************************************
+//send data via websocket
+int8_t ws_send(ws_queue_item_t *item, int32_t wait_ms){
+	return ws_send_item(item, 0, 0, wait_ms);
+}
+
+// ****************************************************************************
+//send message which replaces a queued message with the same key (latest
+//value, see conflation), key 0 - as ws_send
+int8_t ws_send_key(ws_queue_item_t *item, uint16_t key, int32_t wait_ms){
+	return ws_send_item(item, 0, key, wait_ms);
+}
+
+// ****************************************************************************
+//send one fragment of a message, the first one has opcode WS_OP_TXT or
+//WS_OP_BIN, next ones WS_OP_CON, last is 1 for the final fragment
+int8_t ws_send_fragment(ws_queue_item_t *item, uint8_t last, int32_t wait_ms){
+	return ws_send_item(item, (last == 0) ? 0x1 : 0x0, 0, wait_ms);
+}
+
+// ****************************************************************************
+//send message made of payload blocks as one frame (header and blocks are
+//written as vectors), array and blocks are freed by the server when queued
+int8_t ws_send_vec(int8_t index, WS_OPCODES opcode, ws_vec_t *vec,
+		uint16_t vec_nr, int32_t wait_ms){
+	ws_queue_item_t *item;
+
+	item = ws_item_alloc();
+	if (item == NULL){
+		return 0;
+	}
+	item -> index = index;
+	item -> opcode = opcode;
+	item -> ws_frame = 0x1;
+	item -> vec = vec;
+	item -> vec_nr = vec_nr;
+	if (ws_out_send(item, wait_ms / portTICK_RATE_MS) != pdTRUE){
+		ws_item_free(item);
+		return 0;
+	}
+	return 1;
+}
+
+// ****************************************************************************
+//send caller's buffer without copying it, the server does not free it, so
+//it must not change until it is written (constant data)
+int8_t ws_send_buf(int8_t index, WS_OPCODES opcode, const uint8_t *data,
+		uint32_t len, int32_t wait_ms){
+	return ws_send_to(index, data, len, opcode, 0, NULL, NULL, wait_ms);
+}
+
+// ****************************************************************************
+//send caller's buffer (static, const or owned by the caller) to index (-1
+//all open connections) without copying it, on_complete (may be NULL) is
+//called with ctx and the number of connections the message was written to
+//when no connection needs the buffer any more (written, dropped or
+//connection closed); flags: WS_SEND_MORE, WS_SEND_PLAIN; returns 1 or 0
+//if the message can not be queued (on_complete is not called then)
+int8_t ws_send_to(int8_t index, const uint8_t *buf, uint32_t len,
+		WS_OPCODES opcode, uint8_t flags, ws_send_done_t on_complete, void *ctx,
+		int32_t wait_ms){
+	ws_queue_item_t *item;
+
+	item = ws_item_alloc();
+	if (item == NULL){
+		return 0;
+	}
+	item -> payload = (uint8_t *)buf;
+	item -> len = len;
+	item -> index = index;
+	item -> opcode = opcode;
+	item -> ws_frame = 0x1;
+	item -> keep = 0x1;
+	item -> more = (flags & WS_SEND_MORE) ? 0x1 : 0x0;
+	item -> plain = (flags & WS_SEND_PLAIN) ? 0x1 : 0x0;
+	item -> done = on_complete;
+	item -> done_ctx = ctx;
+	if (ws_out_send(item, wait_ms / portTICK_RATE_MS) != pdTRUE){
+		ws_item_free(item);
+		return 0;
+	}
+	return 1;
+}
+
+// ****************************************************************************
+typedef struct ws_send_sync{
+	xSemaphoreHandle done;
+	uint8_t sent;
+} ws_send_sync_t;
+
+static void ws_send_sync_done(void *ctx, uint8_t sent){
+	ws_send_sync_t *sync = (ws_send_sync_t *)ctx;
+
+	sync -> sent = sent;
+	xSemaphoreGive(sync -> done);
+}
+
+// ****************************************************************************
+//ws_send_to() which waits until the message is written to (or dropped by)
+//all its connections, wait_ms limits only queueing; returns the number of
+//connections the message was written to or -1 if it was not queued; must
+//not be called by the server tasks (receive callback)
+int16_t ws_send_to_sync(int8_t index, const uint8_t *buf, uint32_t len,
+		WS_OPCODES opcode, uint8_t flags, int32_t wait_ms){
+	ws_send_sync_t sync;
+
+	sync.done = xSemaphoreCreateBinary();
+	if (sync.done == NULL){
+		return -1;
+	}
+	if (ws_send_to(index, buf, len, opcode, flags, ws_send_sync_done, &sync,
+			wait_ms) != 1){
+		vSemaphoreDelete(sync.done);
+		return -1;
+	}
+	xSemaphoreTake(sync.done, portMAX_DELAY);
+	vSemaphoreDelete(sync.done);
+	return sync.sent;
+}
+
+// ****************************************************************************
+//write frames combined for index (-1 all connections) now, without waiting
+//for tx_coalesce_us, returns 1 or 0 if the request can not be queued
+int8_t ws_flush(int8_t index, int32_t wait_ms){
+	ws_queue_item_t *item;
+
+	item = ws_item_alloc();
+	if (item == NULL){
+		return 0;
+	}
+	item -> index = index;
+	item -> flush = 0x1;
+	if (ws_out_send(item, wait_ms / portTICK_RATE_MS) != pdTRUE){
+		ws_item_free(item);
+		return 0;
+	}
+	return 1;
+}
+
+// ****************************************************************************
+//queue prepared frame for index (-1 all, topic 0 any) without encoding or
+//copying it, the caller keeps its reference
+static int8_t ws_frame_send(int8_t index, uint8_t topic, ws_frame_t *frame,
+		int32_t wait_ms){
+	ws_queue_item_t *item;
+
+	item = ws_item_alloc();
+	if (item == NULL){
+		return 0;
+	}
+	item -> index = index;
+	item -> topic = topic;
+	item -> opcode = frame -> head[0] & 0x0F;
+	item -> ws_frame = 0x1;
+	item -> more = (frame -> head[0] & 0x80) ? 0x0 : 0x1;
+	item -> keep = 0x1;
+	item -> plain = 0x1;
+	item -> len = frame -> len;
+	item -> frame = ws_frame_ref(frame);
+	if (ws_out_send(item, wait_ms / portTICK_RATE_MS) != pdTRUE){
+		ws_frame_unref(item -> frame);
+		ws_item_free(item);
+		return 0;
+	}
+	return 1;
+}
+
+// ****************************************************************************
+//send frame made by ws_frame_prepare() to index (-1 all open connections),
+//it is not compressed; returns 1 or 0 if it can not be queued
+int8_t ws_send_frame(int8_t index, ws_frame_t *frame, int32_t wait_ms){
+	return ws_frame_send(index, 0, frame, wait_ms);
+}
+
+// ****************************************************************************
+//send prepared frame to the subscribers of topic, nothing is queued if the
+//topic has no subscribers; returns 1 or 0 if it can not be queued
+int8_t ws_publish_frame(int8_t topic, ws_frame_t *frame, int32_t wait_ms){
+	if ((topic < 1) || (topic > WS_TOPIC_MAX)){
+		return 0;
+	}
+	if (topic_subs[topic - 1] == 0){
+		return 1;
+	}
+	return ws_frame_send(-1, topic, frame, wait_ms);
+}
+
+// ****************************************************************************
+//subscribe (on = 1) or unsubscribe (on = 0) open connection index to topic,
+//returns 1 or -1 if the connection is not open
+int8_t ws_subscribe(int8_t index, int8_t topic, uint8_t on){
+	struct ws_list_item *ws;
+	uint32_t bit;
+	int8_t ret = -1;
+
+	if ((server_is_running == 0) || (index < 0) || (index >= ws_max_nr) ||
+			(topic < 1) || (topic > WS_TOPIC_MAX)){
+		return -1;
+	}
+	ws = &ws_list[index];
+	bit = WS_TOPIC_BIT(topic);
+	xSemaphoreTake(WS_SHARD(index) -> mutex, portMAX_DELAY);
+	if ((ws -> ws_state == WS_OPEN) && ws_slot_used(index)){
+		if ((on == 1) && ((ws -> topics & bit) == 0)){
+			ws -> topics |= bit;
+			__atomic_add_fetch(&topic_subs[topic - 1], 1, __ATOMIC_RELAXED);
+		}
+		else if ((on == 0) && ((ws -> topics & bit) != 0)){
+			ws -> topics &= ~bit;
+			__atomic_sub_fetch(&topic_subs[topic - 1], 1, __ATOMIC_RELAXED);
+		}
+		ret = 1;
+	}
+	xSemaphoreGive(WS_SHARD(index) -> mutex);
+	return ret;
+}
+
+// ****************************************************************************
+//send copy of data to the subscribers of topic, nothing is queued if the
+//topic has no subscribers; returns 1 or 0 if it can not be queued
+int8_t ws_publish(int8_t topic, WS_OPCODES opcode, const uint8_t *data,
+		uint32_t len, int32_t wait_ms){
+	ws_queue_item_t *item;
+	uint8_t *buf;
+
+	if ((topic < 1) || (topic > WS_TOPIC_MAX)){
+		return 0;
+	}
+	if (topic_subs[topic - 1] == 0){
+		return 1;
+	}
+	buf = ws_buf_alloc(len + 1);
+	if (buf == NULL){
+		return 0;
+	}
+	item = ws_item_alloc();
+	if (item == NULL){
+		ws_buf_free(buf);
+		return 0;
+	}
+	memcpy(buf, data, len);
+	item -> payload = buf;
+	item -> len = len;
+	item -> index = -1;
+	item -> topic = topic;
+	item -> opcode = opcode;
+	item -> ws_frame = 0x1;
+	if (ws_out_send(item, wait_ms / portTICK_RATE_MS) != pdTRUE){
+		ws_item_free(item);
+		return 0;
+	}
+	return 1;
+}
+
+// ****************************************************************************
+//number of connections in ws_list
+static uint8_t ws_slots_used(void){
+	uint8_t nr = 0;
+
+	for (int i = 0; i < ws_max_nr; i++){
+		nr += ws_slot_used(i) ? 1 : 0;
+	}
+	return nr;
+}
+
+// ****************************************************************************
+//wait up to ms for all connections to be released, returns 1 if they were
+static uint8_t ws_slots_wait(uint32_t ms){
+	for (uint32_t t = 0; ws_slots_used() > 0; t += WS_TX_RETRY_MS){
+		if (t >= ms){
+			return 0;
+		}
+		vTaskDelay(pdMS_TO_TICKS(WS_TX_RETRY_MS));
+	}
+	return 1;
+}
+
+// ****************************************************************************
+//stop the server: no new clients, open connections get close 1001 and
+//close_timeout_ms for the answer, the rest is dropped; then the server tasks
+//exit and everything created by ws_server_init is released (pools and the
+//input queue stay); must not be called from a server task or a callback,
+//returns -1 if the server does not run or its tasks did not exit
 int8_t ws_server_stop(){
+	ws_queue_item_t *item = NULL;
+	uint8_t tasks;
 
-	//close server connection
-	netconn_close(server_conn);
-	vTaskDelete(server_task_handle);
+	if (server_is_running != 1){
+		return -1;
+	}
+	//ws_send*() fail from here
+	server_is_running = 2;
+	//the accepting task closes the listener
+	WS_SET(ws_stopping, 1);
+	for (int i = 0; i < ws_max_nr; i++){
+		xSemaphoreTake(WS_SHARD(i) -> mutex, portMAX_DELAY);
+		if (ws_slot_used(i) && (ws_list[i].ws_state == WS_OPEN)){
+			xSemaphoreGive(WS_SHARD(i) -> mutex);
+			ws_close_send(1001, i, pdMS_TO_TICKS(WS_TX_RETRY_MS));
+		}
+		else{
+			xSemaphoreGive(WS_SHARD(i) -> mutex);
+		}
+	}
+	if (ws_slots_wait(ws_cfg.close_timeout_ms) == 0){
+		for (int i = 0; i < ws_max_nr; i++){
+			xSemaphoreTake(WS_SHARD(i) -> mutex, portMAX_DELAY);
+			if (ws_slot_used(i)){
+				ws_disconnect(i, "server stopped");
+			}
+			xSemaphoreGive(WS_SHARD(i) -> mutex);
+		}
+	}
+	if (ws_slots_wait(WS_STOP_WAIT_MS) == 0){
+		printf("ws server stop, connections not released\n");
+		return -1;
+	}
+	//select tasks exit in their next pass, send tasks after the last item
+	WS_SET(ws_stopping, 2);
+	for (int n = 0; n < ws_shard_nr; n++){
+		xQueueSend(shards[n].queue, &item, portMAX_DELAY);
+	}
+	tasks = ws_shard_nr + ((ws_cfg.engine == WS_ENGINE_SELECT) ? ws_shard_nr : 1);
+	for (int k = 0; k < tasks; k++){
+		if (xSemaphoreTake(ws_stop_sem, pdMS_TO_TICKS(WS_STOP_WAIT_MS)) != pdTRUE){
+			printf("ws server stop, tasks not finished\n");
+			return -1;
+		}
+	}
+	//the timer task may be running the wheel callback
+	if (wheel_timer != NULL){
+		xTimerStop(wheel_timer, 0);
+		xTimerDelete(wheel_timer, 0);
+		wheel_timer = NULL;
+		vTaskDelay(pdMS_TO_TICKS(2 * WS_WHEEL_TICK_MS));
+	}
+	//items queued by the timer after the last one go to no connection
+	for (int n = 0; n < ws_shard_nr; n++){
+		while (xQueueReceive(shards[n].queue, &item, 0) == pdTRUE){
+			if (item != NULL){
+				ws_queue_frame(&shards[n], item);
+			}
+		}
+	}
 	server_is_running = 0;
-
-	//TODO: close all connection and stop all websocket tasks
+	ws_server_free();
+	printf("ws server stopped\n");
 	return 1;
 }
 
@@ -674,52 +2493,285 @@ void server_task(void* arg){
 	cfg = (ws_server_cfg_t *)arg;
 	port = cfg -> port;
 
-	//set up new TCP listener
+	//set up new TCP listener, accept returns now and then to check for
+	//ws_server_stop
 	server_conn = netconn_new(NETCONN_TCP);
 	netconn_bind(server_conn, NULL, port);
 	netconn_listen(server_conn);
+	netconn_set_recvtimeout(server_conn, WS_ACCEPT_TIMEOUT_MS);
 	printf("WebSocket server in listening mode\n");
 	vTaskDelay(1000 / portTICK_PERIOD_MS);
 
-	for (;;){
+	while (WS_GET(ws_stopping) == 0){
 		if (netconn_accept(server_conn, &newconn) == ERR_OK){
+			//small frames go out at once, not after the ACK of the previous one
+			tcp_nagle_disable(newconn -> pcb.tcp);
 			//check if there is place for next client
 			xSemaphoreTake(xServerMutex, portMAX_DELAY);
-			index = -1;
+			WS_STAT_INC(ws_stats.accepts);
 			printf("new client connected\n");
-			for (int i = 0; i < MAX_OPEN_WS_NR; i++){
-				if (ws_list[i].netconn_ptr == NULL){
-					index = i;
-					break;
-				}
-			}
+			index = ws_slot_find();
 			if (index > -1){
 				printf("client will be served, index: %i\n", index);
-				ws_list[index].netconn_ptr = newconn;
-				ws_list[index].ws_state = WS_CLOSED;
-				ws_list[index].ws_timer = NULL;
-				ws_list[index].index = index;
-				ws_list[index].pings = 0;
-				ws_list[index].pongs = 0;
-				ws_list[index].run = WS_RUN;
+				ws_slot_init(index);
+				WS_SET(ws_list[index].netconn_ptr, newconn);
 
-				xTaskCreate(ws_receive_task, "ws_task", 1024*2, &index, 3,
-						&ws_list[index].ws_task_handl);
+				ws_task_create(ws_receive_task, "ws_task", &cfg -> recv_task,
+						index % ws_shard_nr, &index, &ws_list[index].ws_task_handl);
 			}
 			else{
 				//too much clients, send error info and close connection
 				//TODO: there was no http request, is it correct to send data now?
 				xSemaphoreGive(xServerMutex);
+				WS_STAT_INC(ws_stats.busy);
 				printf("no space for new clients\n");
 				netconn_write(newconn, error_busy_page, sizeof(error_busy_page), NETCONN_COPY);
 				netconn_close(newconn);
+				netconn_delete(newconn);
 			}
 		}
 	}
+	netconn_close(server_conn);
+	netconn_delete(server_conn);
+	server_conn = NULL;
+	xSemaphoreGive(ws_stop_sem);
+	vTaskDelete(NULL);
+}
+
+// ****************************************************************************
+//accept new client on the listening socket (select engine), returns -1
+//if there is no waiting connection
+static int8_t ws_select_accept(int listen_sock){
+	int sock, n = 1;
+	int8_t index = -1;
+
+	sock = lwip_accept(listen_sock, NULL, NULL);
+	if (sock < 0){
+		return -1;
+	}
+	lwip_setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &n, sizeof(n));
+	WS_STAT_INC(ws_stats.accepts);
+	printf("new client connected\n");
+	index = ws_slot_find();
+	if (index < 0){
+		//too much clients, send error info and close connection
+		WS_STAT_INC(ws_stats.busy);
+		printf("no space for new clients\n");
+		lwip_send(sock, error_busy_page, sizeof(error_busy_page), 0);
+		lwip_close(sock);
+		return 0;
+	}
+	printf("client will be served, index: %i\n", index);
+	lwip_fcntl(sock, F_SETFL, O_NONBLOCK);
+	ws_slot_init(index);
+	//select task of the shard takes the socket in its next pass
+	xSemaphoreTake(WS_SHARD(index) -> mutex, portMAX_DELAY);
+	WS_SET(ws_list[index].sock, sock);
+	xSemaphoreGive(WS_SHARD(index) -> mutex);
+	return 0;
 }
 
+// ****************************************************************************
+//non-blocking listening socket of the select engine, -1 on error
+static int ws_select_listen(uint16_t port){
+	struct sockaddr_in addr;
+	int listen_sock, n = 1;
+
+	listen_sock = lwip_socket(AF_INET, SOCK_STREAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	lwip_setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &n, sizeof(n));
+	if ((lwip_bind(listen_sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) ||
+			(lwip_listen(listen_sock, ws_max_nr) != 0)){
+		printf("WebSocket server, socket can't listen\n");
+		lwip_close(listen_sock);
+		return -1;
+	}
+	lwip_fcntl(listen_sock, F_SETFL, O_NONBLOCK);
+	return listen_sock;
+}
+
+// ****************************************************************************
+//server with one task for all connections of a shard: lwIP select on
+//non-blocking sockets, connection state is kept only in ws_list, frames
+//are written by the send task of the shard; the task of the first shard
+//accepts new clients for all shards
+static void ws_select_task(void* arg){
+	ws_shard_t *s = (ws_shard_t *)arg;
+	uint8_t *rq;
+	struct timeval tv;
+	fd_set rset;
+	int listen_sock = -1, max_sock, sock, n;
+
+	rq = malloc(WS_SELECT_RECV_LEN + 1);
+	if (s -> n == 0){
+		listen_sock = ws_select_listen(ws_cfg.port);
+	}
+	if ((rq == NULL) || ((s -> n == 0) && (listen_sock < 0))){
+		printf("select task not started, shard = %u\n", s -> n);
+		free(rq);
+		vTaskDelete(NULL);
+		return;
+	}
+	if (listen_sock >= 0){
+		printf("WebSocket server in listening mode (select)\n");
+	}
+
+	for (;;){
+		if ((WS_GET(ws_stopping) > 0) && (listen_sock >= 0)){
+			//ws_server_stop, no new clients
+			lwip_close(listen_sock);
+			listen_sock = -1;
+		}
+		if (WS_GET(ws_stopping) > 1){
+			//all connections are released
+			free(rq);
+			xSemaphoreGive(ws_stop_sem);
+			vTaskDelete(NULL);
+			return;
+		}
+		FD_ZERO(&rset);
+		if (listen_sock >= 0){
+			FD_SET(listen_sock, &rset);
+		}
+		max_sock = listen_sock;
+		for (int i = s -> n; i < ws_max_nr; i += ws_shard_nr){
+			sock = WS_GET(ws_list[i].sock);
+			if (sock < 0){
+				continue;
+			}
+			if (WS_GET(ws_list[i].run) == WS_STOP){
+				//closed by protocol, timer or slow consumer policy
+				lwip_shutdown(sock, SHUT_RDWR);
+				ws_conn_release(i);
+				continue;
+			}
+			FD_SET(sock, &rset);
+			max_sock = MAX(max_sock, sock);
+		}
+		//timeout lets connections stopped by other tasks be released
+		tv.tv_sec = 0;
+		tv.tv_usec = WS_SELECT_TIMEOUT_MS * 1000;
+		n = lwip_select(max_sock + 1, &rset, NULL, NULL, &tv);
+		if (n <= 0){
+			continue;
+		}
+
+		for (int i = s -> n; i < ws_max_nr; i += ws_shard_nr){
+			sock = WS_GET(ws_list[i].sock);
+			if ((sock < 0) || !FD_ISSET(sock, &rset)){
+				continue;
+			}
+			n = lwip_recv(sock, rq, WS_SELECT_RECV_LEN, 0);
+			if (n > 0){
+				rq[n] = 0;
+				ws_receive_data(i, rq, n);
+			}
+			else if ((n == 0) || (errno != EWOULDBLOCK)){
+				printf("TCP was closed by client, index: %i\n", i);
+				ws_conn_release(i);
+			}
+		}
+		if ((listen_sock >= 0) && FD_ISSET(listen_sock, &rset)){
+			while (ws_select_accept(listen_sock) == 0);
+		}
+	}
+}
+
+// ****************************************************************************
+//copy server counters to st and counters of open connections to conn (max
+//places, conn may be NULL), returns number of connections copied; all shard
+//mutexes are held, so no connection is folded into the totals meanwhile
+//(it would be counted twice or not at all) and send counters are not
+//being written
+uint8_t ws_get_stats(ws_server_stats_t *st, ws_conn_stats_t *conn,
+		uint8_t max){
+	struct ws_list_item *ws;
+	ws_conn_stats_t *c;
+	uint8_t nr = 0;
+
+	if (server_is_running == 0){
+		memset(st, 0, sizeof(ws_server_stats_t));
+		return 0;
+	}
+	for (int n = 0; n < ws_shard_nr; n++){
+		xSemaphoreTake(shards[n].mutex, portMAX_DELAY);
+	}
+	*st = ws_stats;
+	for (int i = 0; i < ws_max_nr; i++){
+		ws = &ws_list[i];
+		if (ws_slot_used(i) == 0){
+			continue;
+		}
+		st -> frames_in += ws -> st.frames_in;
+		st -> msgs_in += ws -> st.msgs_in;
+		st -> bytes_in += WS_STAT_GET(ws -> st.bytes_in);
+		st -> frames_out += ws -> st.frames_out;
+		st -> bytes_out += ws -> st.bytes_out;
+		st -> writes += ws -> st.writes;
+		st -> drops += ws -> st.drops;
+		st -> conflated += ws -> st.conflated;
+		st -> write_errors += ws -> st.write_errors;
+		st -> open += (ws -> ws_state == WS_OPEN) ? 1 : 0;
+		if ((conn == NULL) || (nr == max)){
+			continue;
+		}
+		c = &conn[nr++];
+		*c = ws -> st;
+		c -> bytes_in = WS_STAT_GET(ws -> st.bytes_in);
+		c -> index = i;
+		c -> state = ws -> ws_state;
+		c -> deflate = ws -> pmd;
+		c -> tx_queued = ws -> tx_nr;
+	}
+	for (int n = ws_shard_nr - 1; n >= 0; n--){
+		xSemaphoreGive(shards[n].mutex);
+	}
+	st -> uptime_s = (xTaskGetTickCount() - ws_start_tick) / configTICK_RATE_HZ;
+	st -> out_queue = 0;
+	for (int n = 0; n < ws_shard_nr; n++){
+		st -> out_queue += uxQueueMessagesWaiting(shards[n].queue);
+	}
+	st -> in_queue = uxQueueMessagesWaiting(ws_input_queue);
+	st -> heap_free = esp_get_free_heap_size();
+	st -> heap_min_free = esp_get_minimum_free_heap_size();
+	return nr;
+}
+
+// ****************************************************************************
+//smoothed round trip time of the connection's heartbeat pings in us, 0 if
+//not measured (heartbeat off, no pong yet or no connection)
+uint32_t ws_get_rtt(int8_t index){
+	if ((index < 0) || (index >= ws_max_nr) || (ws_slot_used(index) == 0)){
+		return 0;
+	}
+	return ws_list[index].st.rtt_us;
+}
+
+// ****************************************************************************
+//number of places for connections
+uint8_t ws_get_max_clients(void){
+	return ws_max_nr;
+}
 
 // ****************************************************************************
 xQueueHandle ws_get_recv_queue(){
 	return ws_input_queue;
 }
+
+// ****************************************************************************
+//take received message from the input queue (same as xQueueReceive on
+//ws_get_recv_queue(), the time spent in the queue is measured)
+int8_t ws_recv(ws_queue_item_t **item, int32_t wait_ms){
+	TickType_t wait;
+
+	wait = (wait_ms < 0) ? portMAX_DELAY :
+			(TickType_t)(wait_ms / portTICK_RATE_MS);
+	if (xQueueReceive(ws_input_queue, item, wait) != pdTRUE){
+		return pdFALSE;
+	}
+	WS_LAT_SINCE(WS_LAT_IN_QUEUE, (*item) -> t_us);
+	return pdTRUE;
+}
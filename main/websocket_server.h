@@ -10,6 +10,12 @@
 
 #include "lwip/api.h"
 
+#include "ws_frame.h"
+#include "ws_pool.h"
+#include "ws_stats.h"
+#include "ws_latency.h"
+#include "ws_topic.h"
+
 typedef void *ws_handler_t;
 
 /** \brief Opcode according to RFC 6455*/
@@ -49,29 +55,166 @@ typedef enum {
 	WS_RUN = 0x1
 } WS_RUNING;
 
+//receiving of fragmented messages
+typedef enum {
+	WS_RX_REASSEMBLE = 0x0,	//fragments are collected, message is passed whole
+	WS_RX_STREAM = 0x1		//every fragment is passed on when it ends
+} WS_RX_MODE;
+
+//connection handling
+typedef enum {
+	WS_ENGINE_TASKS = 0x0,	//netconn API, one receive task per connection
+	WS_ENGINE_SELECT = 0x1	//lwIP sockets, one task serves all connections
+} WS_ENGINE;
+
+//what to do with frames for a client whose queue is full
+typedef enum {
+	WS_TX_DROP_OLDEST = 0x0,	//oldest queued message is dropped
+	WS_TX_DROP_NEWEST = 0x1,	//new message is dropped
+	WS_TX_DISCONNECT = 0x2		//connection is closed
+} WS_TX_POLICY;
+
+//messages longer than max_msg_len are received in parts (first/last), every
+//part is at most max_msg_len bytes long
 typedef struct{
 	uint8_t *payload;
-	uint16_t len;
+	uint32_t len;
 	int8_t index;
 	WS_OPCODES opcode:4;
 	uint8_t ws_frame:1; //ws - 1, non ws - 0
 	uint8_t text:1; //1 - text frame, 0 - binary frame
+	uint8_t first:1; //received: first part of the message
+	uint8_t last:1; //received: last part of the message
+	uint8_t more:1; //send: fragment, next fragments follow (WS_OP_CON)
+	uint8_t keep:1; //payload is owned by the caller, it is not freed
+	uint8_t flush:1; //server: no data, combined frames of index are written
+					//(set by ws_flush, cleared by ws_send)
+	uint8_t plain:1; //send: message is not compressed
+	uint64_t msg_len; //received: length of the whole message, 0 - not known yet
+	ws_vec_t *vec; //send: payload blocks used instead of payload
+	uint16_t vec_nr;
+	uint16_t key; //server: queued message with the same key is replaced by
+					//this one (latest value), 0 - none (set by ws_send_key)
+	uint8_t topic; //server: with index -1 only subscribers of the topic,
+					//0 - all open connections (set by ws_publish)
+	ws_frame_t *frame; //server: broadcast encoded once for all shards
+	ws_send_done_t done; //send: called when the message is written to all
+					//its connections (see ws_send_to), NULL - none
+	void *done_ctx;
+#if WS_LATENCY
+	uint32_t t_us; //time of queueing
+#endif
 }ws_queue_item_t;
 
-typedef struct{
-	uint8_t *payload;
-	int len;
-}ws_send_data;
+//answer of the receive callback
+typedef enum {
+	WS_RECV_DONE = 0x0,		//payload is released (or reused) by the server
+	WS_RECV_KEEP = 0x1,		//application keeps the payload, it frees it with
+							//ws_buf_free() or sends it
+	WS_RECV_QUEUE = 0x2		//message goes to ws_input_queue
+} WS_RECV_ACTION;
+
+//called by the receive task of the connection (or the select task) for
+//every received message (or part), msg is valid only during the call
+typedef WS_RECV_ACTION (*ws_recv_cb_t)(ws_queue_item_t *msg);
+
+//flags of ws_send_to()
+#define WS_SEND_MORE	0x01	//fragment, next ones follow (WS_OP_CON)
+#define WS_SEND_PLAIN	0x02	//not compressed (permessage-deflate)
+
+//core of a task, 0 - any core
+#define WS_CORE_ANY		0
+#define WS_CORE(n)		((n) + 1)
+
+#define WS_SHARD_MAX	4	//send (and select) tasks with own connections
+
+//task parameters, 0 - default value
+typedef struct ws_task_cfg{
+	uint16_t stack;			//stack size in bytes
+	uint8_t prio;			//priority
+	uint8_t core;			//WS_CORE_ANY or WS_CORE(n)
+} ws_task_cfg_t;
 
-//configuration structure
+//configuration structure, fields equal to 0 get default values
 typedef struct ws_server_cfg{
 	uint16_t port;
+	WS_ENGINE engine;
+	uint8_t max_clients;	//0 - MAX_OPEN_WS_NR (5) or WS_SELECT_MAX_NR (32),
+							//max 127
+	uint16_t in_queue_len;	//received messages queue, 0 - 10
+	uint16_t out_queue_len;	//messages to send queue, 0 - 10
+	ws_task_cfg_t server_task;	//accept (or select) task, 4096 B, prio 3
+	ws_task_cfg_t recv_task;	//receive task of a connection, 2048 B, prio 3
+	ws_task_cfg_t send_task;	//send task, 2048 B, prio 1
+	WS_RX_MODE rx_mode;
+	uint32_t max_msg_len; //max length of a message passed whole,
+						//0 - MAX_PAYLOAD_LEN
+	uint64_t max_stream_len; //longer messages are received in parts,
+							//0 - messages longer than max_msg_len are refused
+	ws_recv_cb_t recv_cb;	//messages are passed to it instead of
+							//ws_input_queue, NULL - queue only
+	uint16_t tx_queue_len; //frames queued per client, 0 - WS_TX_QUEUE_LEN (16)
+	uint32_t tx_high_water; //bytes queued per client, 0 - not limited
+	WS_TX_POLICY tx_policy; //applied when tx_queue_len or tx_high_water is reached
+	uint16_t item_pool_nr; //queue items and frames in pools, 0 - heap only
+	ws_pool_cfg_t buf_pool[WS_POOL_CLASSES]; //payload size classes (ascending),
+							//nr 0 - class not used
+	uint8_t deflate;		//permessage-deflate (RFC 7692): 0 - off, 1 - used if
+							//the client offers it
+	uint8_t deflate_server_bits; //window of sent messages, 8..15, 0 - 15
+	uint8_t deflate_client_bits; //window of received messages kept between
+							//messages (context takeover), 8..15, 0 - not kept
+	uint16_t deflate_min_len; //shorter messages are sent uncompressed, 0 - 32
+	uint32_t ping_period_ms; //heartbeat: ping to every open connection, 0 - off
+	uint8_t ping_max_missed; //unanswered pings closing the connection, 0 - 3
+	uint32_t handshake_timeout_ms; //time from accept to the upgrade request,
+							//0 - 10000
+	uint32_t close_timeout_ms; //wait for the close answer, 0 - 2000
+	uint32_t idle_timeout_ms; //connection without received data is closed
+							//(1001), 0 - off
+	uint32_t tx_stall_ms;	//connection whose frames can not be written for
+							//so long is dropped, 0 - off
+	uint16_t tx_coalesce_len; //small data frames of a connection are copied
+							//to a buffer of this size and written at once,
+							//0 - off
+	uint32_t tx_coalesce_us; //combined frames wait at most so long for more
+							//(rounded up to ticks), 0 - written at the end
+							//of every pass of the send task
+	uint8_t shards;			//connections are split among so many send tasks
+							//(and select tasks), 1..WS_SHARD_MAX, 0 - 1
+	uint8_t shard_core[WS_SHARD_MAX]; //WS_CORE(n) of the tasks of a shard
+							//(also receive tasks), used if shards > 1,
+							//0 - shard n on core (n + 1) % cores
 } ws_server_cfg_t;
 
 int8_t ws_server_init(void *param);
 int8_t ws_server_stop(void);
 int8_t ws_send(ws_queue_item_t *item, int32_t wait_ms);
+int8_t ws_send_key(ws_queue_item_t *item, uint16_t key, int32_t wait_ms);
+int8_t ws_send_fragment(ws_queue_item_t *item, uint8_t last, int32_t wait_ms);
+int8_t ws_send_vec(int8_t index, WS_OPCODES opcode, ws_vec_t *vec,
+		uint16_t vec_nr, int32_t wait_ms);
+int8_t ws_send_buf(int8_t index, WS_OPCODES opcode, const uint8_t *data,
+		uint32_t len, int32_t wait_ms);
+int8_t ws_send_frame(int8_t index, ws_frame_t *frame, int32_t wait_ms);
+int8_t ws_publish_frame(int8_t topic, ws_frame_t *frame, int32_t wait_ms);
+int8_t ws_send_to(int8_t index, const uint8_t *buf, uint32_t len,
+		WS_OPCODES opcode, uint8_t flags, ws_send_done_t on_complete, void *ctx,
+		int32_t wait_ms);
+int16_t ws_send_to_sync(int8_t index, const uint8_t *buf, uint32_t len,
+		WS_OPCODES opcode, uint8_t flags, int32_t wait_ms);
 xQueueHandle ws_get_recv_queue(void);
+int8_t ws_recv(ws_queue_item_t **item, int32_t wait_ms);
+ws_queue_item_t *ws_item_alloc(void);
+void ws_item_free(ws_queue_item_t *item);
+uint8_t ws_get_stats(ws_server_stats_t *st, ws_conn_stats_t *conn,
+		uint8_t max);
+uint8_t ws_get_max_clients(void);
+uint32_t ws_get_rtt(int8_t index);
+int8_t ws_flush(int8_t index, int32_t wait_ms);
+int8_t ws_subscribe(int8_t index, int8_t topic, uint8_t on);
+int8_t ws_publish(int8_t topic, WS_OPCODES opcode, const uint8_t *data,
+		uint32_t len, int32_t wait_ms);
 
 
 #endif /* MAIN_WEBSOCKET_SERVER_H_ */
@@ -0,0 +1,455 @@
+/*
+ * ws_codec.c
+ *
+ *  Incremental WebSocket frame parser and payload unmasking.
+ */
+
+#include <string.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "ws_codec.h"
+
+#define WS_OPCODE_CONTROL	0x08	//bit set in all control opcodes
+
+//unaligned 32 bit loads are allowed (Xtensa raises an exception)
+#ifndef WS_UNALIGNED_ACCESS
+#if defined(__x86_64__) || defined(__i386__) || defined(__aarch64__)
+#define WS_UNALIGNED_ACCESS	1
+#else
+#define WS_UNALIGNED_ACCESS	0
+#endif
+#endif
+
+// ****************************************************************************
+void ws_parser_init(ws_parser_t *p){
+	memset(p, 0, sizeof(ws_parser_t));
+	p -> state = WS_PS_HEAD;
+	p -> hdr_need = 2;
+}
+
+// ****************************************************************************
+static WS_PARSE_EVENT parse_error(ws_parser_t *p, uint16_t code){
+	p -> state = WS_PS_ERROR;
+	p -> error = code;
+	return WS_PARSE_ERROR;
+}
+
+// ****************************************************************************
+//first two bytes of the header are known, check them and compute header length
+static int8_t parse_first_bytes(ws_parser_t *p){
+	uint8_t len7;
+
+	p -> fin = p -> hdr[0] >> 7;
+	p -> rsv = (p -> hdr[0] >> 4) & 0x07;
+	p -> opcode = p -> hdr[0] & 0x0F;
+	p -> masked = p -> hdr[1] >> 7;
+	len7 = p -> hdr[1] & 0x7F;
+
+	if ((p -> rsv & ~p -> rsv_allowed) != 0){
+		return -1;
+	}
+	switch (p -> opcode){
+	case 0x0: case 0x1: case 0x2:
+	case 0x8: case 0x9: case 0xA:
+		break;
+	default:
+		//reserved opcode
+		return -1;
+	}
+	if (p -> opcode & WS_OPCODE_CONTROL){
+		//control frames can not be fragmented or long
+		if ((p -> fin == 0) || (len7 > WS_MAX_CONTROL_LEN)){
+			return -1;
+		}
+	}
+	if (p -> masked == 0){
+		//client must mask all frames
+		return -1;
+	}
+	p -> hdr_need = 2 + 4;
+	if (len7 == 126){
+		p -> hdr_need += 2;
+	}
+	else if (len7 == 127){
+		p -> hdr_need += 8;
+	}
+	return 0;
+}
+
+// ****************************************************************************
+//whole header collected, decode length and masking key
+static int8_t parse_rest(ws_parser_t *p){
+	uint8_t len7 = p -> hdr[1] & 0x7F, pos = 2;
+
+	if (len7 == 126){
+		p -> len = ((uint16_t)p -> hdr[2] << 8) | p -> hdr[3];
+		pos = 4;
+	}
+	else if (len7 == 127){
+		p -> len = 0;
+		for (int i = 0; i < 8; i++){
+			p -> len = (p -> len << 8) | p -> hdr[2 + i];
+		}
+		pos = 10;
+		if (p -> len >> 63){
+			//most significant bit must be 0
+			return -1;
+		}
+	}
+	else{
+		p -> len = len7;
+	}
+	memcpy(p -> mask, p -> hdr + pos, 4);
+	return 0;
+}
+
+// ****************************************************************************
+//consume input until the next event
+WS_PARSE_EVENT ws_parser_run(ws_parser_t *p, const uint8_t **data,
+		size_t *len, ws_chunk_t *chunk){
+	size_t n;
+
+	switch (p -> state){
+	case WS_PS_HEAD:
+		while (p -> hdr_pos < p -> hdr_need){
+			if (*len == 0){
+				return WS_PARSE_NEED_MORE;
+			}
+			n = p -> hdr_need - p -> hdr_pos;
+			if (n > *len){
+				n = *len;
+			}
+			memcpy(p -> hdr + p -> hdr_pos, *data, n);
+			p -> hdr_pos += n;
+			*data += n;
+			*len -= n;
+			if ((p -> hdr_pos == 2) && (p -> hdr_need == 2)){
+				if (parse_first_bytes(p) != 0){
+					return parse_error(p, 1002);
+				}
+			}
+		}
+		if (parse_rest(p) != 0){
+			return parse_error(p, 1002);
+		}
+		p -> done = 0;
+		p -> state = (p -> len > 0) ? WS_PS_PAYLOAD : WS_PS_END;
+		return WS_PARSE_HEADER;
+
+	case WS_PS_PAYLOAD:
+		if (*len == 0){
+			return WS_PARSE_NEED_MORE;
+		}
+		n = *len;
+		if (n > p -> len - p -> done){
+			n = p -> len - p -> done;
+		}
+		chunk -> data = *data;
+		chunk -> len = n;
+		chunk -> offset = p -> done;
+		*data += n;
+		*len -= n;
+		p -> done += n;
+		if (p -> done == p -> len){
+			p -> state = WS_PS_END;
+		}
+		return WS_PARSE_PAYLOAD;
+
+	case WS_PS_END:
+		//prepare for the next frame
+		p -> state = WS_PS_HEAD;
+		p -> hdr_pos = 0;
+		p -> hdr_need = 2;
+		return WS_PARSE_FRAME_END;
+
+	case WS_PS_ERROR:
+	default:
+		return WS_PARSE_ERROR;
+	}
+}
+
+// ****************************************************************************
+//unmask payload chunk while copying it (dst may be equal to src), offset is
+//the position of src in the frame payload
+//dst is aligned first, then 32 bit words (16/32 byte vectors on the host)
+//are processed, unaligned src words are assembled from bytes on targets
+//without unaligned access (Xtensa)
+void ws_unmask(uint8_t *dst, const uint8_t *src, size_t len,
+		const uint8_t mask[4], uint64_t offset){
+	uint8_t m[4];
+	uint32_t mw, w;
+	size_t i = 0;
+
+	//mask rotated to the chunk start
+	for (int k = 0; k < 4; k++){
+		m[k] = mask[(offset + k) & 3];
+	}
+
+	//head, up to aligned destination
+	while ((i < len) && (((uintptr_t)(dst + i) & 3) != 0)){
+		dst[i] = src[i] ^ m[i & 3];
+		i++;
+	}
+	if (i == len){
+		return;
+	}
+	//mask word for position i (little endian)
+	mw = (uint32_t)m[i & 3] | ((uint32_t)m[(i + 1) & 3] << 8) |
+			((uint32_t)m[(i + 2) & 3] << 16) | ((uint32_t)m[(i + 3) & 3] << 24);
+
+#if defined(__AVX2__)
+	{
+		__m256i mv = _mm256_set1_epi32(mw);
+
+		for (; i + 32 <= len; i += 32){
+			__m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+			_mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(v, mv));
+		}
+	}
+#endif
+#if defined(__SSE2__)
+	{
+		__m128i mv = _mm_set1_epi32(mw);
+
+		for (; i + 16 <= len; i += 16){
+			__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+			_mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(v, mv));
+		}
+	}
+#endif
+
+#if WS_UNALIGNED_ACCESS
+	for (; i + 16 <= len; i += 16){
+		uint32_t *d = (uint32_t *)__builtin_assume_aligned(dst + i, 4);
+		uint32_t v[4];
+
+		memcpy(v, src + i, 16);
+		d[0] = v[0] ^ mw;
+		d[1] = v[1] ^ mw;
+		d[2] = v[2] ^ mw;
+		d[3] = v[3] ^ mw;
+	}
+	for (; i + 4 <= len; i += 4){
+		memcpy(&w, src + i, 4);
+		*(uint32_t *)__builtin_assume_aligned(dst + i, 4) = w ^ mw;
+	}
+#else
+	if (((uintptr_t)(src + i) & 3) == 0){
+		const uint32_t *s = (const uint32_t *)__builtin_assume_aligned(src + i, 4);
+		uint32_t *d = (uint32_t *)__builtin_assume_aligned(dst + i, 4);
+		size_t words = (len - i) / 4;
+
+		for (size_t k = 0; k < words; k++){
+			d[k] = s[k] ^ mw;
+		}
+		i += words * 4;
+	}
+	else{
+		for (; i + 4 <= len; i += 4){
+			const uint8_t *s = src + i;
+
+			w = (uint32_t)s[0] | ((uint32_t)s[1] << 8) |
+					((uint32_t)s[2] << 16) | ((uint32_t)s[3] << 24);
+			*(uint32_t *)__builtin_assume_aligned(dst + i, 4) = w ^ mw;
+		}
+	}
+#endif
+
+	//tail
+	for (; i < len; i++){
+		dst[i] = src[i] ^ m[i & 3];
+	}
+}
+
+// ****************************************************************************
+//UTF-8 validation: shift based DFA, a state is the position of its 6 bit
+//field in the table row of a byte, the field holds the next state. The
+//row does not depend on the state, so one step is a shift on the critical
+//path instead of two dependent table loads.
+#define U_ACC		WS_UTF8_ACCEPT
+#define U_REJ		WS_UTF8_REJECT
+#define U_N1		12		//one continuation byte missing
+#define U_N2		18
+#define U_N3		24
+#define U_NE0		30		//after E0, next A0..BF (no overlong)
+#define U_NED		36		//after ED, next 80..9F (no surrogates)
+#define U_NF0		42		//after F0, next 90..BF (no overlong)
+#define U_NF4		48		//after F4, next 80..8F (up to U+10FFFF)
+
+_Static_assert((U_ACC == 0) && (U_REJ == 6), "UTF-8 states");
+
+//row of a byte from the next states in the order of the states above
+#define U_ROW(acc, n1, n2, n3, e0, ed, f0, f4) ( \
+		((uint64_t)(acc) << U_ACC) | ((uint64_t)U_REJ << U_REJ) | \
+		((uint64_t)(n1) << U_N1) | ((uint64_t)(n2) << U_N2) | \
+		((uint64_t)(n3) << U_N3) | ((uint64_t)(e0) << U_NE0) | \
+		((uint64_t)(ed) << U_NED) | ((uint64_t)(f0) << U_NF0) | \
+		((uint64_t)(f4) << U_NF4))
+#define U_LEAD(next)	U_ROW(next, U_REJ, U_REJ, U_REJ, U_REJ, U_REJ, U_REJ, U_REJ)
+#define U_BAD			U_LEAD(U_REJ)
+
+static const uint64_t utf8_row[256] = {
+	[0x00 ... 0x7F] = U_LEAD(U_ACC),
+	[0x80 ... 0x8F] = U_ROW(U_REJ, U_ACC, U_N1, U_N2, U_REJ, U_N1, U_REJ, U_N2),
+	[0x90 ... 0x9F] = U_ROW(U_REJ, U_ACC, U_N1, U_N2, U_REJ, U_N1, U_N2, U_REJ),
+	[0xA0 ... 0xBF] = U_ROW(U_REJ, U_ACC, U_N1, U_N2, U_N1, U_REJ, U_N2, U_REJ),
+	[0xC0 ... 0xC1] = U_BAD,
+	[0xC2 ... 0xDF] = U_LEAD(U_N1),
+	[0xE0] = U_LEAD(U_NE0),
+	[0xE1 ... 0xEC] = U_LEAD(U_N2),
+	[0xED] = U_LEAD(U_NED),
+	[0xEE ... 0xEF] = U_LEAD(U_N2),
+	[0xF0] = U_LEAD(U_NF0),
+	[0xF1 ... 0xF3] = U_LEAD(U_N3),
+	[0xF4] = U_LEAD(U_NF4),
+	[0xF5 ... 0xFF] = U_BAD
+};
+
+#define U_STEP(state, c)	((uint8_t)(utf8_row[c] >> (state)) & 63)
+
+// ****************************************************************************
+//byte by byte, without branches on the data
+static inline uint8_t utf8_run(uint8_t state, const uint8_t *s, size_t len){
+	for (size_t i = 0; i < len; i++){
+		state = U_STEP(state, s[i]);
+	}
+	return state;
+}
+
+// ****************************************************************************
+//length of the ASCII run at s
+static size_t utf8_ascii(const uint8_t *s, size_t len){
+	size_t i = 0;
+	uint32_t w;
+
+#if defined(__SSE2__)
+	for (; i + 16 <= len; i += 16){
+		int m = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(s + i)));
+
+		if (m != 0){
+			return i + __builtin_ctz(m);
+		}
+	}
+#endif
+#if WS_UNALIGNED_ACCESS
+	for (; i + 4 <= len; i += 4){
+		memcpy(&w, s + i, 4);
+		if ((w & 0x80808080) != 0){
+			break;
+		}
+	}
+#else
+	for (; (i < len) && (((uintptr_t)(s + i) & 3) != 0); i++){
+		if (s[i] & 0x80){
+			return i;
+		}
+	}
+	for (; i + 4 <= len; i += 4){
+		w = *(const uint32_t *)__builtin_assume_aligned(s + i, 4);
+		if ((w & 0x80808080) != 0){
+			break;
+		}
+	}
+#endif
+	for (; (i < len) && ((s[i] & 0x80) == 0); i++);
+	return i;
+}
+
+// ****************************************************************************
+//continue validation of text with the state returned for the previous
+//bytes (WS_UTF8_ACCEPT at the start), text is valid if the state after
+//its last byte is WS_UTF8_ACCEPT, WS_UTF8_REJECT is final
+uint8_t ws_utf8_check(uint8_t state, const uint8_t *data, size_t len){
+	size_t i = 0, n;
+
+	while ((i < len) && (state != U_REJ)){
+		if (state == U_ACC){
+			i += utf8_ascii(data + i, len - i);
+		}
+		//rest of the block (reject is final, checked once per block)
+		n = 16 - (i & 15);
+		n = (n < len - i) ? n : len - i;
+		state = utf8_run(state, data + i, n);
+		i += n;
+	}
+	return state;
+}
+
+// ****************************************************************************
+//ws_unmask() and ws_utf8_check() in one pass: unmasked words and vectors are
+//tested for non ASCII bytes while still in registers, ASCII ones are only
+//stored while the DFA is in WS_UTF8_ACCEPT, the others (and every word
+//inside a character) go through the DFA right after they are stored.
+//After WS_UTF8_REJECT dst is not complete.
+uint8_t ws_unmask_utf8(uint8_t *dst, const uint8_t *src, size_t len,
+		const uint8_t mask[4], uint64_t offset, uint8_t state){
+	uint8_t m[4];
+	uint32_t mw, w;
+	size_t i = 0;
+
+	for (int k = 0; k < 4; k++){
+		m[k] = mask[(offset + k) & 3];
+	}
+
+	//head, up to aligned destination
+	while ((i < len) && (((uintptr_t)(dst + i) & 3) != 0)){
+		dst[i] = src[i] ^ m[i & 3];
+		state = U_STEP(state, dst[i]);
+		i++;
+	}
+	if ((i == len) || (state == U_REJ)){
+		return state;
+	}
+	mw = (uint32_t)m[i & 3] | ((uint32_t)m[(i + 1) & 3] << 8) |
+			((uint32_t)m[(i + 2) & 3] << 16) | ((uint32_t)m[(i + 3) & 3] << 24);
+
+	while (i + 4 <= len){
+#if defined(__SSE2__)
+		if (state == U_ACC){
+			__m128i mv = _mm_set1_epi32(mw);
+
+			for (; i + 16 <= len; i += 16){
+				__m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(src + i)),
+						mv);
+
+				_mm_storeu_si128((__m128i *)(dst + i), v);
+				if (_mm_movemask_epi8(v) != 0){
+					//words of the vector are checked below
+					break;
+				}
+			}
+			if (i + 4 > len){
+				break;
+			}
+		}
+#endif
+#if WS_UNALIGNED_ACCESS
+		memcpy(&w, src + i, 4);
+#else
+		{
+			const uint8_t *s = src + i;
+
+			w = (uint32_t)s[0] | ((uint32_t)s[1] << 8) |
+					((uint32_t)s[2] << 16) | ((uint32_t)s[3] << 24);
+		}
+#endif
+		w ^= mw;
+		*(uint32_t *)__builtin_assume_aligned(dst + i, 4) = w;
+		if (((w & 0x80808080) != 0) || (state != U_ACC)){
+			state = utf8_run(state, dst + i, 4);
+			if (state == U_REJ){
+				return state;
+			}
+		}
+		i += 4;
+	}
+
+	//tail
+	for (; i < len; i++){
+		dst[i] = src[i] ^ m[i & 3];
+		state = U_STEP(state, dst[i]);
+	}
+	return state;
+}
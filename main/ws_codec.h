@@ -0,0 +1,86 @@
+/*
+ * ws_codec.h
+ *
+ *  Incremental WebSocket frame parser (RFC 6455, client to server frames).
+ *  The parser keeps its state between calls, so a frame header may be split
+ *  over any number of segments and one segment may carry many frames.
+ *  It does not allocate memory and does not touch payload data, payload
+ *  chunks are returned as pointers into the input.
+ *
+ *  Typical use, for every received segment:
+ *
+ *	while ((ev = ws_parser_run(&p, &data, &len, &chunk)) != WS_PARSE_NEED_MORE){
+ *		switch (ev){
+ *		case WS_PARSE_HEADER:		//p.opcode, p.fin, p.len are valid
+ *		case WS_PARSE_PAYLOAD:		//chunk of masked payload data
+ *		case WS_PARSE_FRAME_END:	//all payload of the frame was returned
+ *		case WS_PARSE_ERROR:		//p.error is the close code
+ *		}
+ *	}
+ *
+ *  Text payload is checked to be UTF-8 (RFC 3629: no overlong forms,
+ *  surrogates or code points above U+10FFFF) by a DFA, the state is kept
+ *  by the caller, so a code point may be split over chunks and fragments.
+ */
+
+#ifndef MAIN_WS_CODEC_H_
+#define MAIN_WS_CODEC_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define WS_MAX_HEADER_LEN		14	//2 + 8 bytes of length + 4 bytes of mask
+#define WS_MAX_CONTROL_LEN		125
+
+#define WS_UTF8_ACCEPT			0	//complete code points so far
+#define WS_UTF8_REJECT			6	//not UTF-8, final state
+
+typedef enum {
+	WS_PARSE_NEED_MORE = 0,		//all input consumed
+	WS_PARSE_HEADER,			//frame header decoded
+	WS_PARSE_PAYLOAD,			//payload chunk returned
+	WS_PARSE_FRAME_END,			//end of the current frame
+	WS_PARSE_ERROR				//protocol error, see error field
+} WS_PARSE_EVENT;
+
+//parser states
+typedef enum {
+	WS_PS_HEAD = 0,
+	WS_PS_PAYLOAD,
+	WS_PS_END,
+	WS_PS_ERROR
+} WS_PARSE_STATE;
+
+typedef struct{
+	const uint8_t *data;	//masked payload bytes, points into the input
+	size_t len;
+	uint64_t offset;		//offset of data in the frame payload
+} ws_chunk_t;
+
+typedef struct{
+	WS_PARSE_STATE state;
+	uint8_t hdr[WS_MAX_HEADER_LEN];
+	uint8_t hdr_pos;		//header bytes collected
+	uint8_t hdr_need;		//header length, known after two bytes
+	uint8_t opcode;
+	uint8_t fin;
+	uint8_t rsv;			//RSV1..RSV3 bits
+	uint8_t masked;
+	uint8_t mask[4];
+	uint8_t rsv_allowed;	//RSV bits negotiated by extensions
+	uint64_t len;			//payload length of the current frame
+	uint64_t done;			//payload bytes returned so far
+	uint16_t error;			//close code after WS_PARSE_ERROR
+} ws_parser_t;
+
+void ws_parser_init(ws_parser_t *p);
+WS_PARSE_EVENT ws_parser_run(ws_parser_t *p, const uint8_t **data,
+		size_t *len, ws_chunk_t *chunk);
+
+void ws_unmask(uint8_t *dst, const uint8_t *src, size_t len,
+		const uint8_t mask[4], uint64_t offset);
+uint8_t ws_utf8_check(uint8_t state, const uint8_t *data, size_t len);
+uint8_t ws_unmask_utf8(uint8_t *dst, const uint8_t *src, size_t len,
+		const uint8_t mask[4], uint64_t offset, uint8_t state);
+
+#endif /* MAIN_WS_CODEC_H_ */
@@ -0,0 +1,475 @@
+/*
+ * ws_deflate.c
+ *
+ *  Small DEFLATE compressor (fixed Huffman codes) and decompressor for
+ *  permessage-deflate.
+ */
+
+#include <string.h>
+
+#include "ws_deflate.h"
+
+#define WS_DEFLATE_MIN_MATCH	3
+#define WS_DEFLATE_MAX_MATCH	258
+
+//length codes 257..285 and distance codes 0..29 (RFC 1951, 3.2.5)
+static const uint16_t len_base[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t len_extra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t dist_base[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+	8193, 12289, 16385, 24577};
+static const uint8_t dist_extra[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+//order of code length codes in a dynamic block header
+static const uint8_t clen_order[19] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+//bytes removed from the end of every message by the sender
+static const uint8_t msg_tail[4] = {0x00, 0x00, 0xFF, 0xFF};
+
+typedef struct{
+	uint8_t *out;
+	size_t cap;
+	size_t pos;
+	uint32_t bits;
+	uint8_t nr;
+	uint8_t full;			//output buffer too short
+} bit_writer_t;
+
+//fixed Huffman codes (RFC 1951, 3.2.6), bit reversed (they are sent from
+//the MSB); constant, so tasks of all shards compress at the same time
+static const uint16_t fixed_lit_code[288] = {
+	0x00C, 0x08C, 0x04C, 0x0CC, 0x02C, 0x0AC, 0x06C, 0x0EC, 0x01C, 0x09C, 0x05C, 0x0DC,
+	0x03C, 0x0BC, 0x07C, 0x0FC, 0x002, 0x082, 0x042, 0x0C2, 0x022, 0x0A2, 0x062, 0x0E2,
+	0x012, 0x092, 0x052, 0x0D2, 0x032, 0x0B2, 0x072, 0x0F2, 0x00A, 0x08A, 0x04A, 0x0CA,
+	0x02A, 0x0AA, 0x06A, 0x0EA, 0x01A, 0x09A, 0x05A, 0x0DA, 0x03A, 0x0BA, 0x07A, 0x0FA,
+	0x006, 0x086, 0x046, 0x0C6, 0x026, 0x0A6, 0x066, 0x0E6, 0x016, 0x096, 0x056, 0x0D6,
+	0x036, 0x0B6, 0x076, 0x0F6, 0x00E, 0x08E, 0x04E, 0x0CE, 0x02E, 0x0AE, 0x06E, 0x0EE,
+	0x01E, 0x09E, 0x05E, 0x0DE, 0x03E, 0x0BE, 0x07E, 0x0FE, 0x001, 0x081, 0x041, 0x0C1,
+	0x021, 0x0A1, 0x061, 0x0E1, 0x011, 0x091, 0x051, 0x0D1, 0x031, 0x0B1, 0x071, 0x0F1,
+	0x009, 0x089, 0x049, 0x0C9, 0x029, 0x0A9, 0x069, 0x0E9, 0x019, 0x099, 0x059, 0x0D9,
+	0x039, 0x0B9, 0x079, 0x0F9, 0x005, 0x085, 0x045, 0x0C5, 0x025, 0x0A5, 0x065, 0x0E5,
+	0x015, 0x095, 0x055, 0x0D5, 0x035, 0x0B5, 0x075, 0x0F5, 0x00D, 0x08D, 0x04D, 0x0CD,
+	0x02D, 0x0AD, 0x06D, 0x0ED, 0x01D, 0x09D, 0x05D, 0x0DD, 0x03D, 0x0BD, 0x07D, 0x0FD,
+	0x013, 0x113, 0x093, 0x193, 0x053, 0x153, 0x0D3, 0x1D3, 0x033, 0x133, 0x0B3, 0x1B3,
+	0x073, 0x173, 0x0F3, 0x1F3, 0x00B, 0x10B, 0x08B, 0x18B, 0x04B, 0x14B, 0x0CB, 0x1CB,
+	0x02B, 0x12B, 0x0AB, 0x1AB, 0x06B, 0x16B, 0x0EB, 0x1EB, 0x01B, 0x11B, 0x09B, 0x19B,
+	0x05B, 0x15B, 0x0DB, 0x1DB, 0x03B, 0x13B, 0x0BB, 0x1BB, 0x07B, 0x17B, 0x0FB, 0x1FB,
+	0x007, 0x107, 0x087, 0x187, 0x047, 0x147, 0x0C7, 0x1C7, 0x027, 0x127, 0x0A7, 0x1A7,
+	0x067, 0x167, 0x0E7, 0x1E7, 0x017, 0x117, 0x097, 0x197, 0x057, 0x157, 0x0D7, 0x1D7,
+	0x037, 0x137, 0x0B7, 0x1B7, 0x077, 0x177, 0x0F7, 0x1F7, 0x00F, 0x10F, 0x08F, 0x18F,
+	0x04F, 0x14F, 0x0CF, 0x1CF, 0x02F, 0x12F, 0x0AF, 0x1AF, 0x06F, 0x16F, 0x0EF, 0x1EF,
+	0x01F, 0x11F, 0x09F, 0x19F, 0x05F, 0x15F, 0x0DF, 0x1DF, 0x03F, 0x13F, 0x0BF, 0x1BF,
+	0x07F, 0x17F, 0x0FF, 0x1FF, 0x000, 0x040, 0x020, 0x060, 0x010, 0x050, 0x030, 0x070,
+	0x008, 0x048, 0x028, 0x068, 0x018, 0x058, 0x038, 0x078, 0x004, 0x044, 0x024, 0x064,
+	0x014, 0x054, 0x034, 0x074, 0x003, 0x083, 0x043, 0x0C3, 0x023, 0x0A3, 0x063, 0x0E3};
+static const uint8_t fixed_lit_len[288] = {
+	[0 ... 143] = 8, [144 ... 255] = 9, [256 ... 279] = 7, [280 ... 287] = 8};
+static const uint8_t fixed_dist_code[30] = {
+	 0, 16,  8, 24,  4, 20, 12, 28,  2, 18, 10, 26,  6, 22, 14,
+	30,  1, 17,  9, 25,  5, 21, 13, 29,  3, 19, 11, 27,  7, 23};
+
+// ****************************************************************************
+// COMPRESSION
+// ****************************************************************************
+//append n bits (LSB first), full is set when the output is too short
+static void put_bits(bit_writer_t *w, uint32_t value, uint8_t n){
+	w -> bits |= value << w -> nr;
+	w -> nr += n;
+	while (w -> nr >= 8){
+		if (w -> pos == w -> cap){
+			w -> full = 1;
+			w -> nr = 0;
+			w -> bits = 0;
+			return;
+		}
+		w -> out[w -> pos++] = w -> bits;
+		w -> bits >>= 8;
+		w -> nr -= 8;
+	}
+}
+
+// ****************************************************************************
+static void put_match(bit_writer_t *w, uint32_t len, uint32_t dist){
+	int i;
+
+	for (i = 0; (i < 28) && (len_base[i + 1] <= len); i++);
+	put_bits(w, fixed_lit_code[257 + i], fixed_lit_len[257 + i]);
+	put_bits(w, len - len_base[i], len_extra[i]);
+	for (i = 0; (i < 29) && (dist_base[i + 1] <= dist); i++);
+	put_bits(w, fixed_dist_code[i], 5);
+	put_bits(w, dist - dist_base[i], dist_extra[i]);
+}
+
+// ****************************************************************************
+static uint32_t hash3(const uint8_t *p){
+	uint32_t v = p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16);
+
+	return (v * 2654435761u) >> (32 - WS_DEFLATE_HASH_BITS);
+}
+
+// ****************************************************************************
+//compress one message, matches are at most 2^window_bits bytes back
+//returns compressed length, 0 if it does not fit in out_cap bytes
+size_t ws_deflate(ws_deflate_t *d, const uint8_t *in, size_t len,
+		uint8_t *out, size_t out_cap, uint8_t window_bits){
+	bit_writer_t w = {out, out_cap, 0, 0, 0, 0};
+	size_t pos = 0, cand, dist, max, m, end;
+	uint32_t h;
+
+	if (window_bits < WS_DEFLATE_MIN_BITS){
+		window_bits = WS_DEFLATE_MIN_BITS;
+	}
+	if (window_bits > WS_DEFLATE_MAX_BITS){
+		window_bits = WS_DEFLATE_MAX_BITS;
+	}
+	memset(d -> head, 0, sizeof(d -> head));
+	//not final block with fixed codes
+	put_bits(&w, 0, 1);
+	put_bits(&w, 1, 2);
+
+	while ((pos < len) && (w.full == 0)){
+		if (pos + WS_DEFLATE_MIN_MATCH <= len){
+			h = hash3(in + pos);
+			cand = d -> head[h];
+			d -> head[h] = pos + 1;
+			if (cand > 0){
+				cand--;
+				dist = pos - cand;
+				if ((dist <= (1u << window_bits)) && (in[cand] == in[pos]) &&
+						(in[cand + 1] == in[pos + 1]) && (in[cand + 2] == in[pos + 2])){
+					max = len - pos;
+					if (max > WS_DEFLATE_MAX_MATCH){
+						max = WS_DEFLATE_MAX_MATCH;
+					}
+					for (m = WS_DEFLATE_MIN_MATCH; (m < max) &&
+							(in[cand + m] == in[pos + m]); m++);
+					put_match(&w, m, dist);
+					//positions inside the match can be referenced later
+					end = pos + m;
+					for (pos++; (pos < end) && (pos + WS_DEFLATE_MIN_MATCH <= len); pos++){
+						d -> head[hash3(in + pos)] = pos + 1;
+					}
+					pos = end;
+					continue;
+				}
+			}
+		}
+		put_bits(&w, fixed_lit_code[in[pos]], fixed_lit_len[in[pos]]);
+		pos++;
+	}
+	//end of block and an empty stored block (sync flush), its length
+	//fields (the message tail) are not sent
+	put_bits(&w, fixed_lit_code[256], fixed_lit_len[256]);
+	put_bits(&w, 0, 3);
+	if (w.nr > 0){
+		put_bits(&w, 0, 8 - w.nr);
+	}
+	return (w.full == 0) ? w.pos : 0;
+}
+
+// ****************************************************************************
+// DECOMPRESSION
+// ****************************************************************************
+//next input byte, the message tail follows the data
+static uint8_t next_byte(ws_inflate_t *s){
+	if (s -> in_pos < s -> in_len){
+		return s -> in[s -> in_pos++];
+	}
+	if (s -> in_pos < s -> in_len + sizeof(msg_tail)){
+		return msg_tail[s -> in_pos++ - s -> in_len];
+	}
+	s -> eof = 1;
+	return 0;
+}
+
+// ****************************************************************************
+static uint32_t get_bits(ws_inflate_t *s, uint8_t need){
+	uint32_t v = s -> bits;
+
+	while (s -> bit_nr < need){
+		v |= (uint32_t)next_byte(s) << s -> bit_nr;
+		s -> bit_nr += 8;
+	}
+	s -> bits = v >> need;
+	s -> bit_nr -= need;
+	return v & ((1u << need) - 1);
+}
+
+// ****************************************************************************
+//canonical code from code lengths, returns 0 for a complete code, > 0 for
+//an incomplete one, < 0 if it is over-subscribed
+static int build(ws_huff_t *h, const uint8_t *length, int n){
+	uint16_t offs[16];
+	int left = 1;
+
+	memset(h -> count, 0, sizeof(h -> count));
+	for (int sym = 0; sym < n; sym++){
+		h -> count[length[sym]]++;
+	}
+	if (h -> count[0] == n){
+		return 0;
+	}
+	for (int len = 1; len < 16; len++){
+		left <<= 1;
+		left -= h -> count[len];
+		if (left < 0){
+			return left;
+		}
+	}
+	offs[1] = 0;
+	for (int len = 1; len < 15; len++){
+		offs[len + 1] = offs[len] + h -> count[len];
+	}
+	for (int sym = 0; sym < n; sym++){
+		if (length[sym] != 0){
+			h -> symbol[offs[length[sym]]++] = sym;
+		}
+	}
+	return left;
+}
+
+// ****************************************************************************
+//decode one symbol, -1 if the code is not used
+static int decode(ws_inflate_t *s, const ws_huff_t *h){
+	int code = 0, first = 0, index = 0, count;
+
+	for (int len = 1; len < 16; len++){
+		code |= get_bits(s, 1);
+		count = h -> count[len];
+		if (code - count < first){
+			return h -> symbol[index + (code - first)];
+		}
+		index += count;
+		first += count;
+		first <<= 1;
+		code <<= 1;
+	}
+	return -1;
+}
+
+// ****************************************************************************
+//literals and matches of a compressed block
+static int8_t codes(ws_inflate_t *s){
+	int sym;
+	size_t len, dist;
+
+	for (;;){
+		sym = decode(s, &s -> lit);
+		if ((sym < 0) || (s -> eof == 1)){
+			return WS_INFLATE_ERROR;
+		}
+		if (sym < 256){
+			if (s -> out_pos == s -> out_cap){
+				return WS_INFLATE_FULL;
+			}
+			s -> out[s -> out_pos++] = sym;
+			continue;
+		}
+		if (sym == 256){
+			return WS_INFLATE_OK;
+		}
+		sym -= 257;
+		if (sym >= 29){
+			return WS_INFLATE_ERROR;
+		}
+		len = len_base[sym] + get_bits(s, len_extra[sym]);
+		sym = decode(s, &s -> dist);
+		if ((sym < 0) || (sym >= 30)){
+			return WS_INFLATE_ERROR;
+		}
+		dist = dist_base[sym] + get_bits(s, dist_extra[sym]);
+		if (dist > s -> out_pos + s -> dict_len){
+			return WS_INFLATE_ERROR;
+		}
+		if (len > s -> out_cap - s -> out_pos){
+			return WS_INFLATE_FULL;
+		}
+		//the match may start in the dictionary
+		while ((len > 0) && (dist > s -> out_pos)){
+			s -> out[s -> out_pos] = s -> dict[s -> dict_len - (dist - s -> out_pos)];
+			s -> out_pos++;
+			len--;
+		}
+		for (; len > 0; len--){
+			s -> out[s -> out_pos] = s -> out[s -> out_pos - dist];
+			s -> out_pos++;
+		}
+	}
+}
+
+// ****************************************************************************
+static int8_t stored(ws_inflate_t *s){
+	uint16_t len, nlen;
+
+	//rest of the current byte is skipped
+	s -> bits = 0;
+	s -> bit_nr = 0;
+	len = next_byte(s);
+	len |= (uint16_t)next_byte(s) << 8;
+	nlen = next_byte(s);
+	nlen |= (uint16_t)next_byte(s) << 8;
+	if ((s -> eof == 1) || ((len ^ nlen) != 0xFFFF)){
+		return WS_INFLATE_ERROR;
+	}
+	if (len > s -> out_cap - s -> out_pos){
+		return WS_INFLATE_FULL;
+	}
+	while (len-- > 0){
+		s -> out[s -> out_pos++] = next_byte(s);
+	}
+	return (s -> eof == 0) ? WS_INFLATE_OK : WS_INFLATE_ERROR;
+}
+
+// ****************************************************************************
+static int8_t fixed(ws_inflate_t *s){
+	uint8_t length[288];
+	int sym;
+
+	for (sym = 0; sym < 144; sym++){
+		length[sym] = 8;
+	}
+	for (; sym < 256; sym++){
+		length[sym] = 9;
+	}
+	for (; sym < 280; sym++){
+		length[sym] = 7;
+	}
+	for (; sym < 288; sym++){
+		length[sym] = 8;
+	}
+	build(&s -> lit, length, 288);
+	memset(length, 5, 30);
+	build(&s -> dist, length, 30);
+	return codes(s);
+}
+
+// ****************************************************************************
+static int8_t dynamic(ws_inflate_t *s){
+	uint8_t length[286 + 30];
+	int nlen, ndist, ncode, index, sym, err;
+	uint8_t len;
+
+	nlen = get_bits(s, 5) + 257;
+	ndist = get_bits(s, 5) + 1;
+	ncode = get_bits(s, 4) + 4;
+	if ((nlen > 286) || (ndist > 30)){
+		return WS_INFLATE_ERROR;
+	}
+	memset(length, 0, 19);
+	for (index = 0; index < ncode; index++){
+		length[clen_order[index]] = get_bits(s, 3);
+	}
+	//code length codes must be complete
+	if (build(&s -> lit, length, 19) != 0){
+		return WS_INFLATE_ERROR;
+	}
+	index = 0;
+	while (index < nlen + ndist){
+		sym = decode(s, &s -> lit);
+		if ((sym < 0) || (s -> eof == 1)){
+			return WS_INFLATE_ERROR;
+		}
+		if (sym < 16){
+			length[index++] = sym;
+			continue;
+		}
+		len = 0;
+		if (sym == 16){
+			if (index == 0){
+				return WS_INFLATE_ERROR;
+			}
+			len = length[index - 1];
+			sym = 3 + get_bits(s, 2);
+		}
+		else if (sym == 17){
+			sym = 3 + get_bits(s, 3);
+		}
+		else{
+			sym = 11 + get_bits(s, 7);
+		}
+		if (index + sym > nlen + ndist){
+			return WS_INFLATE_ERROR;
+		}
+		while (sym-- > 0){
+			length[index++] = len;
+		}
+	}
+	if (length[256] == 0){
+		//no end of block code
+		return WS_INFLATE_ERROR;
+	}
+	//incomplete codes are allowed only with one symbol
+	err = build(&s -> lit, length, nlen);
+	if ((err < 0) || ((err > 0) && (nlen - s -> lit.count[0] != 1))){
+		return WS_INFLATE_ERROR;
+	}
+	err = build(&s -> dist, length + nlen, ndist);
+	if ((err < 0) || ((err > 0) && (ndist - s -> dist.count[0] != 1))){
+		return WS_INFLATE_ERROR;
+	}
+	return codes(s);
+}
+
+// ****************************************************************************
+//decompress one message (its tail was removed by the sender), dict holds
+//the last dict_len bytes of previous messages (context takeover) or is NULL
+int8_t ws_inflate(ws_inflate_t *s, const uint8_t *in, size_t len,
+		uint8_t *out, size_t out_cap, size_t *out_len, const uint8_t *dict,
+		size_t dict_len){
+	uint8_t last, type;
+	int8_t ret;
+
+	s -> in = in;
+	s -> in_len = len;
+	s -> in_pos = 0;
+	s -> bits = 0;
+	s -> bit_nr = 0;
+	s -> eof = 0;
+	s -> out = out;
+	s -> out_cap = out_cap;
+	s -> out_pos = 0;
+	s -> dict = dict;
+	s -> dict_len = (dict != NULL) ? dict_len : 0;
+	if (len == 0){
+		//empty message, zlib sends nothing after a flush without new input
+		*out_len = 0;
+		return WS_INFLATE_OK;
+	}
+
+	do {
+		if ((s -> in_pos == s -> in_len + sizeof(msg_tail)) && (s -> bit_nr == 0)){
+			//data and tail used up at a block boundary
+			break;
+		}
+		last = get_bits(s, 1);
+		type = get_bits(s, 2);
+		switch (type){
+		case 0:
+			ret = stored(s);
+			break;
+		case 1:
+			ret = fixed(s);
+			break;
+		case 2:
+			ret = dynamic(s);
+			break;
+		default:
+			ret = WS_INFLATE_ERROR;
+			break;
+		}
+		if ((ret == WS_INFLATE_OK) && (s -> eof == 1)){
+			ret = WS_INFLATE_ERROR;
+		}
+		if (ret != WS_INFLATE_OK){
+			return ret;
+		}
+	} while (last == 0);
+	*out_len = s -> out_pos;
+	return WS_INFLATE_OK;
+}
@@ -0,0 +1,65 @@
+/*
+ * ws_deflate.h
+ *
+ *  Small DEFLATE (RFC 1951) compressor and decompressor for the
+ *  permessage-deflate extension (RFC 7692).
+ *
+ *  The compressor is LZ77 with one hash probe and fixed Huffman codes, it
+ *  references only the message being compressed (no context takeover), so
+ *  it needs no window memory and one compressed frame can be sent to any
+ *  client. The output ends with an empty stored block without its last
+ *  four bytes (0x00 0x00 0xFF 0xFF), as RFC 7692 requires.
+ *
+ *  The decompressor handles stored, fixed and dynamic blocks of one whole
+ *  message, the four bytes removed by the sender are added by it. Matches
+ *  may reach back into a dictionary (last bytes of previous messages) when
+ *  the client uses context takeover.
+ */
+
+#ifndef MAIN_WS_DEFLATE_H_
+#define MAIN_WS_DEFLATE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define WS_DEFLATE_HASH_BITS	10
+#define WS_DEFLATE_MAX_BITS		15	//max window bits
+#define WS_DEFLATE_MIN_BITS		8
+
+#define WS_INFLATE_OK			0
+#define WS_INFLATE_ERROR		-1	//corrupted data
+#define WS_INFLATE_FULL			-2	//output longer than the buffer
+
+typedef struct ws_deflate{
+	uint32_t head[1 << WS_DEFLATE_HASH_BITS];	//last position of a hash + 1
+} ws_deflate_t;
+
+typedef struct ws_huff{
+	uint16_t count[16];		//codes of every length
+	uint16_t symbol[288];	//symbols ordered by code
+} ws_huff_t;
+
+//decompressor state, about 1 kB, not kept between messages
+typedef struct ws_inflate{
+	const uint8_t *in;
+	size_t in_len;
+	size_t in_pos;
+	uint32_t bits;
+	uint8_t bit_nr;
+	uint8_t eof;			//input ended before the data
+	uint8_t *out;
+	size_t out_cap;
+	size_t out_pos;
+	const uint8_t *dict;
+	size_t dict_len;
+	ws_huff_t lit;
+	ws_huff_t dist;
+} ws_inflate_t;
+
+size_t ws_deflate(ws_deflate_t *d, const uint8_t *in, size_t len,
+		uint8_t *out, size_t out_cap, uint8_t window_bits);
+int8_t ws_inflate(ws_inflate_t *s, const uint8_t *in, size_t len,
+		uint8_t *out, size_t out_cap, size_t *out_len, const uint8_t *dict,
+		size_t dict_len);
+
+#endif /* MAIN_WS_DEFLATE_H_ */
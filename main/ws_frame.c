@@ -0,0 +1,369 @@
+/*
+ * ws_frame.c
+ *
+ *  Reference counted outgoing WebSocket frame.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+#include "lwip/sockets.h"
+
+#include "websocket_server.h"
+#include "ws_frame.h"
+#include "ws_pool.h"
+
+typedef err_t (*ws_write_fn_t)(void *conn, struct netvector *vec, u16_t cnt,
+		u8_t apiflags, size_t *written);
+
+// ****************************************************************************
+//encode unmasked header for payload length f -> len
+static void frame_head(ws_frame_t *f, uint8_t opcode, uint8_t fin){
+	ws_frame_header_u_t header;
+
+	header.h.opcode = opcode;
+	header.h.reserved = 0;
+	header.h.fin = fin;
+	header.h.mask = 0x0;	//only client masks data
+	if (f -> len <= 125){
+		header.h.payload_len = f -> len;
+		f -> head_len = 2;
+	}
+	else if (f -> len <= 0xFFFF){
+		header.h.payload_len = 126;
+		f -> head[2] = f -> len >> 8;
+		f -> head[3] = f -> len & 0x00FF;
+		f -> head_len = 4;
+	}
+	else{
+		header.h.payload_len = 127;
+		for (int i = 0; i < 8; i++){
+			f -> head[2 + i] = f -> len >> (56 - 8 * i);
+		}
+		f -> head_len = 10;
+	}
+	f -> head[0] = header.bytes[0];
+	f -> head[1] = header.bytes[1];
+}
+
+// ****************************************************************************
+//create frame, takes ownership of payload (also on error) unless keep is 1
+ws_frame_t *ws_frame_new(uint8_t opcode, uint8_t fin, uint8_t ws_frame,
+		uint8_t *payload, uint32_t len, uint8_t keep){
+	ws_frame_t *f;
+
+	f = ws_frame_alloc();
+	if (f == NULL){
+		if (keep == 0){
+			ws_buf_free(payload);
+		}
+		return NULL;
+	}
+	f -> refs = 1;
+	f -> key = 0;
+	f -> done = NULL;
+	f -> origin = NULL;
+	f -> sent = 0;
+	WS_LAT_STAMP(f -> t_us);
+	f -> keep = keep;
+	f -> payload = payload;
+	f -> vec = NULL;
+	f -> vec_nr = 0;
+	f -> len = len;
+	f -> head_len = 0;
+	if (ws_frame == 1){
+		frame_head(f, opcode, fin);
+	}
+	return f;
+}
+
+// ****************************************************************************
+//create frame from payload blocks, takes ownership of the array and blocks
+//(also on error) unless keep is 1
+ws_frame_t *ws_frame_new_vec(uint8_t opcode, uint8_t fin, ws_vec_t *vec,
+		uint16_t vec_nr, uint8_t keep){
+	ws_frame_t *f;
+
+	f = ws_frame_alloc();
+	if (f == NULL){
+		for (int i = 0; (keep == 0) && (i < vec_nr); i++){
+			ws_buf_free(vec[i].data);
+		}
+		if (keep == 0){
+			ws_buf_free(vec);
+		}
+		return NULL;
+	}
+	f -> refs = 1;
+	f -> key = 0;
+	f -> done = NULL;
+	f -> origin = NULL;
+	f -> sent = 0;
+	WS_LAT_STAMP(f -> t_us);
+	f -> keep = keep;
+	f -> payload = NULL;
+	f -> vec = vec;
+	f -> vec_nr = vec_nr;
+	f -> len = 0;
+	for (int i = 0; i < vec_nr; i++){
+		f -> len += vec[i].len;
+	}
+	frame_head(f, opcode, fin);
+	return f;
+}
+
+// ****************************************************************************
+//prepared frame: header is encoded and data copied once, the caller keeps
+//the reference and sends the frame any number of times (ws_send_frame),
+//it is released with ws_frame_unref(); NULL if there is no memory
+ws_frame_t *ws_frame_prepare(uint8_t opcode, const uint8_t *data,
+		uint32_t len){
+	uint8_t *payload;
+
+	payload = ws_buf_alloc((len > 0) ? len : 1);
+	if (payload == NULL){
+		return NULL;
+	}
+	memcpy(payload, data, len);
+	return ws_frame_new(opcode, 1, 1, payload, len, 0);
+}
+
+// ****************************************************************************
+//frame is still queued for some connection, it must not be patched
+uint8_t ws_frame_busy(ws_frame_t *f){
+	return __atomic_load_n(&f -> refs, __ATOMIC_ACQUIRE) > 1;
+}
+
+// ****************************************************************************
+//overwrite len bytes of the prepared frame's payload at off, length and
+//header stay; returns 1, 0 if the frame is busy or -1 if out of range
+int8_t ws_frame_patch(ws_frame_t *f, uint32_t off, const uint8_t *data,
+		uint32_t len){
+	if ((f -> payload == NULL) || (off > f -> len) || (len > f -> len - off)){
+		return -1;
+	}
+	if (ws_frame_busy(f)){
+		return 0;
+	}
+	memcpy(f -> payload + off, data, len);
+	return 1;
+}
+
+// ****************************************************************************
+//write value as a decimal number right-aligned in width bytes at off,
+//padded with spaces (valid JSON whitespace); returns as ws_frame_patch(),
+//-1 also if the number does not fit
+int8_t ws_frame_patch_dec(ws_frame_t *f, uint32_t off, uint8_t width,
+		int32_t value){
+	uint8_t field[12];
+	uint32_t v = (value < 0) ? -(uint32_t)value : (uint32_t)value;
+	int pos = width;
+
+	if (width > sizeof(field)){
+		return -1;
+	}
+	do {
+		if (pos == 0){
+			return -1;
+		}
+		field[--pos] = '0' + v % 10;
+		v /= 10;
+	} while (v > 0);
+	if (value < 0){
+		if (pos == 0){
+			return -1;
+		}
+		field[--pos] = '-';
+	}
+	memset(field, ' ', pos);
+	return ws_frame_patch(f, off, field, width);
+}
+
+// ****************************************************************************
+ws_frame_t *ws_frame_ref(ws_frame_t *f){
+	__atomic_add_fetch(&f -> refs, 1, __ATOMIC_RELAXED);
+	return f;
+}
+
+// ****************************************************************************
+//the last reference releases payload and calls the completion callback
+//(in the task which dropped it)
+void ws_frame_unref(ws_frame_t *f){
+	ws_send_done_t done;
+	ws_frame_t *origin;
+	void *ctx;
+	uint8_t sent;
+
+	if (f == NULL){
+		return;
+	}
+	if (__atomic_sub_fetch(&f -> refs, 1, __ATOMIC_ACQ_REL) == 0){
+		if (f -> keep == 0){
+			for (int i = 0; i < f -> vec_nr; i++){
+				ws_buf_free(f -> vec[i].data);
+			}
+			ws_buf_free(f -> vec);
+			ws_buf_free(f -> payload);
+		}
+		done = f -> done;
+		ctx = f -> ctx;
+		sent = f -> sent;
+		origin = f -> origin;
+		ws_frame_free(f);
+		if (done != NULL){
+			done(ctx, sent);
+		}
+		ws_frame_unref(origin);
+	}
+}
+
+// ****************************************************************************
+//frame is written to one more connection (or copied to its combining
+//buffer), only counted for frames with completion callback
+void ws_frame_written(ws_frame_t *f){
+	if (f -> origin != NULL){
+		f = f -> origin;
+	}
+	if (f -> done != NULL){
+		__atomic_add_fetch(&f -> sent, 1, __ATOMIC_RELAXED);
+	}
+}
+
+// ****************************************************************************
+//bytes written to the connection for the frame
+uint64_t ws_frame_size(const ws_frame_t *f){
+	return f -> head_len + f -> len;
+}
+
+// ****************************************************************************
+//n-th block of the frame: header, then payload or payload blocks
+static void frame_block(ws_frame_t *f, int n, const uint8_t **ptr,
+		uint64_t *len){
+	if (n == 0){
+		*ptr = f -> head;
+		*len = f -> head_len;
+	}
+	else if (f -> vec == NULL){
+		*ptr = f -> payload;
+		*len = f -> len;
+	}
+	else{
+		*ptr = f -> vec[n - 1].data;
+		*len = f -> vec[n - 1].len;
+	}
+}
+
+// ****************************************************************************
+//copy header and payload to dst (ws_frame_size bytes), small frames are
+//combined into one write
+void ws_frame_copy(ws_frame_t *f, uint8_t *dst){
+	const uint8_t *ptr;
+	uint64_t len;
+	int blocks;
+
+	blocks = 1 + ((f -> vec != NULL) ? f -> vec_nr : 1);
+	for (int n = 0; n < blocks; n++){
+		frame_block(f, n, &ptr, &len);
+		if (len > 0){
+			memcpy(dst, ptr, len);
+			dst += len;
+		}
+	}
+}
+
+// ****************************************************************************
+//netconn writer
+static err_t write_netconn(void *conn, struct netvector *vec, u16_t cnt,
+		u8_t apiflags, size_t *written){
+	return netconn_write_vectors_partly((struct netconn *)conn, vec, cnt,
+			WS_FRAME_WRITE_FLAGS | apiflags, written);
+}
+
+// ****************************************************************************
+//socket writer, socket is non-blocking
+static err_t write_sock(void *sock, struct netvector *vec, u16_t cnt,
+		u8_t apiflags, size_t *written){
+	struct iovec iov[WS_FRAME_WRITE_VECS];
+	int n;
+
+	(void)apiflags;
+	for (int i = 0; i < cnt; i++){
+		iov[i].iov_base = (void *)vec[i].ptr;
+		iov[i].iov_len = vec[i].len;
+	}
+	n = lwip_writev(*(int *)sock, iov, cnt);
+	if (n < 0){
+		return (errno == EWOULDBLOCK) ? ERR_WOULDBLOCK : ERR_CLSD;
+	}
+	*written = n;
+	return ERR_OK;
+}
+
+// ****************************************************************************
+//write header and payload from offset *off without building a contiguous
+//copy, blocks go in groups of WS_FRAME_WRITE_VECS vectors
+//if the connection does not block the write may stop early, *off is the
+//position to resume from and ERR_WOULDBLOCK is returned until the whole
+//frame is written
+static err_t frame_write(ws_frame_t *f, uint64_t *off, ws_write_fn_t write,
+		void *conn, u8_t apiflags){
+	struct netvector vec[WS_FRAME_WRITE_VECS];
+	const uint8_t *ptr;
+	uint64_t len, skip = *off, want = 0;
+	size_t written;
+	u16_t cnt = 0;
+	int blocks;
+	err_t err;
+
+	blocks = 1 + ((f -> vec != NULL) ? f -> vec_nr : 1);
+	for (int n = 0; n <= blocks; n++){
+		if (n < blocks){
+			frame_block(f, n, &ptr, &len);
+			if (len <= skip){
+				//empty or already written
+				skip -= len;
+				continue;
+			}
+			ptr += skip;
+			len -= skip;
+			skip = 0;
+		}
+		if ((cnt == WS_FRAME_WRITE_VECS) || ((n == blocks) && (cnt > 0))){
+			written = 0;
+			err = write(conn, vec, cnt, apiflags, &written);
+			*off += written;
+			if (err != ERR_OK){
+				return err;
+			}
+			if (written < want){
+				return ERR_WOULDBLOCK;
+			}
+			cnt = 0;
+			want = 0;
+		}
+		if (n < blocks){
+			vec[cnt].ptr = ptr;
+			vec[cnt].len = len;
+			want += len;
+			cnt++;
+		}
+	}
+	return ERR_OK;
+}
+
+// ****************************************************************************
+//write frame to netconn, with NETCONN_DONTBLOCK the write may stop early
+err_t ws_frame_write(struct netconn *conn, ws_frame_t *f, uint64_t *off,
+		u8_t apiflags){
+	return frame_write(f, off, write_netconn, conn, apiflags);
+}
+
+// ****************************************************************************
+//write frame to non-blocking lwIP socket
+err_t ws_frame_write_sock(int sock, ws_frame_t *f, uint64_t *off){
+	return frame_write(f, off, write_sock, &sock, 0);
+}
@@ -0,0 +1,82 @@
+/*
+ * ws_frame.h
+ *
+ *  Reference counted outgoing WebSocket frame. The header is encoded once
+ *  and the payload is owned by the frame, every client connection writes
+ *  the same object (header and payload blocks as vectors) and the payload
+ *  is released when the last reference is dropped.
+ *
+ *  Prepared frames (ws_frame_prepare) are kept by the application and sent
+ *  many times without encoding or copying, fixed-width fields of their
+ *  payload can be patched while no connection queue holds them.
+ */
+
+#ifndef MAIN_WS_FRAME_H_
+#define MAIN_WS_FRAME_H_
+
+#include <stdint.h>
+
+#include "lwip/api.h"
+
+#include "ws_latency.h"
+
+#define WS_FRAME_HEAD_LEN	10	//max header length, server frames are not masked
+#define WS_FRAME_WRITE_VECS	8	//vectors passed to one netconn write
+#define WS_FRAME_RSV1		0x40	//first header byte: compressed message
+
+//lwIP references NOCOPY data until the peer acknowledges it and netconn
+//does not report acknowledges, so lwIP still copies into its pbufs: a frame
+//is released (and ws_send_to completes) when it is written, not when acked
+#define WS_FRAME_WRITE_FLAGS	NETCONN_COPY
+
+//called when the last reference of a frame is dropped, sent is the number
+//of connections the frame was written to
+typedef void (*ws_send_done_t)(void *ctx, uint8_t sent);
+
+//one block of payload, large messages do not need to be contiguous
+typedef struct ws_vec{
+	uint8_t *data;			//heap or pool block, freed with the frame
+	uint32_t len;
+} ws_vec_t;
+
+typedef struct ws_frame{
+	uint32_t refs;
+	uint8_t *payload;		//owned by the frame, freed with it (unless keep)
+	uint8_t keep;			//payload (or blocks) is owned by the caller
+	ws_vec_t *vec;			//or list of payload blocks (array and blocks owned)
+	uint16_t vec_nr;
+	uint64_t len;			//payload length
+	uint8_t head[WS_FRAME_HEAD_LEN];
+	uint8_t head_len;		//0 for non websocket data (handshake answer)
+	uint16_t key;			//conflation key, 0 - none
+	ws_send_done_t done;	//completion callback, NULL - none
+	void *ctx;				//its argument
+	struct ws_frame *origin; //frame this one is a copy of (compressed), it
+							//is counted and referenced by the copy
+	uint8_t sent;			//connections written (done != NULL)
+#if WS_LATENCY
+	uint32_t t_us;			//taken from the output queue
+#endif
+} ws_frame_t;
+
+ws_frame_t *ws_frame_new(uint8_t opcode, uint8_t fin, uint8_t ws_frame,
+		uint8_t *payload, uint32_t len, uint8_t keep);
+ws_frame_t *ws_frame_new_vec(uint8_t opcode, uint8_t fin, ws_vec_t *vec,
+		uint16_t vec_nr, uint8_t keep);
+ws_frame_t *ws_frame_prepare(uint8_t opcode, const uint8_t *data,
+		uint32_t len);
+uint8_t ws_frame_busy(ws_frame_t *frame);
+int8_t ws_frame_patch(ws_frame_t *frame, uint32_t off, const uint8_t *data,
+		uint32_t len);
+int8_t ws_frame_patch_dec(ws_frame_t *frame, uint32_t off, uint8_t width,
+		int32_t value);
+ws_frame_t *ws_frame_ref(ws_frame_t *frame);
+void ws_frame_unref(ws_frame_t *frame);
+void ws_frame_written(ws_frame_t *frame);
+uint64_t ws_frame_size(const ws_frame_t *frame);
+void ws_frame_copy(ws_frame_t *frame, uint8_t *dst);
+err_t ws_frame_write(struct netconn *conn, ws_frame_t *frame, uint64_t *off,
+		u8_t apiflags);
+err_t ws_frame_write_sock(int sock, ws_frame_t *frame, uint64_t *off);
+
+#endif /* MAIN_WS_FRAME_H_ */
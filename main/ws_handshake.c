@@ -0,0 +1,330 @@
+/*
+ * ws_handshake.c
+ *
+ *  Incremental HTTP upgrade request parser and Sec-WebSocket-Accept key.
+ */
+
+#include <string.h>
+#include <sys/param.h>
+
+#include "hwcrypto/sha.h"
+
+#include "ws_handshake.h"
+
+#define SHA1_RES_LEN		20
+#define WS_HS_NAME_MAX		24	//sec-websocket-extensions
+
+enum {HS_LINE = 0, HS_NAME, HS_DONE, HS_ERROR};
+enum {HDR_OTHER = 0, HDR_UPGRADE, HDR_CONNECTION, HDR_VERSION, HDR_KEY,
+	HDR_EXT};
+
+static const char request_method[] = "GET /";
+static const char request_version[] = " HTTP/1.1";
+static const char guid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+static const char base64_table[] =
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+//known headers, lowercase
+static const char *const hdr_names[] = {NULL, "upgrade", "connection",
+	"sec-websocket-version", "sec-websocket-key", "sec-websocket-extensions"};
+
+// ****************************************************************************
+void ws_hs_init(ws_hs_t *h){
+	memset(h, 0, sizeof(ws_hs_t));
+	h -> state = HS_LINE;
+}
+
+// ****************************************************************************
+static char lower(char c){
+	return ((c >= 'A') && (c <= 'Z')) ? c + ('a' - 'A') : c;
+}
+
+// ****************************************************************************
+//n characters of s (any case) are the lowercase k, which has only letters,
+//digits and '-': bit 0x20 is ignored where k has a letter (bit 0x40 set),
+//4 characters are compared at once
+static uint8_t same(const char *s, const char *k, size_t n){
+	uint32_t a, b;
+	size_t j;
+
+	for (j = 0; j + 4 <= n; j += 4){
+		memcpy(&a, s + j, 4);
+		memcpy(&b, k + j, 4);
+		if ((a | ((b >> 1) & 0x20202020)) != b){
+			return 0;
+		}
+	}
+	for (; j < n; j++){
+		if ((s[j] | ((k[j] >> 1) & 0x20)) != k[j]){
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// ****************************************************************************
+//header of the name (n characters, any case), the length selects the only
+//known name which may match
+static uint8_t header_id(const char *name, size_t n){
+	uint8_t i;
+
+	switch (n){
+	case 7:
+		i = HDR_UPGRADE;
+		break;
+	case 10:
+		i = HDR_CONNECTION;
+		break;
+	case 17:
+		i = HDR_KEY;
+		break;
+	case 21:
+		i = HDR_VERSION;
+		break;
+	case 24:
+		i = HDR_EXT;
+		break;
+	default:
+		return HDR_OTHER;
+	}
+	return same(name, hdr_names[i], n) ? i : HDR_OTHER;
+}
+
+// ****************************************************************************
+//comma separated list of n characters contains the lowercase token of t
+//characters (spaces around tokens are skipped)
+static uint8_t has_token(const char *s, size_t n, const char *token, size_t t){
+	size_t a, b;
+	const char *comma;
+
+	while (n > 0){
+		comma = memchr(s, ',', n);
+		b = (comma != NULL) ? (size_t)(comma - s) : n;
+		for (a = 0; (a < b) && ((s[a] == ' ') || (s[a] == '\t')); a++);
+		for (; (b > a) && ((s[b - 1] == ' ') || (s[b - 1] == '\t')); b--);
+		if ((b - a == t) && same(s + a, token, t)){
+			return 1;
+		}
+		if (comma == NULL){
+			break;
+		}
+		n -= comma - s + 1;
+		s = comma + 1;
+	}
+	return 0;
+}
+
+// ****************************************************************************
+//value (n characters, spaces around it removed) of a known header, over:
+//the middle of a long split line was dropped
+static void parse_value(ws_hs_t *h, uint8_t header, const char *v, size_t n,
+		uint8_t over){
+	uint16_t version = 0;
+	size_t j;
+
+	switch (header){
+	case HDR_UPGRADE:
+		if ((over == 0) && has_token(v, n, "websocket", 9)){
+			h -> flags |= WS_HS_UPGRADE;
+		}
+		break;
+	case HDR_CONNECTION:
+		if ((over == 0) && has_token(v, n, "upgrade", 7)){
+			h -> flags |= WS_HS_CONNECTION;
+		}
+		break;
+	case HDR_VERSION:
+		for (j = 0; (j < n) && (j < 4) && (v[j] >= '0') && (v[j] <= '9'); j++){
+			version = version * 10 + v[j] - '0';
+		}
+		//repeated header is not valid
+		h -> version = ((h -> version != 0) || (j != n) || (j == 0) ||
+				(over == 1)) ? 0xFFFF : version;
+		h -> flags &= ~WS_HS_VERSION;
+		h -> flags |= (h -> version == 13) ? WS_HS_VERSION : 0;
+		break;
+	case HDR_KEY:
+		//repeated header is not valid
+		if ((h -> key_len == 0) && (n == WS_HS_KEY_LEN) && (over == 0)){
+			memcpy(h -> key, v, WS_HS_KEY_LEN);
+			h -> key[WS_HS_KEY_LEN] = 0;
+			h -> key_len = WS_HS_KEY_LEN;
+			h -> flags |= WS_HS_KEY;
+		}
+		else{
+			h -> key_len = 0xFF;
+			h -> flags &= ~WS_HS_KEY;
+		}
+		break;
+	case HDR_EXT:
+		//headers are joined with ", "
+		if ((over == 1) || (h -> ext_len + n + 2 >= WS_HS_EXT_LEN)){
+			h -> ext_over = 1;
+			break;
+		}
+		memcpy(h -> ext + h -> ext_len, v, n);
+		h -> ext_len += n;
+		h -> ext[h -> ext_len++] = ',';
+		h -> ext[h -> ext_len++] = ' ';
+		h -> ext[h -> ext_len] = 0;
+		break;
+	default:
+		break;
+	}
+}
+
+// ****************************************************************************
+//one line of n characters without "\r\n"
+static void parse_line(ws_hs_t *h, const char *s, size_t n, uint8_t over){
+	const char *colon;
+	size_t a, b;
+	uint8_t header;
+	char c;
+
+	if (h -> state == HS_LINE){
+		//GET /path HTTP/1.1, other methods and versions are refused
+		if ((n < sizeof(request_method) - 1 + sizeof(request_version) - 1) ||
+				(memcmp(s, request_method, sizeof(request_method) - 1) != 0) ||
+				(memcmp(s + n - (sizeof(request_version) - 1), request_version,
+				sizeof(request_version) - 1) != 0)){
+			h -> state = HS_ERROR;
+			return;
+		}
+		h -> state = HS_NAME;
+		return;
+	}
+	if (n == 0){
+		//empty line ends the request
+		h -> state = HS_DONE;
+		return;
+	}
+	//known names are at most 24 characters long and start with 'c', 's'
+	//or 'u', lines without ':' are skipped
+	c = lower(s[0]);
+	if ((c != 'c') && (c != 's') && (c != 'u')){
+		return;
+	}
+	colon = memchr(s, ':', MIN(n, (size_t)(WS_HS_NAME_MAX + 1)));
+	if (colon == NULL){
+		return;
+	}
+	header = header_id(s, colon - s);
+	if (header == HDR_OTHER){
+		return;
+	}
+	a = colon - s + 1;
+	b = n;
+	for (; (a < b) && ((s[a] == ' ') || (s[a] == '\t')); a++);
+	for (; (b > a) && ((s[b - 1] == ' ') || (s[b - 1] == '\t')); b--);
+	parse_value(h, header, s + a, b - a, over);
+}
+
+// ****************************************************************************
+//part of a line split over segments is added to line, a longer line keeps
+//its beginning (method, header name) and the last WS_HS_LINE_TAIL bytes
+static void line_add(ws_hs_t *h, const uint8_t *p, size_t n){
+	char *tail = h -> line + WS_HS_LINE_LEN - WS_HS_LINE_TAIL;
+	size_t k = MIN(n, (size_t)(WS_HS_LINE_LEN - h -> line_len));
+
+	memcpy(h -> line + h -> line_len, p, k);
+	h -> line_len += k;
+	p += k;
+	n -= k;
+	if (n == 0){
+		return;
+	}
+	h -> line_over = 1;
+	if (n >= WS_HS_LINE_TAIL){
+		memcpy(tail, p + n - WS_HS_LINE_TAIL, WS_HS_LINE_TAIL);
+	}
+	else{
+		memmove(tail, tail + n, WS_HS_LINE_TAIL - n);
+		memcpy(tail + WS_HS_LINE_TAIL - n, p, n);
+	}
+}
+
+// ****************************************************************************
+//parse next part of the request, *used is set to the number of bytes
+//belonging to the request when it is complete (the rest are websocket
+//frames), returns WS_HS_MORE, WS_HS_DONE or WS_HS_ERROR
+int8_t ws_hs_parse(ws_hs_t *h, const uint8_t *data, size_t len, size_t *used){
+	const uint8_t *lf;
+	const char *s;
+	size_t i = 0, n;
+	uint8_t over;
+
+	while ((i < len) && (h -> state < HS_DONE)){
+		lf = memchr(data + i, '\n', len - i);
+		if (lf == NULL){
+			//line continues in the next segment
+			line_add(h, data + i, len - i);
+			i = len;
+			break;
+		}
+		if (h -> line_len == 0){
+			//whole line in this segment, it is not copied
+			s = (const char *)data + i;
+			n = lf - (data + i);
+			over = 0;
+		}
+		else{
+			line_add(h, data + i, lf - (data + i));
+			s = h -> line;
+			n = h -> line_len;
+			over = h -> line_over;
+			h -> line_len = 0;
+			h -> line_over = 0;
+		}
+		i = lf - data + 1;
+		if ((n > 0) && (s[n - 1] == '\r')){
+			n--;
+		}
+		parse_line(h, s, n, over);
+	}
+	*used = i;
+	h -> total += i;
+	if (h -> total > WS_HS_MAX_LEN){
+		h -> state = HS_ERROR;
+	}
+	if (h -> state == HS_ERROR){
+		return WS_HS_ERROR;
+	}
+	if (h -> state != HS_DONE){
+		return WS_HS_MORE;
+	}
+	if (h -> ext_over == 1){
+		//cut offers could be misread, none is taken
+		h -> ext_len = 0;
+	}
+	else if (h -> ext_len >= 2){
+		//remove ", " after the last extensions header
+		h -> ext_len -= 2;
+	}
+	h -> ext[h -> ext_len] = 0;
+	return (h -> flags == WS_HS_ALL) ? WS_HS_DONE : WS_HS_ERROR;
+}
+
+// ****************************************************************************
+//Sec-WebSocket-Accept value of the key: base64(SHA-1(key + GUID)),
+//accept must have WS_HS_ACCEPT_LEN + 1 bytes
+void ws_hs_accept(const char *key, char *accept){
+	uint8_t buf[WS_HS_KEY_LEN + sizeof(guid)], sha[SHA1_RES_LEN + 1];
+	uint32_t v;
+	int i;
+
+	memcpy(buf, key, WS_HS_KEY_LEN);
+	memcpy(buf + WS_HS_KEY_LEN, guid, sizeof(guid) - 1);
+	esp_sha(SHA1, buf, WS_HS_KEY_LEN + sizeof(guid) - 1, sha);
+
+	//20 bytes: 6 groups of 3 bytes and 2 bytes with one '=' of padding
+	sha[SHA1_RES_LEN] = 0;
+	for (i = 0; i < 7; i++){
+		v = (sha[3*i] << 16) | (sha[3*i + 1] << 8) | sha[3*i + 2];
+		accept[4*i] = base64_table[v >> 18];
+		accept[4*i + 1] = base64_table[(v >> 12) & 0x3F];
+		accept[4*i + 2] = base64_table[(v >> 6) & 0x3F];
+		accept[4*i + 3] = base64_table[v & 0x3F];
+	}
+	accept[WS_HS_ACCEPT_LEN - 1] = '=';
+	accept[WS_HS_ACCEPT_LEN] = 0;
+}
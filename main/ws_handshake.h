@@ -0,0 +1,59 @@
+/*
+ * ws_handshake.h
+ *
+ *  Incremental parser of the HTTP upgrade request and Sec-WebSocket-Accept
+ *  key generation.
+ *
+ *  The request is parsed line by line as it arrives, it may be split over any
+ *  number of segments. Line ends are found with memchr(), a line which is
+ *  split over segments is collected in the parser state (the beginning and
+ *  the end of longer lines are kept). The request line must be
+ *  "GET /... HTTP/1.1", header names and the Upgrade/Connection tokens are
+ *  matched case-insensitively, only the values needed for the answer (key,
+ *  extension offers) are kept, nothing is allocated.
+ */
+
+#ifndef MAIN_WS_HANDSHAKE_H_
+#define MAIN_WS_HANDSHAKE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define WS_HS_LINE_LEN		128	//split line, longest extensions header
+#define WS_HS_LINE_TAIL		16	//end of a longer split line, HTTP version
+#define WS_HS_KEY_LEN		24	//base64 of 16 bytes
+#define WS_HS_EXT_LEN		96	//extension offers, longer ones are ignored
+#define WS_HS_ACCEPT_LEN	28	//base64 of SHA-1
+#define WS_HS_MAX_LEN		4096 //max request length
+
+#define WS_HS_MORE			0	//request not finished yet
+#define WS_HS_DONE			1	//valid upgrade request
+#define WS_HS_ERROR			-1	//not a websocket upgrade request
+
+//headers found in the request
+#define WS_HS_UPGRADE		0x01	//Upgrade: websocket
+#define WS_HS_CONNECTION	0x02	//Connection: ..., Upgrade
+#define WS_HS_VERSION		0x04	//Sec-WebSocket-Version: 13
+#define WS_HS_KEY			0x08	//Sec-WebSocket-Key
+#define WS_HS_ALL			0x0F
+
+typedef struct ws_hs{
+	uint16_t total;			//bytes parsed
+	uint8_t state;
+	uint8_t flags;			//WS_HS_UPGRADE ...
+	uint8_t key_len;		//0xFF repeated or wrong key
+	uint8_t ext_len;
+	uint8_t ext_over:1;		//offers do not fit in ext
+	uint8_t line_over:1;	//middle of the split line is dropped
+	uint8_t line_len;		//bytes in line
+	uint16_t version;		//0xFFFF repeated or wrong version
+	char line[WS_HS_LINE_LEN];	//line split over segments
+	char key[WS_HS_KEY_LEN + 1];
+	char ext[WS_HS_EXT_LEN];	//Sec-WebSocket-Extensions values, ", " joined
+} ws_hs_t;
+
+void ws_hs_init(ws_hs_t *h);
+int8_t ws_hs_parse(ws_hs_t *h, const uint8_t *data, size_t len, size_t *used);
+void ws_hs_accept(const char *key, char *accept);
+
+#endif /* MAIN_WS_HANDSHAKE_H_ */
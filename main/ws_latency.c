@@ -0,0 +1,86 @@
+/*
+ * ws_latency.c
+ *
+ *  Log-linear latency histograms, one per pipeline stage, updated without
+ *  locks by any task.
+ */
+
+#include <string.h>
+
+#include "ws_latency.h"
+
+#if WS_LATENCY
+
+#define WS_LAT_SUB			(1 << WS_LAT_SUB_BITS)
+
+static ws_lat_hist_t hist[WS_LAT_STAGES];
+
+// ****************************************************************************
+//bucket of a time: v < 8 - bucket v, otherwise 8 buckets per power of 2
+static uint16_t ws_lat_index(uint32_t us){
+	uint32_t e, i;
+
+	if (us < WS_LAT_SUB){
+		return us;
+	}
+	e = 31 - __builtin_clz(us);
+	i = ((e - WS_LAT_SUB_BITS + 1) << WS_LAT_SUB_BITS) +
+			((us >> (e - WS_LAT_SUB_BITS)) & (WS_LAT_SUB - 1));
+	return (i < WS_LAT_BUCKETS) ? i : WS_LAT_BUCKETS - 1;
+}
+
+// ****************************************************************************
+//longest time counted in bucket i
+uint32_t ws_lat_bucket_max(uint16_t i){
+	uint32_t e;
+
+	if (i < WS_LAT_SUB){
+		return i;
+	}
+	e = (i >> WS_LAT_SUB_BITS) + WS_LAT_SUB_BITS - 1;
+	return ((WS_LAT_SUB + (i & (WS_LAT_SUB - 1)) + 1) << (e - WS_LAT_SUB_BITS)) - 1;
+}
+
+// ****************************************************************************
+void ws_lat_record(WS_LAT_STAGE stage, uint32_t us){
+	ws_lat_hist_t *h = &hist[stage];
+	uint32_t old;
+
+	__atomic_add_fetch(&h -> bucket[ws_lat_index(us)], 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&h -> count, 1, __ATOMIC_RELAXED);
+	old = __atomic_load_n(&h -> max, __ATOMIC_RELAXED);
+	while ((us > old) && !__atomic_compare_exchange_n(&h -> max, &old, us, 1,
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+// ****************************************************************************
+//copy of the stage histogram, it may change while it is copied
+void ws_lat_get(WS_LAT_STAGE stage, ws_lat_hist_t *h){
+	memcpy(h, &hist[stage], sizeof(ws_lat_hist_t));
+}
+
+// ****************************************************************************
+void ws_lat_reset(void){
+	memset(hist, 0, sizeof(hist));
+}
+
+// ****************************************************************************
+//time (upper bound of the bucket) not exceeded by pct % of the samples
+uint32_t ws_lat_percentile(const ws_lat_hist_t *h, uint8_t pct){
+	uint64_t need, sum = 0;
+
+	if (h -> count == 0){
+		return 0;
+	}
+	need = ((uint64_t)h -> count * pct + 99) / 100;
+	for (uint16_t i = 0; i < WS_LAT_BUCKETS; i++){
+		sum += h -> bucket[i];
+		if ((sum >= need) && (sum > 0)){
+			return (ws_lat_bucket_max(i) < h -> max) ? ws_lat_bucket_max(i) :
+					h -> max;
+		}
+	}
+	return h -> max;
+}
+
+#endif
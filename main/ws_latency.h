@@ -0,0 +1,62 @@
+/*
+ * ws_latency.h
+ *
+ *  Latency histograms of the send and receive pipeline stages.
+ *
+ *  Built only with WS_LATENCY=1 (e.g. -DWS_LATENCY=1 in the component
+ *  CFLAGS), otherwise the timestamps are not in the queue items and frames
+ *  and the macros are empty. Every stage has a log-linear histogram of
+ *  microseconds: values below 8 have own buckets, above that every power
+ *  of 2 is split into 8 buckets (12.5 % resolution), up to 2^26 us (67 s).
+ */
+
+#ifndef MAIN_WS_LATENCY_H_
+#define MAIN_WS_LATENCY_H_
+
+#include <stdint.h>
+
+#ifndef WS_LATENCY
+#define WS_LATENCY			0
+#endif
+
+#define WS_LAT_SUB_BITS		3	//buckets per power of 2: 2^3
+#define WS_LAT_MAX_EXP		26	//longest time 2^26 us
+#define WS_LAT_BUCKETS		(((WS_LAT_MAX_EXP - WS_LAT_SUB_BITS + 1) << \
+		WS_LAT_SUB_BITS) + (1 << WS_LAT_SUB_BITS))
+
+//pipeline stages
+typedef enum {
+	WS_LAT_OUT_QUEUE = 0,	//ws_send() -> taken by the send task
+	WS_LAT_TX,				//taken by the send task -> written to the client
+							//(client's frame queue and writing)
+	WS_LAT_WRITE,			//one netconn/socket write call
+	WS_LAT_RX,				//first frame header of a message (or end of the
+							//previous part) -> message queued for the app
+	WS_LAT_IN_QUEUE,		//queued for the app -> taken with ws_recv()
+	WS_LAT_STAGES
+} WS_LAT_STAGE;
+
+typedef struct ws_lat_hist{
+	uint32_t count;
+	uint32_t max;			//us
+	uint32_t bucket[WS_LAT_BUCKETS];
+} ws_lat_hist_t;
+
+#if WS_LATENCY
+#include "esp_timer.h"
+
+#define WS_LAT_NOW()			((uint32_t)esp_timer_get_time())
+#define WS_LAT_STAMP(t)			((t) = WS_LAT_NOW())
+#define WS_LAT_SINCE(stage, t)	ws_lat_record((stage), WS_LAT_NOW() - (t))
+
+void ws_lat_record(WS_LAT_STAGE stage, uint32_t us);
+void ws_lat_get(WS_LAT_STAGE stage, ws_lat_hist_t *h);
+void ws_lat_reset(void);
+uint32_t ws_lat_percentile(const ws_lat_hist_t *h, uint8_t pct);
+uint32_t ws_lat_bucket_max(uint16_t i);
+#else
+#define WS_LAT_STAMP(t)
+#define WS_LAT_SINCE(stage, t)
+#endif
+
+#endif /* MAIN_WS_LATENCY_H_ */
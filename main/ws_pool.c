@@ -0,0 +1,291 @@
+/*
+ * ws_pool.c
+ *
+ *  Fixed size block pools for queue items, frames and message payloads.
+ */
+
+#include <stdio.h>
+#include <sys/param.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+#include "websocket_server.h"
+#include "ws_frame.h"
+#include "ws_pool.h"
+
+#define WS_POOL_ALIGN		8
+
+static ws_pool_t item_pool;
+static ws_pool_t frame_pool;
+static ws_pool_t buf_pool[WS_POOL_CLASSES];
+
+// ****************************************************************************
+//allocate nr blocks of size bytes and link them in the free list
+int8_t ws_pool_create(ws_pool_t *p, uint32_t size, uint16_t nr){
+	uint8_t *b;
+
+	memset(p, 0, sizeof(ws_pool_t));
+	vPortCPUInitializeMutex(&p -> lock);
+	if (nr == 0){
+		return 0;
+	}
+	size = (MAX(size, sizeof(void *)) + WS_POOL_ALIGN - 1) & ~(WS_POOL_ALIGN - 1);
+	p -> mem = malloc((size_t)size * nr);
+	if (p -> mem == NULL){
+		return -1;
+	}
+	p -> size = size;
+	p -> nr = nr;
+	for (int i = nr - 1; i >= 0; i--){
+		b = p -> mem + (size_t)i * size;
+		*(void **)b = p -> free_list;
+		p -> free_list = b;
+	}
+	return 0;
+}
+
+// ****************************************************************************
+//take block from the pool, NULL if the pool is empty or not used
+void *ws_pool_alloc(ws_pool_t *p){
+	void *b;
+
+	if (p -> mem == NULL){
+		return NULL;
+	}
+	portENTER_CRITICAL(&p -> lock);
+	b = p -> free_list;
+	if (b != NULL){
+		p -> free_list = *(void **)b;
+		p -> used++;
+		p -> allocs++;
+		if (p -> used > p -> high_water){
+			p -> high_water = p -> used;
+		}
+	}
+	else{
+		p -> misses++;
+	}
+	portEXIT_CRITICAL(&p -> lock);
+	return b;
+}
+
+// ****************************************************************************
+//return block to the pool, it must be owned by the pool
+void ws_pool_free(ws_pool_t *p, void *block){
+	portENTER_CRITICAL(&p -> lock);
+	*(void **)block = p -> free_list;
+	p -> free_list = block;
+	p -> used--;
+	portEXIT_CRITICAL(&p -> lock);
+}
+
+// ****************************************************************************
+//block belongs to the pool
+uint8_t ws_pool_owns(const ws_pool_t *p, const void *block){
+	const uint8_t *b = block;
+
+	return (p -> mem != NULL) && (b >= p -> mem) &&
+			(b < p -> mem + (size_t)p -> size * p -> nr);
+}
+
+// ****************************************************************************
+void ws_pool_get_stats(ws_pool_t *p, ws_pool_stats_t *st){
+	portENTER_CRITICAL(&p -> lock);
+	st -> size = p -> size;
+	st -> nr = p -> nr;
+	st -> used = p -> used;
+	st -> high_water = p -> high_water;
+	st -> allocs = p -> allocs;
+	st -> misses = p -> misses;
+	portEXIT_CRITICAL(&p -> lock);
+}
+
+// ****************************************************************************
+//create server pools once, item_nr items and frames, payload classes must
+//be given in ascending size; pools are kept when the server is started
+//again (blocks may still be held by the application), so a later call
+//must give the same configuration, returns -1 if it does not
+int8_t ws_pools_init(uint16_t item_nr, const ws_pool_cfg_t *buf){
+	static uint8_t done = 0;
+	static uint16_t done_item_nr;
+	static ws_pool_cfg_t done_buf[WS_POOL_CLASSES];
+	int8_t ret = 0;
+
+	if (done == 1){
+		if ((item_nr != done_item_nr) ||
+				(memcmp(buf, done_buf, sizeof(done_buf)) != 0)){
+			printf("ws pools, already created with another configuration\n");
+			return -1;
+		}
+		return 0;
+	}
+	ret |= ws_pool_create(&item_pool, sizeof(ws_queue_item_t), item_nr);
+	ret |= ws_pool_create(&frame_pool, sizeof(ws_frame_t), item_nr);
+	for (int i = 0; i < WS_POOL_CLASSES; i++){
+		ret |= ws_pool_create(&buf_pool[i], buf[i].size, buf[i].nr);
+	}
+	if (ret != 0){
+		//no block was given out yet, next call tries again
+		free(item_pool.mem);
+		free(frame_pool.mem);
+		for (int i = 0; i < WS_POOL_CLASSES; i++){
+			free(buf_pool[i].mem);
+		}
+		memset(&item_pool, 0, sizeof(ws_pool_t));
+		memset(&frame_pool, 0, sizeof(ws_pool_t));
+		memset(buf_pool, 0, sizeof(buf_pool));
+		printf("ws pools, no heap memory\n");
+		return ret;
+	}
+	done = 1;
+	done_item_nr = item_nr;
+	memcpy(done_buf, buf, sizeof(done_buf));
+	return 0;
+}
+
+// ****************************************************************************
+//block from the pool if it is not empty, otherwise from the heap
+static void *pool_or_heap(ws_pool_t *p, size_t size){
+	void *b = ws_pool_alloc(p);
+
+	return (b != NULL) ? b : malloc(size);
+}
+
+// ****************************************************************************
+static void pool_or_heap_free(ws_pool_t *p, void *b){
+	if (ws_pool_owns(p, b)){
+		ws_pool_free(p, b);
+	}
+	else{
+		free(b);
+	}
+}
+
+// ****************************************************************************
+//new queue item, all fields are 0
+ws_queue_item_t *ws_item_alloc(void){
+	ws_queue_item_t *item = pool_or_heap(&item_pool, sizeof(ws_queue_item_t));
+
+	if (item != NULL){
+		memset(item, 0, sizeof(ws_queue_item_t));
+		//items queued by the server are sent right after allocation
+		WS_LAT_STAMP(item -> t_us);
+	}
+	return item;
+}
+
+// ****************************************************************************
+//release item and its payload (if not owned by the caller)
+void ws_item_free(ws_queue_item_t *item){
+	if (item == NULL){
+		return;
+	}
+	if (item -> keep == 0){
+		ws_buf_free(item -> payload);
+	}
+	pool_or_heap_free(&item_pool, item);
+}
+
+// ****************************************************************************
+ws_frame_t *ws_frame_alloc(void){
+	return pool_or_heap(&frame_pool, sizeof(ws_frame_t));
+}
+
+// ****************************************************************************
+void ws_frame_free(ws_frame_t *f){
+	pool_or_heap_free(&frame_pool, f);
+}
+
+// ****************************************************************************
+//payload buffer from the smallest class it fits in, when that class is empty
+//from the next larger one which is not (the empty one counts a miss), larger
+//buffers and buffers no class can give come from the heap
+void *ws_buf_alloc(size_t size){
+	void *b;
+
+	for (int i = 0; i < WS_POOL_CLASSES; i++){
+		if ((buf_pool[i].mem != NULL) && (size <= buf_pool[i].size)){
+			b = ws_pool_alloc(&buf_pool[i]);
+			if (b != NULL){
+				return b;
+			}
+		}
+	}
+	return malloc((size > 0) ? size : 1);
+}
+
+// ****************************************************************************
+//resize buffer, used bytes are kept, NULL if there is no memory (buf is
+//not released then)
+void *ws_buf_realloc(void *buf, size_t used, size_t size){
+	void *b;
+	int i;
+
+	if (buf == NULL){
+		return ws_buf_alloc(size);
+	}
+	for (i = 0; i < WS_POOL_CLASSES; i++){
+		if (ws_pool_owns(&buf_pool[i], buf)){
+			if (size <= buf_pool[i].size){
+				return buf;
+			}
+			break;
+		}
+	}
+	if (i == WS_POOL_CLASSES){
+		//heap buffer stays on the heap if no class is large enough
+		for (i = 0; i < WS_POOL_CLASSES; i++){
+			if ((buf_pool[i].mem != NULL) && (size <= buf_pool[i].size)){
+				break;
+			}
+		}
+		if (i == WS_POOL_CLASSES){
+			return realloc(buf, size);
+		}
+	}
+	b = ws_buf_alloc(size);
+	if (b == NULL){
+		return NULL;
+	}
+	memcpy(b, buf, MIN(used, size));
+	ws_buf_free(buf);
+	return b;
+}
+
+// ****************************************************************************
+//release pool or heap buffer
+void ws_buf_free(void *buf){
+	if (buf == NULL){
+		return;
+	}
+	for (int i = 0; i < WS_POOL_CLASSES; i++){
+		if (ws_pool_owns(&buf_pool[i], buf)){
+			ws_pool_free(&buf_pool[i], buf);
+			return;
+		}
+	}
+	free(buf);
+}
+
+// ****************************************************************************
+//statistics of items, frames and used payload classes, returns number of
+//filled entries
+uint8_t ws_get_pool_stats(ws_pool_stats_t *st, uint8_t max){
+	uint8_t n = 0;
+
+	if (n < max){
+		ws_pool_get_stats(&item_pool, &st[n++]);
+	}
+	if (n < max){
+		ws_pool_get_stats(&frame_pool, &st[n++]);
+	}
+	for (int i = 0; (i < WS_POOL_CLASSES) && (n < max); i++){
+		if (buf_pool[i].mem != NULL){
+			ws_pool_get_stats(&buf_pool[i], &st[n++]);
+		}
+	}
+	return n;
+}
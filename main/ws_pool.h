@@ -0,0 +1,67 @@
+/*
+ * ws_pool.h
+ *
+ *  Fixed size block pools for queue items, frames and message payloads.
+ *  Every pool is one heap block allocated at start, free blocks are kept
+ *  in a list, so allocation and release take constant time and do not
+ *  fragment the heap. When a pool is empty (or not configured) memory
+ *  comes from the heap and the miss is counted, every free function
+ *  accepts both pool and heap blocks.
+ */
+
+#ifndef MAIN_WS_POOL_H_
+#define MAIN_WS_POOL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "freertos/FreeRTOS.h"
+
+#define WS_POOL_CLASSES		3	//payload size classes
+
+//payload size class, nr equal to 0 - class not used
+typedef struct ws_pool_cfg{
+	uint32_t size;			//block size in bytes
+	uint16_t nr;			//number of blocks
+} ws_pool_cfg_t;
+
+typedef struct ws_pool_stats{
+	uint32_t size;			//block size
+	uint16_t nr;			//blocks in the pool
+	uint16_t used;			//blocks in use now
+	uint16_t high_water;	//max blocks in use
+	uint32_t allocs;		//allocations served by the pool
+	uint32_t misses;		//allocations when the pool was empty
+} ws_pool_stats_t;
+
+typedef struct ws_pool{
+	uint8_t *mem;			//nr blocks, NULL if the pool is not used
+	void *free_list;		//first free block, it holds the next one
+	uint32_t size;
+	uint16_t nr;
+	uint16_t used;
+	uint16_t high_water;
+	uint32_t allocs;
+	uint32_t misses;
+	portMUX_TYPE lock;
+} ws_pool_t;
+
+struct ws_frame;
+
+//single pool
+int8_t ws_pool_create(ws_pool_t *p, uint32_t size, uint16_t nr);
+void *ws_pool_alloc(ws_pool_t *p);
+void ws_pool_free(ws_pool_t *p, void *block);
+uint8_t ws_pool_owns(const ws_pool_t *p, const void *block);
+void ws_pool_get_stats(ws_pool_t *p, ws_pool_stats_t *st);
+
+//server pools: queue items, frames and payload size classes
+int8_t ws_pools_init(uint16_t item_nr, const ws_pool_cfg_t *buf);
+struct ws_frame *ws_frame_alloc(void);
+void ws_frame_free(struct ws_frame *f);
+void *ws_buf_alloc(size_t size);
+void *ws_buf_realloc(void *buf, size_t used, size_t size);
+void ws_buf_free(void *buf);
+uint8_t ws_get_pool_stats(ws_pool_stats_t *st, uint8_t max);
+
+#endif /* MAIN_WS_POOL_H_ */
@@ -0,0 +1,88 @@
+/*
+ * ws_sensor.c
+ *
+ *  Binary sensor batches, records are written in place as they are added.
+ */
+
+#include "ws_sensor.h"
+
+// ****************************************************************************
+static void put16(uint8_t *p, uint16_t v){
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+// ****************************************************************************
+static void put32(uint8_t *p, uint32_t v){
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+// ****************************************************************************
+static uint32_t get32(const uint8_t *p){
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+			((uint32_t)p[3] << 24);
+}
+
+// ****************************************************************************
+//batch of up to cap records in buf (WS_SENSOR_LEN(cap) bytes)
+void ws_sensor_init(ws_sensor_batch_t *b, uint8_t *buf, uint8_t cap){
+	b -> buf = buf;
+	b -> cap = cap;
+	ws_sensor_reset(b);
+}
+
+// ****************************************************************************
+//start the next batch in the same buffer
+void ws_sensor_reset(ws_sensor_batch_t *b){
+	b -> nr = 0;
+	b -> t0_ms = 0;
+	b -> buf[0] = WS_SENSOR_VERSION;
+	b -> buf[1] = 0;
+	put32(b -> buf + 2, 0);
+}
+
+// ****************************************************************************
+//append reading value * 10^exp of sensor id taken at t_ms, returns 1,
+//0 if the batch is full or t_ms is more than 65535 ms after the first
+//record (the batch should be sent first)
+int8_t ws_sensor_add(ws_sensor_batch_t *b, uint8_t id, int32_t value,
+		int8_t exp, uint32_t t_ms){
+	uint8_t *r;
+
+	if (b -> nr == 0){
+		b -> t0_ms = t_ms;
+		put32(b -> buf + 2, t_ms);
+	}
+	if ((b -> nr == b -> cap) || (t_ms - b -> t0_ms > 0xFFFF)){
+		return 0;
+	}
+	r = b -> buf + WS_SENSOR_LEN(b -> nr);
+	r[0] = id;
+	r[1] = (uint8_t)exp;
+	put16(r + 2, t_ms - b -> t0_ms);
+	put32(r + 4, (uint32_t)value);
+	b -> buf[1] = ++b -> nr;
+	return 1;
+}
+
+// ****************************************************************************
+//record i of a received batch, returns 1 or -1 if there is no such record
+//or the batch is not valid
+int8_t ws_sensor_read(const uint8_t *buf, size_t len, uint8_t i,
+		ws_sensor_rec_t *rec){
+	const uint8_t *r;
+
+	if ((len < WS_SENSOR_HEAD_LEN) || (buf[0] != WS_SENSOR_VERSION) ||
+			(i >= buf[1]) || (len < (size_t)WS_SENSOR_LEN(buf[1]))){
+		return -1;
+	}
+	r = buf + WS_SENSOR_LEN(i);
+	rec -> id = r[0];
+	rec -> exp = (int8_t)r[1];
+	rec -> t_ms = get32(buf + 2) + ((uint32_t)r[2] | ((uint32_t)r[3] << 8));
+	rec -> value = (int32_t)get32(r + 4);
+	return 1;
+}
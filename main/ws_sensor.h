@@ -0,0 +1,58 @@
+/*
+ * ws_sensor.h
+ *
+ *  Compact binary form of sensor readings, sent as WS_OP_BIN frames in
+ *  batches instead of one JSON text per reading. Fixed schema, little
+ *  endian:
+ *
+ *	batch header (6 bytes)
+ *		0	uint8_t		WS_SENSOR_VERSION
+ *		1	uint8_t		number of records
+ *		2	uint32_t	t0, ms (time of the first record)
+ *	record (8 bytes)
+ *		0	uint8_t		sensor id (defined by the application)
+ *		1	int8_t		decimal exponent: reading = value * 10^exp
+ *		2	uint16_t	ms after t0
+ *		4	int32_t		value
+ *
+ *  The decoder for browsers is in www_test/sensors.js.
+ */
+
+#ifndef MAIN_WS_SENSOR_H_
+#define MAIN_WS_SENSOR_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define WS_SENSOR_VERSION		1
+#define WS_SENSOR_HEAD_LEN		6
+#define WS_SENSOR_REC_LEN		8
+#define WS_SENSOR_LEN(n)		(WS_SENSOR_HEAD_LEN + (n) * WS_SENSOR_REC_LEN)
+
+typedef struct ws_sensor_batch{
+	uint8_t *buf;			//WS_SENSOR_LEN(cap) bytes
+	uint8_t cap;			//records
+	uint8_t nr;				//records in buf
+	uint32_t t0_ms;			//time of the first record
+} ws_sensor_batch_t;
+
+typedef struct ws_sensor_rec{
+	uint8_t id;
+	int8_t exp;
+	uint32_t t_ms;
+	int32_t value;
+} ws_sensor_rec_t;
+
+void ws_sensor_init(ws_sensor_batch_t *b, uint8_t *buf, uint8_t cap);
+void ws_sensor_reset(ws_sensor_batch_t *b);
+int8_t ws_sensor_add(ws_sensor_batch_t *b, uint8_t id, int32_t value,
+		int8_t exp, uint32_t t_ms);
+int8_t ws_sensor_read(const uint8_t *buf, size_t len, uint8_t i,
+		ws_sensor_rec_t *rec);
+
+//bytes of the encoded batch
+static inline size_t ws_sensor_len(const ws_sensor_batch_t *b){
+	return WS_SENSOR_LEN(b -> nr);
+}
+
+#endif /* MAIN_WS_SENSOR_H_ */
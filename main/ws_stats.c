@@ -0,0 +1,248 @@
+/*
+ * ws_stats.c
+ *
+ *  JSON form of the server statistics and its periodic push to an admin
+ *  connection. Only the public server API is used.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <inttypes.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/timers.h"
+
+#include "websocket_server.h"
+#include "ws_stats.h"
+
+#define WS_STATS_JSON_LEN		1024	//server part of the snapshot
+#define WS_STATS_CONN_JSON_LEN	448		//one connection
+#define WS_STATS_PUSH_STACK		3072
+#define WS_STATS_PUSH_PRIO		1
+
+static TimerHandle_t push_timer;
+static xSemaphoreHandle push_sem;	//given by the timer, taken by push task
+static volatile int8_t push_index = -1;	//-1: not pushing
+static uint32_t push_id;		//admin connection, not the next one at index
+
+// ****************************************************************************
+//text is added at pos, pos is set beyond size if it does not fit
+static void json_add(char *buf, size_t size, size_t *pos, const char *fmt, ...){
+	va_list args;
+	int n;
+
+	if (*pos >= size){
+		return;
+	}
+	va_start(args, fmt);
+	n = vsnprintf(buf + *pos, size - *pos, fmt, args);
+	va_end(args);
+	*pos = (n < 0) ? size : *pos + n;
+}
+
+// ****************************************************************************
+//close codes with their numbers, only codes which were used
+static void json_codes(char *buf, size_t size, size_t *pos, const char *name,
+		const uint32_t *codes){
+	const char *sep = "";
+
+	json_add(buf, size, pos, ",\"%s\":{", name);
+	for (int i = 0; i < WS_STATS_CLOSE_NR; i++){
+		if (codes[i] == 0){
+			continue;
+		}
+		if (i == WS_STATS_CLOSE_OTHER){
+			json_add(buf, size, pos, "%s\"other\":%" PRIu32, sep, codes[i]);
+		}
+		else{
+			json_add(buf, size, pos, "%s\"%i\":%" PRIu32, sep, 1000 + i,
+					codes[i]);
+		}
+		sep = ",";
+	}
+	json_add(buf, size, pos, "}");
+}
+
+// ****************************************************************************
+//snapshot as {"type":"stats","data":{...,"conns":[...]}}, returns its
+//length or 0 if it does not fit in size bytes
+size_t ws_stats_json(const ws_server_stats_t *st, const ws_conn_stats_t *conn,
+		uint8_t conn_nr, char *buf, size_t size){
+	const ws_conn_stats_t *c;
+	size_t pos = 0;
+
+	json_add(buf, size, &pos, "{\"type\":\"stats\",\"data\":{\"uptime\":%" PRIu32
+			",\"accepts\":%" PRIu32 ",\"busy\":%" PRIu32 ",\"handshakes\":%" PRIu32
+			",\"handshake_errors\":%" PRIu32 ",\"ping_timeouts\":%" PRIu32
+			",\"idle_timeouts\":%" PRIu32 ",\"stall_timeouts\":%" PRIu32
+			",\"open\":%u", st -> uptime_s, st -> accepts, st -> busy,
+			st -> handshakes, st -> handshake_errors, st -> ping_timeouts,
+			st -> idle_timeouts, st -> stall_timeouts, st -> open);
+	json_add(buf, size, &pos, ",\"frames_in\":%" PRIu32 ",\"msgs_in\":%" PRIu32
+			",\"bytes_in\":%" PRIu64 ",\"frames_out\":%" PRIu32 ",\"bytes_out\":%"
+			PRIu64 ",\"writes\":%" PRIu32 ",\"drops\":%" PRIu32 ",\"conflated\":%"
+			PRIu32 ",\"write_errors\":%" PRIu32, st -> frames_in, st -> msgs_in,
+			st -> bytes_in, st -> frames_out, st -> bytes_out, st -> writes,
+			st -> drops, st -> conflated, st -> write_errors);
+	json_add(buf, size, &pos, ",\"out_queue\":%u,\"out_queue_hw\":%u"
+			",\"in_queue\":%u,\"in_queue_hw\":%u", st -> out_queue,
+			st -> out_queue_high_water, st -> in_queue, st -> in_queue_high_water);
+	json_codes(buf, size, &pos, "close_sent", st -> close_sent);
+	json_codes(buf, size, &pos, "close_recv", st -> close_recv);
+	json_add(buf, size, &pos, ",\"heap_free\":%" PRIu32 ",\"heap_min_free\":%"
+			PRIu32 ",\"conns\":[", st -> heap_free, st -> heap_min_free);
+	for (uint8_t i = 0; i < conn_nr; i++){
+		c = &conn[i];
+		json_add(buf, size, &pos, "%s{\"id\":%" PRIu32 ",\"index\":%i,"\
+				"\"state\":%u,\"deflate\":%u,\"close_code\":%u,\"frames_in\":%"
+				PRIu32 ",\"msgs_in\":%" PRIu32 ",\"bytes_in\":%" PRIu64,
+				(i == 0) ? "" : ",", c -> id, c -> index, c -> state, c -> deflate,
+				c -> close_code, c -> frames_in, c -> msgs_in, c -> bytes_in);
+		json_add(buf, size, &pos, ",\"frames_out\":%" PRIu32 ",\"bytes_out\":%"
+				PRIu64 ",\"writes\":%" PRIu32 ",\"drops\":%" PRIu32
+				",\"conflated\":%" PRIu32 ",\"write_errors\":%" PRIu32
+				",\"tx_queued\":%u,\"tx_hw\":%u,\"pings\":%" PRIu32 ",\"pongs\":%"
+				PRIu32 ",\"rtt_us\":%" PRIu32 "}", c -> frames_out, c -> bytes_out,
+				c -> writes, c -> drops, c -> conflated, c -> write_errors,
+				c -> tx_queued, c -> tx_high_water, c -> pings, c -> pongs,
+				c -> rtt_us);
+	}
+	json_add(buf, size, &pos, "]}}");
+	return (pos < size) ? pos : 0;
+}
+
+// ****************************************************************************
+//snapshot is sent to the admin connection, pushing stops when it is closed
+static void ws_stats_push_one(void){
+	ws_server_stats_t st;
+	ws_conn_stats_t *conn;
+	ws_queue_item_t *item;
+	uint8_t max = ws_get_max_clients(), nr, open = 0;
+	int8_t index = push_index;
+	size_t size, len = 0;
+	char *buf = NULL;
+
+	if (index < 0){
+		return;
+	}
+	conn = malloc(max * sizeof(ws_conn_stats_t));
+	if (conn == NULL){
+		return;
+	}
+	nr = ws_get_stats(&st, conn, max);
+	for (uint8_t i = 0; i < nr; i++){
+		if ((conn[i].index == index) && (conn[i].id == push_id) &&
+				(conn[i].state == WS_OPEN)){
+			open = 1;
+			break;
+		}
+	}
+	if (open == 0){
+		printf("stats push stopped, index = %i\n", index);
+		push_index = -1;
+		free(conn);
+		return;
+	}
+	size = WS_STATS_JSON_LEN + nr * WS_STATS_CONN_JSON_LEN;
+	buf = ws_buf_alloc(size);
+	if (buf != NULL){
+		len = ws_stats_json(&st, conn, nr, buf, size);
+	}
+	free(conn);
+	item = (len > 0) ? ws_item_alloc() : NULL;
+	if (item == NULL){
+		ws_buf_free(buf);
+		return;
+	}
+	item -> payload = (uint8_t *)buf;
+	item -> len = len;
+	item -> index = index;
+	item -> opcode = WS_OP_TXT;
+	item -> ws_frame = 0x1;
+	//snapshot is skipped if the output queue is full
+	if (ws_send(item, 0) != pdTRUE){
+		ws_item_free(item);
+	}
+}
+
+// ****************************************************************************
+//push task: snapshot takes the shard mutexes and allocates, so it is not
+//built in the timer task (it would hold up all timers)
+static void ws_stats_push_task(void *arg){
+	(void)arg;
+	for (;;){
+		xSemaphoreTake(push_sem, portMAX_DELAY);
+		ws_stats_push_one();
+	}
+}
+
+// ****************************************************************************
+//push timer callback, runs in the timer task: only wakes the push task
+static void ws_stats_push_cb(TimerHandle_t timer){
+	(void)timer;
+	if (push_index >= 0){
+		xSemaphoreGive(push_sem);
+	}
+}
+
+// ****************************************************************************
+//send statistics snapshot to the open connection index every period_ms,
+//index -1 stops pushing; returns 1 or -1 if the connection is not open
+int8_t ws_stats_push(int8_t index, uint32_t period_ms){
+	ws_server_stats_t st;
+	ws_conn_stats_t *conn;
+	uint8_t max = ws_get_max_clients(), nr;
+	int8_t ret = -1;
+
+	push_index = -1;
+	if (push_timer != NULL){
+		xTimerStop(push_timer, 0);
+		xTimerDelete(push_timer, 0);
+		push_timer = NULL;
+	}
+	if ((index < 0) || (period_ms == 0)){
+		return 1;
+	}
+	if (push_sem == NULL){
+		//push task is created with the first push and kept
+		push_sem = xSemaphoreCreateBinary();
+		if (push_sem == NULL){
+			return -1;
+		}
+		if (xTaskCreate(ws_stats_push_task, "ws_stats_push",
+				WS_STATS_PUSH_STACK, NULL, WS_STATS_PUSH_PRIO, NULL) != pdPASS){
+			printf("stats push, no heap memory\n");
+			vSemaphoreDelete(push_sem);
+			push_sem = NULL;
+			return -1;
+		}
+	}
+	conn = malloc(max * sizeof(ws_conn_stats_t));
+	if (conn == NULL){
+		return -1;
+	}
+	nr = ws_get_stats(&st, conn, max);
+	for (uint8_t i = 0; i < nr; i++){
+		if ((conn[i].index == index) && (conn[i].state == WS_OPEN)){
+			push_id = conn[i].id;
+			ret = 1;
+			break;
+		}
+	}
+	free(conn);
+	if (ret != 1){
+		return -1;
+	}
+	push_timer = xTimerCreate("ws_stats", pdMS_TO_TICKS(period_ms), pdTRUE,
+			NULL, ws_stats_push_cb);
+	if (push_timer == NULL){
+		return -1;
+	}
+	push_index = index;
+	xTimerStart(push_timer, 0);
+	return 1;
+}
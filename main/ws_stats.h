@@ -0,0 +1,78 @@
+/*
+ * ws_stats.h
+ *
+ *  Server and connection statistics (ws_get_stats) and their JSON form,
+ *  which can be pushed periodically to an admin connection.
+ *
+ *  Counters are updated without locks by the task owning them (receive
+ *  counters by the receive task, send counters by the send task), a
+ *  snapshot may mix values from slightly different moments.
+ */
+
+#ifndef MAIN_WS_STATS_H_
+#define MAIN_WS_STATS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define WS_STATS_CLOSE_NR		13	//close codes 1000..1011 and others
+#define WS_STATS_CLOSE_OTHER	12
+
+typedef struct ws_conn_stats{
+	uint32_t id;			//number of the connection since start (accepts)
+	int8_t index;
+	uint8_t state;			//WS_STATE
+	uint8_t deflate;		//permessage-deflate negotiated
+	uint16_t close_code;	//last close code sent or received, 0 - none
+	uint32_t frames_in;
+	uint32_t msgs_in;		//data messages
+	uint64_t bytes_in;		//all received bytes, with headers
+	uint32_t frames_out;
+	uint64_t bytes_out;		//all written bytes, with headers
+	uint32_t writes;		//frames or combined frames (tx_coalesce_len) written
+	uint32_t drops;			//frames dropped by tx_policy
+	uint32_t conflated;		//queued frames replaced by newer ones (key)
+	uint32_t write_errors;
+	uint16_t tx_queued;		//frames waiting now
+	uint16_t tx_high_water;	//most frames waiting
+	uint32_t pings;
+	uint32_t pongs;
+	uint32_t rtt_us;		//smoothed heartbeat round trip time, 0 - unknown
+	uint32_t rtt_last_us;	//last heartbeat round trip time
+} ws_conn_stats_t;
+
+//totals include closed connections
+typedef struct ws_server_stats{
+	uint32_t uptime_s;
+	uint32_t accepts;		//TCP connections
+	uint32_t busy;			//refused, no free place (503)
+	uint32_t handshakes;
+	uint32_t handshake_errors;
+	uint32_t ping_timeouts;	//connections closed by the heartbeat
+	uint32_t idle_timeouts;	//connections closed by idle_timeout_ms
+	uint32_t stall_timeouts;	//connections dropped by tx_stall_ms
+	uint16_t open;			//connections in WS_OPEN state
+	uint32_t frames_in;
+	uint32_t msgs_in;
+	uint64_t bytes_in;
+	uint32_t frames_out;
+	uint64_t bytes_out;
+	uint32_t writes;
+	uint32_t drops;
+	uint32_t conflated;
+	uint32_t write_errors;
+	uint16_t out_queue;		//items waiting in the output queues
+	uint16_t out_queue_high_water;
+	uint16_t in_queue;		//items waiting in ws_input_queue
+	uint16_t in_queue_high_water;
+	uint32_t close_sent[WS_STATS_CLOSE_NR];	//index: code - 1000
+	uint32_t close_recv[WS_STATS_CLOSE_NR];
+	uint32_t heap_free;
+	uint32_t heap_min_free;
+} ws_server_stats_t;
+
+size_t ws_stats_json(const ws_server_stats_t *st, const ws_conn_stats_t *conn,
+		uint8_t conn_nr, char *buf, size_t size);
+int8_t ws_stats_push(int8_t index, uint32_t period_ms);
+
+#endif /* MAIN_WS_STATS_H_ */
@@ -0,0 +1,88 @@
+/*
+ * ws_topic.c
+ *
+ *  Topic names and the subscribe/unsubscribe control messages.
+ */
+
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+
+#include "ws_topic.h"
+
+#define WS_TOPIC_SUB		"{\"type\":\"subscribe\",\"topic\":\""
+#define WS_TOPIC_UNSUB		"{\"type\":\"unsubscribe\",\"topic\":\""
+#define WS_TOPIC_END		"\"}"
+
+static char names[WS_TOPIC_MAX][WS_TOPIC_NAME_LEN + 1];
+static uint8_t topic_nr;
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+// ****************************************************************************
+//number of the topic name (len bytes), it is registered if add is 1,
+//returns -1 if it is not known or the table is full
+int8_t ws_topic_find(const char *name, size_t len, uint8_t add){
+	int8_t topic = -1;
+
+	if ((len == 0) || (len > WS_TOPIC_NAME_LEN)){
+		return -1;
+	}
+	portENTER_CRITICAL(&lock);
+	for (uint8_t i = 0; i < topic_nr; i++){
+		if ((strncmp(names[i], name, len) == 0) && (names[i][len] == 0)){
+			topic = i + 1;
+			break;
+		}
+	}
+	if ((topic == -1) && (add == 1) && (topic_nr < WS_TOPIC_MAX)){
+		memcpy(names[topic_nr], name, len);
+		names[topic_nr][len] = 0;
+		topic = ++topic_nr;
+	}
+	portEXIT_CRITICAL(&lock);
+	return topic;
+}
+
+// ****************************************************************************
+//number of the topic, registered if it is new, -1 if the table is full
+int8_t ws_topic(const char *name){
+	return ws_topic_find(name, strlen(name), 1);
+}
+
+// ****************************************************************************
+//names are never removed, so the pointer stays valid
+const char *ws_topic_name(int8_t topic){
+	return ((topic > 0) && (topic <= topic_nr)) ? names[topic - 1] : NULL;
+}
+
+// ****************************************************************************
+//subscribe (sub = 1) or unsubscribe (sub = 0) message, returns the topic,
+//0 if msg is not a control message, -1 if the topic is not registered by
+//the application (clients can not add topics)
+int8_t ws_topic_ctrl(const uint8_t *msg, size_t len, uint8_t *sub){
+	size_t pre, end = sizeof(WS_TOPIC_END) - 1;
+	const char *name;
+
+	if ((len > sizeof(WS_TOPIC_SUB) - 1) &&
+			(memcmp(msg, WS_TOPIC_SUB, sizeof(WS_TOPIC_SUB) - 1) == 0)){
+		pre = sizeof(WS_TOPIC_SUB) - 1;
+		*sub = 1;
+	}
+	else if ((len > sizeof(WS_TOPIC_UNSUB) - 1) &&
+			(memcmp(msg, WS_TOPIC_UNSUB, sizeof(WS_TOPIC_UNSUB) - 1) == 0)){
+		pre = sizeof(WS_TOPIC_UNSUB) - 1;
+		*sub = 0;
+	}
+	else{
+		return 0;
+	}
+	if ((len < pre + end) || (memcmp(msg + len - end, WS_TOPIC_END, end) != 0)){
+		return 0;
+	}
+	name = (const char *)msg + pre;
+	len -= pre + end;
+	if (memchr(name, '"', len) != NULL){
+		return 0;
+	}
+	return ws_topic_find(name, len, 0);
+}
@@ -0,0 +1,30 @@
+/*
+ * ws_topic.h
+ *
+ *  Named topics for publish/subscribe broadcasts. Topics are numbered
+ *  1..WS_TOPIC_MAX in the order they are registered by the application
+ *  (clients can subscribe only to registered topics), a connection keeps its
+ *  subscriptions in a bitset, bit n - 1 for topic n.
+ *
+ *  Clients subscribe with text messages
+ *  {"type":"subscribe","topic":"name"} and
+ *  {"type":"unsubscribe","topic":"name"} (exactly this form, as made by
+ *  JSON.stringify), they are handled by the server and not passed on.
+ */
+
+#ifndef MAIN_WS_TOPIC_H_
+#define MAIN_WS_TOPIC_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define WS_TOPIC_MAX		32	//bits of the subscription set
+#define WS_TOPIC_NAME_LEN	24	//longest name
+#define WS_TOPIC_BIT(t)		(1UL << ((t) - 1))
+
+int8_t ws_topic(const char *name);
+int8_t ws_topic_find(const char *name, size_t len, uint8_t add);
+const char *ws_topic_name(int8_t topic);
+int8_t ws_topic_ctrl(const uint8_t *msg, size_t len, uint8_t *sub);
+
+#endif /* MAIN_WS_TOPIC_H_ */
@@ -0,0 +1,102 @@
+/*
+ * ws_wheel.c
+ *
+ *  Hashed timer wheel, slots are circular doubly linked lists.
+ */
+
+#include <stddef.h>
+
+#include "ws_wheel.h"
+
+#define WS_WHEEL_MASK		(WS_WHEEL_SLOTS - 1)
+
+// ****************************************************************************
+void ws_wheel_init(ws_wheel_t *w, ws_wheel_cb_t cb){
+	for (int i = 0; i < WS_WHEEL_SLOTS; i++){
+		w -> slot[i].next = &w -> slot[i];
+		w -> slot[i].prev = &w -> slot[i];
+	}
+	w -> now = 0;
+	w -> cb = cb;
+	vPortCPUInitializeMutex(&w -> lock);
+}
+
+// ****************************************************************************
+void ws_tm_init(ws_tm_t *t, int8_t index, uint8_t kind){
+	t -> next = NULL;
+	t -> prev = NULL;
+	t -> expire = 0;
+	t -> index = index;
+	t -> kind = kind;
+	t -> id = 0;
+}
+
+// ****************************************************************************
+//caller holds the lock
+static void ws_tm_unlink(ws_tm_t *t){
+	t -> prev -> next = t -> next;
+	t -> next -> prev = t -> prev;
+	t -> next = NULL;
+	t -> prev = NULL;
+}
+
+// ****************************************************************************
+//(re)arm timer to expire in ms (rounded up to ticks, at least one)
+void ws_wheel_arm(ws_wheel_t *w, ws_tm_t *t, uint32_t ms){
+	uint32_t ticks = (ms + WS_WHEEL_TICK_MS - 1) / WS_WHEEL_TICK_MS;
+	ws_tm_t *head;
+
+	portENTER_CRITICAL(&w -> lock);
+	if (t -> prev != NULL){
+		ws_tm_unlink(t);
+	}
+	t -> expire = w -> now + ((ticks > 0) ? ticks : 1);
+	head = &w -> slot[t -> expire & WS_WHEEL_MASK];
+	t -> next = head;
+	t -> prev = head -> prev;
+	head -> prev -> next = t;
+	head -> prev = t;
+	portEXIT_CRITICAL(&w -> lock);
+}
+
+// ****************************************************************************
+void ws_wheel_cancel(ws_wheel_t *w, ws_tm_t *t){
+	portENTER_CRITICAL(&w -> lock);
+	if (t -> prev != NULL){
+		ws_tm_unlink(t);
+	}
+	portEXIT_CRITICAL(&w -> lock);
+}
+
+// ****************************************************************************
+//advance by one tick and run expired timers of the slot, callbacks run
+//without the lock, so the timer may be armed or cancelled meanwhile
+void ws_wheel_tick(ws_wheel_t *w){
+	ws_tm_t *head, *t;
+	int8_t index;
+	uint8_t kind;
+	uint32_t id;
+
+	portENTER_CRITICAL(&w -> lock);
+	w -> now++;
+	head = &w -> slot[w -> now & WS_WHEEL_MASK];
+	for (;;){
+		//timers of later revolutions stay
+		for (t = head -> next; t != head; t = t -> next){
+			if ((int32_t)(w -> now - t -> expire) >= 0){
+				break;
+			}
+		}
+		if (t == head){
+			break;
+		}
+		ws_tm_unlink(t);
+		index = t -> index;
+		kind = t -> kind;
+		id = t -> id;
+		portEXIT_CRITICAL(&w -> lock);
+		w -> cb(index, kind, id);
+		portENTER_CRITICAL(&w -> lock);
+	}
+	portEXIT_CRITICAL(&w -> lock);
+}
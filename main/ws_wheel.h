@@ -0,0 +1,52 @@
+/*
+ * ws_wheel.h
+ *
+ *  Hashed timer wheel for the connection deadlines (handshake, close, idle,
+ *  write stall) and the heartbeat. Timers are embedded in the connection
+ *  state and linked into the slot of their expiry tick, arming and
+ *  cancelling take constant time and allocate nothing. Deadlines longer
+ *  than one revolution stay in their slot until their tick comes.
+ */
+
+#ifndef MAIN_WS_WHEEL_H_
+#define MAIN_WS_WHEEL_H_
+
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+
+#define WS_WHEEL_SLOTS		64	//power of 2
+#define WS_WHEEL_TICK_MS	100	//resolution
+
+typedef struct ws_tm{
+	struct ws_tm *next;
+	struct ws_tm *prev;		//NULL if not armed
+	uint32_t expire;		//tick
+	int8_t index;			//connection, -1 for server timers
+	uint8_t kind;
+	uint32_t id;			//owner of the timer (connection id), the
+							//callback may run after cancelling, it checks it
+} ws_tm_t;
+
+//called in the timer task for every expired timer, it may arm it again
+typedef void (*ws_wheel_cb_t)(int8_t index, uint8_t kind, uint32_t id);
+
+typedef struct ws_wheel{
+	ws_tm_t slot[WS_WHEEL_SLOTS];	//list heads
+	uint32_t now;					//ticks since start
+	ws_wheel_cb_t cb;
+	portMUX_TYPE lock;
+} ws_wheel_t;
+
+void ws_wheel_init(ws_wheel_t *w, ws_wheel_cb_t cb);
+void ws_tm_init(ws_tm_t *t, int8_t index, uint8_t kind);
+void ws_wheel_arm(ws_wheel_t *w, ws_tm_t *t, uint32_t ms);
+void ws_wheel_cancel(ws_wheel_t *w, ws_tm_t *t);
+void ws_wheel_tick(ws_wheel_t *w);
+
+//read without the lock by the only task arming and cancelling the timer
+static inline uint8_t ws_tm_armed(const ws_tm_t *t){
+	return t -> prev != NULL;
+}
+
+#endif /* MAIN_WS_WHEEL_H_ */
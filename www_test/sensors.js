@@ -1,10 +1,26 @@
 var socket = new WebSocket("ws://esp32-ws.local:8080");
+//binary sensor batches (main/ws_sensor.h) come as ArrayBuffer
+socket.binaryType = "arraybuffer";
+
+//sensor ids of the binary records, as in simple_websocket_server.c
+var sensorNames = ["counter", "heap"];
 
 window.addEventListener("load", function(){ //when page loads
         console.log(timeConverter(Date.now()));
 });
 
+//only streams of subscribed topics are sent by the server: "sensors"
+//gives binary batches, "counter" the JSON message with the counter
+socket.onopen = function () {
+	socket.send(JSON.stringify({type: "subscribe", topic: "sensors"}));
+	socket.send(JSON.stringify({type: "subscribe", topic: "counter"}));
+};
+
 socket.onmessage = function (event) {
+	if (event.data instanceof ArrayBuffer) {
+		decodeSensors(event.data).forEach(showSensor);
+		return;
+	}
     var msg = JSON.parse(event.data);
 	var ledTxt = document.getElementById("sensorTwo");
 	var ledPict = document.getElementById("led_picture");
@@ -16,17 +32,43 @@ socket.onmessage = function (event) {
         //var msgData = msg.data;
         switch(msg.data.sensor){
         case "counter":
-		     var s41 = document.getElementById("s4_value");
-		     s41.innerHTML = Number.parseInt(msg.data.value, 0);
-		     var s45 = document.getElementById("s4_time");
-
-			 s45.innerHTML = timeConverter(Date.now());
+		     showSensor({sensor: "counter", value: Number.parseInt(msg.data.value, 0)});
 		     break;
         break;
         }
     }
 };
 
+//records of a binary batch: 6 bytes of header (version, number of records,
+//t0 in ms), 8 bytes per record (id, exponent, ms after t0, value)
+function decodeSensors(buf){
+	var v = new DataView(buf), recs = [];
+
+	if ((v.byteLength < 6) || (v.getUint8(0) != 1)) {
+		return recs;
+	}
+	var nr = v.getUint8(1), t0 = v.getUint32(2, true);
+	for (var i = 0; (i < nr) && (6 + 8 * i + 8 <= v.byteLength); i++) {
+		var o = 6 + 8 * i, id = v.getUint8(o);
+		recs.push({sensor: sensorNames[id] || id,
+			value: v.getInt32(o + 4, true) * Math.pow(10, v.getInt8(o + 1)),
+			t_ms: t0 + v.getUint16(o + 2, true)});
+	}
+	return recs;
+}
+
+function showSensor(rec){
+	switch(rec.sensor) {
+	case "counter":
+		document.getElementById("s4_value").innerHTML = rec.value;
+		document.getElementById("s4_time").innerHTML = timeConverter(Date.now());
+		break;
+	case "heap":
+		document.getElementById("s4_heap").innerHTML = "heap " + rec.value + " B";
+		break;
+	}
+}
+
 //convert UNIX timestamp into time
 function timeConverter(UNIX_timestamp){
   var a = new Date(UNIX_timestamp);